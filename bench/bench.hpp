@@ -0,0 +1,55 @@
+#pragma once
+// Minimal benchmark harness for yarrharr_bench. The API follows Google
+// Benchmark closely enough that the suites could move over unchanged, and
+// the JSON output uses the same schema so its compare.py works on it.
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace bench {
+    class State {
+    public:
+        explicit State(uint64_t iterations) : remaining_(iterations), iterations_(iterations) {}
+
+        bool keepRunning() { return remaining_-- > 0; }
+        uint64_t iterations() const { return iterations_; }
+
+        void setBytesProcessed(int64_t bytes) { bytes_ = bytes; }
+        int64_t bytesProcessed() const { return bytes_; }
+
+        // Extra values reported alongside the timings (memory use, sizes)
+        std::map<std::string, double> counters;
+
+    private:
+        uint64_t remaining_;
+        uint64_t iterations_;
+        int64_t bytes_ = 0;
+    };
+
+    using Function = std::function<void(State&)>;
+
+    struct Registrar {
+        Registrar(const char* name, Function fn);
+    };
+
+    template <typename T>
+    inline void doNotOptimize(const T& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // Points stdout at /dev/null for code that draws progress bars
+    class SilenceStdout {
+    public:
+        SilenceStdout();
+        ~SilenceStdout();
+
+    private:
+        int saved_;
+    };
+}
+
+#define BENCHMARK(name)                                          \
+    static void name(bench::State& state);                       \
+    static bench::Registrar name##_registrar(#name, name);       \
+    static void name(bench::State& state)
@@ -0,0 +1,170 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace {
+    struct Entry {
+        std::string name;
+        bench::Function fn;
+    };
+
+    std::vector<Entry>& registry() {
+        static std::vector<Entry> entries;
+        return entries;
+    }
+
+    struct Sample {
+        double real_ns;
+        double cpu_ns;
+    };
+
+    double threadCpuNs() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+    }
+
+    Sample runOnce(const bench::Function& fn, uint64_t iterations, bench::State& state) {
+        state = bench::State(iterations);
+        double cpuStart = threadCpuNs();
+        auto start = std::chrono::steady_clock::now();
+        fn(state);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return {std::chrono::duration<double, std::nano>(elapsed).count(), threadCpuNs() - cpuStart};
+    }
+
+    nlohmann::json runBenchmark(const Entry& entry, double minTime, int repetitions) {
+        // Grow the iteration count until one run takes long enough to time
+        bench::State state(1);
+        uint64_t iterations = 1;
+        Sample sample = runOnce(entry.fn, iterations, state);
+        while (sample.real_ns < minTime * 1e9 && iterations < (1ull << 40)) {
+            double scale = sample.real_ns > 0 ? minTime * 1e9 * 1.2 / sample.real_ns : 100;
+            iterations = std::max<uint64_t>(iterations * 2, iterations * std::min(scale, 100.0));
+            sample = runOnce(entry.fn, iterations, state);
+        }
+
+        std::vector<Sample> samples{sample};
+        for (int i = 1; i < repetitions; i++) {
+            samples.push_back(runOnce(entry.fn, iterations, state));
+        }
+        std::sort(samples.begin(), samples.end(),
+                  [](const Sample& a, const Sample& b) { return a.real_ns < b.real_ns; });
+        Sample median = samples[samples.size() / 2];
+
+        nlohmann::json result = {
+            {"name", entry.name},
+            {"run_name", entry.name},
+            {"run_type", "iteration"},
+            {"repetitions", repetitions},
+            {"iterations", iterations},
+            {"real_time", median.real_ns / iterations},
+            {"cpu_time", median.cpu_ns / iterations},
+            {"time_unit", "ns"}
+        };
+        if (state.bytesProcessed() > 0) {
+            result["bytes_per_second"] = state.bytesProcessed() / (median.real_ns / 1e9);
+        }
+        for (const auto& [name, value] : state.counters) {
+            result[name] = value;
+        }
+        return result;
+    }
+
+    nlohmann::json context(const char* executable) {
+        char host[256] = {};
+        gethostname(host, sizeof(host) - 1);
+        char date[64];
+        std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+        return {
+            {"date", date},
+            {"host_name", host},
+            {"executable", executable},
+            {"num_cpus", std::thread::hardware_concurrency()},
+#ifdef NDEBUG
+            {"library_build_type", "release"}
+#else
+            {"library_build_type", "debug"}
+#endif
+        };
+    }
+}
+
+namespace bench {
+    Registrar::Registrar(const char* name, Function fn) {
+        registry().push_back({name, std::move(fn)});
+    }
+
+    SilenceStdout::SilenceStdout() {
+        std::cout.flush();
+        std::fflush(stdout);
+        saved_ = dup(STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+
+    SilenceStdout::~SilenceStdout() {
+        std::cout.flush();
+        std::fflush(stdout);
+        dup2(saved_, STDOUT_FILENO);
+        close(saved_);
+    }
+}
+
+// yarrharr_bench [--filter <substring>] [--json <path>] [--min-time <s>] [--repetitions <n>]
+// JSON goes to stdout unless --json is given; the table always goes to stderr.
+int main(int argc, char* argv[]) {
+    std::string filter;
+    std::string jsonPath;
+    double minTime = 0.2;
+    int repetitions = 3;
+    for (int i = 1; i < argc - 1; i++) {
+        std::string option = argv[i];
+        if (option == "--filter") {
+            filter = argv[++i];
+        } else if (option == "--json") {
+            jsonPath = argv[++i];
+        } else if (option == "--min-time") {
+            minTime = std::stod(argv[++i]);
+        } else if (option == "--repetitions") {
+            repetitions = std::max(1, std::stoi(argv[++i]));
+        }
+    }
+
+    auto& entries = registry();
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+
+    nlohmann::json benchmarks = nlohmann::json::array();
+    for (const auto& entry : entries) {
+        if (!filter.empty() && entry.name.find(filter) == std::string::npos) continue;
+
+        auto result = runBenchmark(entry, minTime, repetitions);
+        std::fprintf(stderr, "%-40s %14.1f ns %14.1f ns %12llu", entry.name.c_str(),
+                     result["real_time"].get<double>(), result["cpu_time"].get<double>(),
+                     static_cast<unsigned long long>(result["iterations"].get<uint64_t>()));
+        if (result.contains("bytes_per_second")) {
+            std::fprintf(stderr, "  %.1f MB/s", result["bytes_per_second"].get<double>() / 1e6);
+        }
+        std::fprintf(stderr, "\n");
+        benchmarks.push_back(std::move(result));
+    }
+
+    nlohmann::json report = {{"context", context(argv[0])}, {"benchmarks", benchmarks}};
+    if (jsonPath.empty()) {
+        std::cout << report.dump(2) << "\n";
+    } else {
+        std::ofstream(jsonPath) << report.dump(2) << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+// Compares the old std::vector<Episode> layout against EpisodeStore on a
+// synthetic 10k-episode daily show: resident memory and the per-season
+// lookups done by Downloader::downloadShow.
+#include "bench.hpp"
+#include "episode_store.hpp"
+#include "tmdb.hpp"
+#include <string>
+#include <vector>
+
+namespace {
+    constexpr int SEASONS = 40;
+    constexpr int EPISODES_PER_SEASON = 250;
+
+    size_t stringHeap(const std::string& s) {
+        // libstdc++ keeps strings of up to 15 chars inline
+        return s.capacity() > 15 ? s.capacity() + 1 : 0;
+    }
+
+    std::vector<Episode> makeEpisodes() {
+        std::vector<Episode> episodes;
+        for (int season = 1; season <= SEASONS; season++) {
+            for (int number = 1; number <= EPISODES_PER_SEASON; number++) {
+                Episode ep;
+                ep.season = season;
+                ep.episode = number;
+                ep.name = number % 5 == 0 ? "Episode " + std::to_string(number)
+                                          : "Days of Our Synthetic Lives #" + std::to_string(season * 1000 + number);
+                ep.air_date = number % 7 == 0 ? "Unknown"
+                                              : std::to_string(1980 + season) + "-01-" + std::to_string(10 + number % 18);
+                episodes.push_back(ep);
+            }
+        }
+        return episodes;
+    }
+
+    EpisodeStore makeStore(const std::vector<Episode>& episodes) {
+        EpisodeStore store;
+        store.reserve(episodes.size());
+        for (const auto& ep : episodes) {
+            store.add(ep);
+        }
+        return store;
+    }
+}
+
+BENCHMARK(EpisodeVector_AllSeasons) {
+    auto episodes = makeEpisodes();
+    size_t bytes = episodes.capacity() * sizeof(Episode);
+    for (const auto& ep : episodes) {
+        bytes += stringHeap(ep.name) + stringHeap(ep.air_date);
+    }
+
+    size_t sink = 0;
+    while (state.keepRunning()) {
+        for (int season = 1; season <= SEASONS; season++) {
+            for (const auto& ep : episodes) {
+                if (ep.season == season) sink += ep.name.size();
+            }
+        }
+    }
+    bench::doNotOptimize(sink);
+    state.counters["memory_bytes"] = bytes;
+}
+
+BENCHMARK(EpisodeStore_AllSeasons) {
+    auto store = makeStore(makeEpisodes());
+    size_t sink = 0;
+    while (state.keepRunning()) {
+        for (int season : store.seasons()) {
+            for (const auto& ep : store.season(season)) {
+                sink += ep.name.size();
+            }
+        }
+    }
+    bench::doNotOptimize(sink);
+    state.counters["memory_bytes"] = store.memoryUsage();
+}
+
+BENCHMARK(EpisodeVector_Find) {
+    auto episodes = makeEpisodes();
+    size_t sink = 0;
+    while (state.keepRunning()) {
+        for (const auto& ep : episodes) {
+            if (ep.season == SEASONS && ep.episode == EPISODES_PER_SEASON / 2) {
+                sink += ep.episode;
+                break;
+            }
+        }
+    }
+    bench::doNotOptimize(sink);
+}
+
+BENCHMARK(EpisodeStore_Find) {
+    auto store = makeStore(makeEpisodes());
+    size_t sink = 0;
+    while (state.keepRunning()) {
+        if (auto ep = store.find(SEASONS, EPISODES_PER_SEASON / 2)) sink += ep->episode;
+    }
+    bench::doNotOptimize(sink);
+}
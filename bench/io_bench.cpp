@@ -0,0 +1,54 @@
+// libcurl write and progress callbacks at the chunk sizes curl hands them.
+#include "bench.hpp"
+#include "download_utils.hpp"
+#include <cstdio>
+#include <vector>
+
+namespace {
+    // Writes into a real temporary file, rewound every 64MB so the page
+    // cache rather than the disk is what gets measured
+    void writeChunks(bench::State& state, size_t chunkSize, bool hashed = false) {
+        FILE* sink = std::tmpfile();
+        HashingWriter writer{sink, {}};
+        std::vector<char> chunk(chunkSize, 'x');
+        size_t written = 0;
+        while (state.keepRunning()) {
+            if (hashed) {
+                bench::doNotOptimize(hashingWriteCallback(chunk.data(), 1, chunk.size(), &writer));
+            } else {
+                bench::doNotOptimize(writeCallback(chunk.data(), 1, chunk.size(), sink));
+            }
+            written += chunkSize;
+            if (written >= (64 << 20)) {
+                std::rewind(sink);
+                written = 0;
+            }
+        }
+        std::fclose(sink);
+        state.setBytesProcessed(static_cast<int64_t>(chunkSize) * state.iterations());
+    }
+}
+
+// CURL_MAX_WRITE_SIZE, what curl delivers over HTTP/1.1 and HTTP/2
+BENCHMARK(WriteCallback_16KiB) {
+    writeChunks(state, 16 * 1024);
+}
+
+// The largest chunk curl uses with a raised CURLOPT_BUFFERSIZE
+BENCHMARK(WriteCallback_512KiB) {
+    writeChunks(state, 512 * 1024);
+}
+
+// With dedupe_downloads on, every byte is also fed to SHA-256
+BENCHMARK(HashingWriteCallback_16KiB) {
+    writeChunks(state, 16 * 1024, true);
+}
+
+BENCHMARK(TransferProgressCallback) {
+    TransferProgress progress;
+    curl_off_t now = 0;
+    while (state.keepRunning()) {
+        now += 16 * 1024;
+        bench::doNotOptimize(transferProgressCallback(&progress, 1ll << 32, now, 0, 0));
+    }
+}
@@ -0,0 +1,168 @@
+// End-to-end throughput of TMDB resolution plus Downloader against the
+// loopback server, at several concurrency levels.
+//
+// yarrharr_loopback [--concurrency 1,2,4,8] [--size-mb 8] [--seasons 2] [--episodes 10]
+//                   [--latency-ms 0] [--bandwidth-mbps 0] [--faults 0] [--json <path>]
+//
+// One JSON line per concurrency level goes to stdout (or is appended to
+// --json); a table goes to stderr. Media files are synthetic, so outputs are
+// written with a .bin extension to skip the ffmpeg metadata pass.
+#include "loopback_server.hpp"
+#include "download_utils.hpp"
+#include "downloader.hpp"
+#include "tmdb.hpp"
+#include "worker_pool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double msSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    double percentile(std::vector<double> values, double q) {
+        if (values.empty()) return 0;
+        std::sort(values.begin(), values.end());
+        size_t index = std::min(values.size() - 1, static_cast<size_t>(q * values.size()));
+        return values[index];
+    }
+
+    std::vector<size_t> parseList(const std::string& text) {
+        std::vector<size_t> values;
+        std::stringstream stream(text);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            values.push_back(std::stoul(item));
+        }
+        return values;
+    }
+
+    nlohmann::json runLevel(LoopbackServer& server, size_t concurrency, const fs::path& outputDir) {
+        TMDB tmdb("loopback", server.baseUrl() + "/3");
+        Downloader downloader(server.baseUrl() + "/api/yarrharr/direct");
+        downloader.setApiKey("loopback");
+
+        auto resolveStart = Clock::now();
+        Show show = tmdb.getShowDetails("1");
+        double resolveMs = msSince(resolveStart);
+
+        std::mutex mutex;
+        std::vector<double> latencies;
+        size_t bytes = 0;
+        size_t failures = 0;
+
+        auto start = Clock::now();
+        {
+            WorkerPool pool(concurrency);
+            for (const auto& episode : show.episodes) {
+                pool.submit([&, episode] {
+                    auto jobStart = Clock::now();
+                    try {
+                        auto job = downloader.episodeJob(show, episode, outputDir.string());
+                        job.output_path = fs::path(job.output_path).replace_extension(".bin").string();
+                        TransferProgress progress;
+                        downloader.downloadFile(job.url, job.output_path, &progress);
+                        size_t size = fs::file_size(job.output_path);
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        latencies.push_back(msSince(jobStart));
+                        bytes += size;
+                    } catch (const std::exception&) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        failures++;
+                    }
+                });
+            }
+            pool.wait();
+        }
+        double elapsed = msSince(start) / 1000.0;
+
+        return {
+            {"concurrency", concurrency},
+            {"episodes", show.episodes.size()},
+            {"failures", failures},
+            {"bytes", bytes},
+            {"seconds", elapsed},
+            {"mb_per_second", bytes / elapsed / 1e6},
+            {"resolve_ms", resolveMs},
+            {"latency_ms", {
+                {"p50", percentile(latencies, 0.50)},
+                {"p90", percentile(latencies, 0.90)},
+                {"p99", percentile(latencies, 0.99)},
+                {"max", percentile(latencies, 1.0)}
+            }}
+        };
+    }
+}
+
+int main(int argc, char* argv[]) {
+    LoopbackServer::Options options;
+    std::vector<size_t> levels = {1, 2, 4, 8};
+    std::string jsonPath;
+
+    for (int i = 1; i < argc - 1; i++) {
+        std::string option = argv[i];
+        std::string value = argv[++i];
+        if (option == "--concurrency") {
+            levels = parseList(value);
+        } else if (option == "--size-mb") {
+            options.media_bytes = static_cast<size_t>(std::stod(value) * 1024 * 1024);
+        } else if (option == "--seasons") {
+            options.seasons = std::stoi(value);
+        } else if (option == "--episodes") {
+            options.episodes_per_season = std::stoi(value);
+        } else if (option == "--latency-ms") {
+            options.latency_ms = std::stoi(value);
+        } else if (option == "--bandwidth-mbps") {
+            options.bandwidth = static_cast<size_t>(std::stod(value) * 1e6 / 8);
+        } else if (option == "--faults") {
+            options.fault_rate = std::stod(value);
+        } else if (option == "--json") {
+            jsonPath = value;
+        } else {
+            std::cerr << "Unknown option: " << option << "\n";
+            return 1;
+        }
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    LoopbackServer server(options);
+    fs::path outputDir = fs::temp_directory_path() / ("yarrharr-loopback-" + std::to_string(getpid()));
+
+    std::fprintf(stderr, "%-12s %10s %10s %10s %10s %10s %9s\n",
+                 "concurrency", "MB/s", "p50 ms", "p90 ms", "p99 ms", "resolve ms", "failures");
+    for (size_t concurrency : levels) {
+        auto result = runLevel(server, concurrency, outputDir);
+        fs::remove_all(outputDir);
+
+        std::fprintf(stderr, "%-12zu %10.1f %10.1f %10.1f %10.1f %10.1f %9zu\n", concurrency,
+                     result["mb_per_second"].get<double>(), result["latency_ms"]["p50"].get<double>(),
+                     result["latency_ms"]["p90"].get<double>(), result["latency_ms"]["p99"].get<double>(),
+                     result["resolve_ms"].get<double>(), result["failures"].get<size_t>());
+
+        result["size_mb"] = options.media_bytes / 1024.0 / 1024.0;
+        result["latency_injected_ms"] = options.latency_ms;
+        result["bandwidth_bytes"] = options.bandwidth;
+        result["fault_rate"] = options.fault_rate;
+        if (jsonPath.empty()) {
+            std::cout << result.dump() << "\n";
+        } else {
+            std::ofstream(jsonPath, std::ios::app) << result.dump() << "\n";
+        }
+    }
+
+    curl_global_cleanup();
+    return 0;
+}
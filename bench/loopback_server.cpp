@@ -0,0 +1,380 @@
+#include "loopback_server.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+    const char* statusText(int status) {
+        switch (status) {
+        case 200: return "OK";
+        case 206: return "Partial Content";
+        case 302: return "Found";
+        case 401: return "Unauthorized";
+        case 404: return "Not Found";
+        case 416: return "Range Not Satisfiable";
+        default: return "Internal Server Error";
+        }
+    }
+
+    const std::string& pattern() {
+        static const std::string bytes = [] {
+            std::string data(64 * 1024, '\0');
+            for (size_t i = 0; i < data.size(); i++) {
+                data[i] = static_cast<char>((i * 31 + 7) & 0xFF);
+            }
+            return data;
+        }();
+        return bytes;
+    }
+
+    std::string queryValue(const std::string& query, const std::string& key) {
+        size_t pos = 0;
+        while (pos < query.size()) {
+            size_t end = query.find('&', pos);
+            if (end == std::string::npos) end = query.size();
+            std::string pair = query.substr(pos, end - pos);
+            size_t eq = pair.find('=');
+            if (eq != std::string::npos && pair.substr(0, eq) == key) {
+                return pair.substr(eq + 1);
+            }
+            pos = end + 1;
+        }
+        return "";
+    }
+
+    bool startsWith(const std::string& text, const std::string& prefix) {
+        return text.compare(0, prefix.size(), prefix) == 0;
+    }
+}
+
+LoopbackServer::LoopbackServer(const Options& options) : options_(options), random_(42) {
+    listen_fd_ = utils::prepareSocket(socket(AF_INET, SOCK_STREAM, 0));
+    int one = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t length = sizeof(addr);
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listen_fd_, 128) != 0 ||
+        getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &length) != 0) {
+        close(listen_fd_);
+        throw std::runtime_error(std::string("Loopback server failed to listen: ") + std::strerror(errno));
+    }
+    port_ = ntohs(addr.sin_port);
+    acceptor_ = std::thread(&LoopbackServer::acceptLoop, this);
+}
+
+LoopbackServer::~LoopbackServer() {
+    running_ = false;
+    acceptor_.join();
+    close(listen_fd_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int fd : open_fds_) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    for (auto& thread : connections_) {
+        thread.join();
+    }
+}
+
+void LoopbackServer::acceptLoop() {
+    while (running_) {
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        int fd = utils::prepareSocket(accept(listen_fd_, nullptr, nullptr));
+        if (fd < 0) continue;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_fds_.push_back(fd);
+        connections_.emplace_back(&LoopbackServer::serveConnection, this, fd);
+    }
+}
+
+void LoopbackServer::serveConnection(int fd) {
+    std::string buffer;
+    char chunk[4096];
+    while (running_) {
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                end = std::string::npos;
+                break;
+            }
+            buffer.append(chunk, n);
+        }
+        if (end == std::string::npos) break;
+
+        std::string head = buffer.substr(0, end);
+        buffer.erase(0, end + 4);
+
+        Request request;
+        size_t lineEnd = head.find("\r\n");
+        std::string requestLine = head.substr(0, lineEnd);
+        size_t space1 = requestLine.find(' ');
+        size_t space2 = requestLine.find(' ', space1 + 1);
+        request.method = requestLine.substr(0, space1);
+        std::string target = requestLine.substr(space1 + 1, space2 - space1 - 1);
+        size_t question = target.find('?');
+        request.path = target.substr(0, question);
+        request.query = question == std::string::npos ? "" : target.substr(question + 1);
+
+        bool closeAfter = false;
+        size_t pos = lineEnd == std::string::npos ? head.size() : lineEnd + 2;
+        while (pos < head.size()) {
+            size_t next = head.find("\r\n", pos);
+            if (next == std::string::npos) next = head.size();
+            std::string line = head.substr(pos, next - pos);
+            std::string lower = line;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            if (startsWith(lower, "range:")) {
+                request.range = line.substr(line.find(':') + 1);
+                request.range.erase(0, request.range.find_first_not_of(' '));
+            } else if (startsWith(lower, "x-api-key:")) {
+                request.has_api_key = true;
+            } else if (startsWith(lower, "connection:") && lower.find("close") != std::string::npos) {
+                closeAfter = true;
+            }
+            pos = next + 2;
+        }
+
+        requests_++;
+        if (options_.latency_ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options_.latency_ms));
+        }
+        bool keepOpen;
+        try {
+            keepOpen = respond(fd, request);
+        } catch (const std::exception& e) {
+            keepOpen = sendResponse(fd, 500, "Content-Type: text/plain\r\n", e.what(), false);
+        }
+        if (!keepOpen || closeAfter) break;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_fds_.erase(std::remove(open_fds_.begin(), open_fds_.end(), fd), open_fds_.end());
+    }
+    close(fd);
+}
+
+bool LoopbackServer::respond(int fd, const Request& request) {
+    bool head = request.method == "HEAD";
+    const std::string& path = request.path;
+
+    if (path == "/3/search/multi") {
+        nlohmann::json results = {
+            {{"media_type", "movie"}, {"id", 1}, {"title", "Loopback Movie 1"}, {"release_date", "2020-01-01"}},
+            {{"media_type", "tv"}, {"id", 2}, {"name", "Loopback Show 2"}, {"first_air_date", "2020-01-01"}},
+            {{"media_type", "person"}, {"id", 3}, {"name", "Loopback Person"}}};
+        return sendResponse(fd, 200, "Content-Type: application/json\r\n", nlohmann::json{{"results", results}}.dump(),
+                            head);
+    }
+
+    if (path == "/3/tv/changes") {
+        nlohmann::json results = nlohmann::json::array();
+        for (int id : options_.changed_shows) {
+            results.push_back({{"id", id}, {"adult", false}});
+        }
+        nlohmann::json body = {{"results", results}, {"page", 1}, {"total_pages", 1}};
+        return sendResponse(fd, 200, "Content-Type: application/json\r\n", body.dump(), head);
+    }
+
+    if (startsWith(path, "/3/tv/")) {
+        std::string rest = path.substr(6);
+        size_t slash = rest.find('/');
+        std::string id = rest.substr(0, slash);
+
+        nlohmann::json body;
+        if (slash != std::string::npos && rest.substr(slash) == "/changes") {
+            nlohmann::json changes = nlohmann::json::array();
+            if (std::count(options_.changed_shows.begin(), options_.changed_shows.end(), std::stoi(id))) {
+                changes.push_back({{"key", "season"},
+                                   {"items", {{{"action", "updated"}, {"value", {{"season_number", 1}}}}}}});
+            }
+            body = {{"changes", changes}};
+        } else if (slash == std::string::npos) {
+            nlohmann::json seasons = nlohmann::json::array();
+            for (int season = 1; season <= options_.seasons; season++) {
+                seasons.push_back({{"season_number", season}, {"episode_count", options_.episodes_per_season}});
+            }
+            body = {{"id", std::stoi(id)}, {"name", "Loopback Show " + id}, {"first_air_date", "2020-01-01"},
+                    {"status", "Returning Series"}, {"seasons", seasons},
+                    {"last_episode_to_air", {{"season_number", options_.seasons},
+                                             {"episode_number", options_.episodes_per_season},
+                                             {"air_date", "2020-06-01"}}},
+                    {"next_episode_to_air", nullptr}};
+        } else {
+            int season = std::stoi(rest.substr(rest.rfind('/') + 1));
+            nlohmann::json episodes = nlohmann::json::array();
+            for (int number = 1; number <= options_.episodes_per_season; number++) {
+                episodes.push_back({{"episode_number", number}, {"season_number", season},
+                                    {"name", "Episode " + std::to_string(number)}, {"air_date", "2020-01-01"},
+                                    {"overview", std::string(200, 'o')}});
+            }
+            body = {{"season_number", season}, {"episodes", episodes}};
+        }
+        return sendResponse(fd, 200, "Content-Type: application/json\r\n", body.dump(), head);
+    }
+
+    if (startsWith(path, "/3/movie/")) {
+        std::string id = path.substr(9);
+        nlohmann::json body = {{"id", std::stoi(id)}, {"title", "Loopback Movie " + id}, {"release_date", "2020-01-01"}};
+        return sendResponse(fd, 200, "Content-Type: application/json\r\n", body.dump(), head);
+    }
+
+    if (path == "/api/yarrharr/games") {
+        if (options_.games_latency_ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options_.games_latency_ms));
+        }
+        nlohmann::json games = nlohmann::json::array();
+        for (int id = 1; id <= 3; id++) {
+            games.push_back({{"id", id}, {"title", "Loopback Game " + std::to_string(id)}, {"date", "2020-01-01"},
+                             {"last_updated", "2020-06-01"}});
+        }
+        return sendResponse(fd, 200, "Content-Type: application/json\r\n", games.dump(), head);
+    }
+
+    if (path == "/api/yarrharr/direct") {
+        if (!request.has_api_key) {
+            return sendResponse(fd, 401, "Content-Type: text/plain\r\n", "missing api key", head);
+        }
+        std::string name = queryValue(request.query, "tmdbId");
+        std::string season = queryValue(request.query, "season");
+        if (!season.empty()) {
+            name += "-s" + season + "e" + queryValue(request.query, "episode");
+        }
+        std::string location = options_.hls ? "/hls/" + name + "/index.m3u8" : "/media/" + name + ".mkv";
+        return sendResponse(fd, 302, "Location: " + location + "\r\n", "", head);
+    }
+
+    if (startsWith(path, "/media/")) {
+        return sendMedia(fd, request, options_.media_bytes, "video/x-matroska");
+    }
+
+    if (startsWith(path, "/hls/")) {
+        size_t segmentBytes = options_.media_bytes / std::max(1, options_.segments);
+        size_t variantAt = path.find("/v", 5);
+        int variant = variantAt == std::string::npos ? -1 : std::atoi(path.c_str() + variantAt + 2);
+        bool playlistPath = path.size() > 5 && path.compare(path.size() - 5, 5, ".m3u8") == 0;
+        if (playlistPath && options_.variants > 0 && variant < 0) {
+            std::string playlist = "#EXTM3U\n";
+            for (int k = 0; k < options_.variants; k++) {
+                playlist += "#EXT-X-STREAM-INF:BANDWIDTH=" + std::to_string((segmentBytes >> k) * 8 / 6) +
+                            ",RESOLUTION=" + std::to_string(1920 >> k) + "x" + std::to_string(1080 >> k) +
+                            ",CODECS=\"avc1.640028,mp4a.40.2\"\nv" + std::to_string(k) + "/index.m3u8\n";
+            }
+            return sendResponse(fd, 200, "Content-Type: application/vnd.apple.mpegurl\r\n", playlist, head);
+        }
+        if (variant > 0) {
+            segmentBytes >>= variant;
+        }
+        if (playlistPath) {
+            std::string playlist = "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:6\n#EXT-X-MEDIA-SEQUENCE:0\n";
+            for (int i = 0; i < options_.segments; i++) {
+                playlist += "#EXTINF:6.0,\nseg" + std::to_string(i) + ".ts\n";
+            }
+            playlist += "#EXT-X-ENDLIST\n";
+            return sendResponse(fd, 200, "Content-Type: application/vnd.apple.mpegurl\r\n", playlist, head);
+        }
+        return sendMedia(fd, request, segmentBytes, "video/mp2t");
+    }
+
+    return sendResponse(fd, 404, "Content-Type: text/plain\r\n", "not found", head);
+}
+
+bool LoopbackServer::sendResponse(int fd, int status, const std::string& headers, const std::string& body, bool head) {
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + statusText(status) + "\r\n" + headers +
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    if (!head) {
+        response += body;
+    }
+    return sendBytes(fd, response.data(), response.size());
+}
+
+bool LoopbackServer::sendMedia(int fd, const Request& request, size_t size, const char* contentType) {
+    bool head = request.method == "HEAD";
+    bool truncate = false;
+    if (!head && shouldFail()) {
+        // Faults alternate between server errors and connections that drop
+        // midway through the body
+        if (faults_++ % 2 == 0) {
+            return sendResponse(fd, 500, "Content-Type: text/plain\r\n", "injected fault", false);
+        }
+        truncate = true;
+    }
+
+    size_t first = 0;
+    size_t last = size - 1;
+    int status = 200;
+    std::string headers = std::string("Content-Type: ") + contentType + "\r\nAccept-Ranges: bytes\r\n";
+    if (!request.range.empty() && startsWith(request.range, "bytes=")) {
+        std::string spec = request.range.substr(6);
+        size_t dash = spec.find('-');
+        first = std::stoull(spec.substr(0, dash));
+        if (dash + 1 < spec.size()) {
+            last = std::min<size_t>(std::stoull(spec.substr(dash + 1)), size - 1);
+        }
+        if (first >= size || first > last) {
+            return sendResponse(fd, 416, "Content-Range: bytes */" + std::to_string(size) + "\r\n", "", head);
+        }
+        status = 206;
+        headers += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" +
+                   std::to_string(size) + "\r\n";
+    }
+
+    size_t length = last - first + 1;
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + statusText(status) + "\r\n" + headers +
+                           "Content-Length: " + std::to_string(length) + "\r\n\r\n";
+    if (!sendBytes(fd, response.data(), response.size())) return false;
+    if (head) return true;
+
+    size_t toSend = truncate ? length / 2 : length;
+    const std::string& data = pattern();
+    size_t offset = first;
+    while (toSend > 0) {
+        size_t start = offset % data.size();
+        size_t chunk = std::min(toSend, data.size() - start);
+        if (!sendBytes(fd, data.data() + start, chunk)) return false;
+        offset += chunk;
+        toSend -= chunk;
+    }
+    return !truncate;
+}
+
+bool LoopbackServer::sendBytes(int fd, const char* data, size_t length) {
+    constexpr size_t CHUNK = 16 * 1024;
+    auto start = std::chrono::steady_clock::now();
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = send(fd, data + sent, std::min(CHUNK, length - sent), utils::sendFlags());
+        if (n <= 0) return false;
+        sent += n;
+
+        if (options_.bandwidth > 0) {
+            auto due = start + std::chrono::duration<double>(double(sent) / options_.bandwidth);
+            std::this_thread::sleep_until(due);
+        }
+    }
+    return true;
+}
+
+bool LoopbackServer::shouldFail() {
+    if (options_.fault_rate <= 0) return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::uniform_real_distribution<double>(0, 1)(random_) < options_.fault_rate;
+}
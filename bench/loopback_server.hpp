@@ -0,0 +1,73 @@
+#pragma once
+// Local stand-in for TMDB and the yarrharr API, for driving TMDB and
+// Downloader end to end without touching real services. Serves:
+//   /3/tv/{id}, /3/tv/{id}/season/{n}, /3/movie/{id}   TMDB-shaped JSON
+//   /api/yarrharr/direct?tmdbId=..                      302 to the media
+//   /media/{name}.mkv                                   sized body, Range
+//   /hls/{name}/index.m3u8, /hls/{name}/seg{i}.ts       playlist + segments
+//   /hls/{name}/v{k}/index.m3u8, /hls/{name}/v{k}/seg{i}.ts
+//                                                       variants of a master playlist
+#include <atomic>
+#include <cstddef>
+#include <random>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class LoopbackServer {
+public:
+    struct Options {
+        int latency_ms = 0;          // added before every response
+        size_t bandwidth = 0;        // bytes/s per connection, 0 = unlimited
+        double fault_rate = 0;       // share of media responses that fail
+        size_t media_bytes = 8 << 20;
+        int segments = 10;           // HLS segments, media_bytes split evenly
+        bool hls = false;            // direct redirects to a playlist
+        int variants = 0;            // serve a master playlist with this many
+                                     // variants, each half the one above
+        int seasons = 2;
+        int episodes_per_season = 10;
+        std::vector<int> changed_shows;  // listed by /tv/changes, season 1 edited
+        int games_latency_ms = 0;        // added before games catalog responses
+    };
+
+    explicit LoopbackServer(const Options& options);
+    ~LoopbackServer();
+
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    std::string baseUrl() const { return "http://127.0.0.1:" + std::to_string(port_); }
+    size_t requests() const { return requests_.load(); }
+    size_t faults() const { return faults_.load(); }
+
+private:
+    struct Request {
+        std::string method;
+        std::string path;
+        std::string query;
+        std::string range;
+        bool has_api_key = false;
+    };
+
+    Options options_;
+    int listen_fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_{true};
+    std::atomic<size_t> requests_{0};
+    std::atomic<size_t> faults_{0};
+    std::thread acceptor_;
+    std::vector<std::thread> connections_;
+    std::vector<int> open_fds_;
+    std::mutex mutex_;
+    std::mt19937 random_;
+
+    void acceptLoop();
+    void serveConnection(int fd);
+    bool respond(int fd, const Request& request);
+    bool sendResponse(int fd, int status, const std::string& headers, const std::string& body, bool head);
+    bool sendMedia(int fd, const Request& request, size_t size, const char* contentType);
+    bool sendBytes(int fd, const char* data, size_t length);
+    bool shouldFail();
+};
@@ -0,0 +1,117 @@
+// Per-response and per-line parsing done while resolving and downloading.
+#include "bench.hpp"
+#include "download_utils.hpp"
+#include "downloader.hpp"
+#include "tmdb.hpp"
+#include <cstring>
+#include <nlohmann/json.hpp>
+#include <vector>
+
+namespace {
+    // Shaped like a /tv/{id}/season/{n} response: 24 episodes, each with
+    // overview, crew and guest stars, about 60KB in total
+    const std::string& seasonResponse() {
+        static const std::string response = [] {
+            nlohmann::json episodes = nlohmann::json::array();
+            for (int number = 1; number <= 24; number++) {
+                nlohmann::json crew = nlohmann::json::array();
+                for (const char* job : {"Director", "Writer", "Editor"}) {
+                    crew.push_back({{"job", job}, {"department", "Crew"}, {"credit_id", "52542282760ee313280017f9"},
+                                    {"adult", false}, {"gender", 2}, {"id", 66633 + number},
+                                    {"known_for_department", "Directing"}, {"name", "Vince Gilligan"},
+                                    {"original_name", "Vince Gilligan"}, {"popularity", 3.7},
+                                    {"profile_path", "/z3E0DhBg1V1PZVEtS9vfFPzOWYB.jpg"}});
+                }
+                nlohmann::json guests = nlohmann::json::array();
+                for (int g = 0; g < 5; g++) {
+                    guests.push_back({{"character", "Guest " + std::to_string(g)}, {"credit_id", "5271b489760ee35b3e0881a7"},
+                                      {"order", 500 + g}, {"adult", false}, {"gender", 1}, {"id", 1216630 + g},
+                                      {"known_for_department", "Acting"}, {"name", "Guest Actor " + std::to_string(g)},
+                                      {"original_name", "Guest Actor " + std::to_string(g)}, {"popularity", 1.4},
+                                      {"profile_path", nullptr}});
+                }
+                episodes.push_back({
+                    {"air_date", "2010-03-" + std::to_string(10 + number % 18)},
+                    {"episode_number", number},
+                    {"episode_type", number == 24 ? "finale" : "standard"},
+                    {"id", 62085 + number},
+                    {"name", "Episode title number " + std::to_string(number)},
+                    {"overview", std::string(320, 'o')},
+                    {"production_code", ""},
+                    {"runtime", 47},
+                    {"season_number", 3},
+                    {"show_id", 1396},
+                    {"still_path", "/ydlY3iPfeOAvu8gVqrxPoMvzNCn.jpg"},
+                    {"vote_average", 8.4},
+                    {"vote_count", 180},
+                    {"crew", crew},
+                    {"guest_stars", guests}
+                });
+            }
+            return nlohmann::json{
+                {"_id", "5256c89f19c2956ff6046f6a"}, {"air_date", "2010-03-21"}, {"episodes", episodes},
+                {"name", "Season 3"}, {"overview", std::string(400, 'x')}, {"id", 3575},
+                {"poster_path", "/ffP8Q8ew048YofHRnFVM18B2fPG.jpg"}, {"season_number", 3}, {"vote_average", 8.2}
+            }.dump();
+        }();
+        return response;
+    }
+
+    // What `ffmpeg -progress pipe:1` prints about every half second
+    const std::vector<std::string> PROGRESS_BLOCK = {
+        "frame=28410\n", "fps=611.42\n", "stream_0_0_q=-1.0\n", "bitrate=3120.4kbits/s\n",
+        "total_size=463912960\n", "out_time_us=1185000000\n", "out_time_ms=1185000000\n",
+        "out_time=00:19:45.000000\n", "dup_frames=0\n", "drop_frames=0\n", "speed=25.5x\n",
+        "progress=continue\n"
+    };
+
+    const std::vector<std::string> RESPONSE_HEADERS = {
+        "HTTP/2 200 \r\n", "date: Sat, 18 Oct 2026 12:00:00 GMT\r\n", "content-type: application/vnd.apple.mpegurl\r\n",
+        "content-length: 4096\r\n", "cache-control: no-cache\r\n", "access-control-allow-origin: *\r\n",
+        "x-request-id: 8d3f1a2b-5c6d-4e7f-8a9b-0c1d2e3f4a5b\r\n", "strict-transport-security: max-age=63072000\r\n",
+        "cf-cache-status: DYNAMIC\r\n", "server: cloudflare\r\n", "cf-ray: 8d3f1a2b5c6d4e7f-AMS\r\n", "\r\n"
+    };
+}
+
+BENCHMARK(TMDB_ParseSeasonEpisodes) {
+    const std::string& response = seasonResponse();
+    while (state.keepRunning()) {
+        auto episodes = TMDB::parseSeasonEpisodes(response, 3);
+        bench::doNotOptimize(episodes.data());
+    }
+    state.setBytesProcessed(static_cast<int64_t>(response.size()) * state.iterations());
+    state.counters["response_bytes"] = response.size();
+}
+
+BENCHMARK(Downloader_ParseProgress) {
+    bench::SilenceStdout silence;
+    Downloader downloader("http://localhost");
+    while (state.keepRunning()) {
+        for (const auto& line : PROGRESS_BLOCK) {
+            downloader.parseProgress(line);
+        }
+    }
+}
+
+BENCHMARK(FfmpegProgressCallback_StatsLine) {
+    bench::SilenceStdout silence;
+    char line[] = "frame=28410 fps=611 q=-1.0 size=  453040kB time=00:19:45.00 bitrate=3131.5kbits/s speed=25.5x\r";
+    size_t length = std::strlen(line);
+    while (state.keepRunning()) {
+        bench::doNotOptimize(ffmpegProgressCallback(line, 1, length, nullptr));
+    }
+}
+
+BENCHMARK(HeaderCallback_ResponseHeaders) {
+    std::vector<std::vector<char>> headers;
+    for (const auto& header : RESPONSE_HEADERS) {
+        headers.emplace_back(header.begin(), header.end());
+    }
+    while (state.keepRunning()) {
+        std::string contentType;
+        for (auto& header : headers) {
+            headerCallback(header.data(), 1, header.size(), &contentType);
+        }
+        bench::doNotOptimize(contentType.data());
+    }
+}
@@ -0,0 +1,44 @@
+// String helpers and the `yarrharr show` episode grid.
+#include "bench.hpp"
+#include "show_grid.hpp"
+#include "utils.hpp"
+#include <sstream>
+
+namespace {
+    const std::string TITLE = "Star Trek: The Next Generation - S03E15 - Yesterday's Enterprise (Part 1/2) <Remastered>?.mkv";
+    const std::string EPISODE_LINE = "15. Yesterday's Enterprise: an alternate timeline where the Federation is at war";
+
+    EpisodeStore makeShow() {
+        EpisodeStore episodes;
+        for (int season = 1; season <= 7; season++) {
+            for (int number = 1; number <= 26; number++) {
+                episodes.add(season, number, "An episode title long enough to wrap " + std::to_string(number), "1990-01-01");
+            }
+        }
+        return episodes;
+    }
+}
+
+BENCHMARK(Utils_SanitizeFilename) {
+    while (state.keepRunning()) {
+        auto name = utils::sanitizeFilename(TITLE);
+        bench::doNotOptimize(name.data());
+    }
+}
+
+BENCHMARK(Utils_WrapText) {
+    while (state.keepRunning()) {
+        auto lines = utils::wrapText(EPISODE_LINE, 24);
+        bench::doNotOptimize(lines.data());
+    }
+}
+
+BENCHMARK(ShowGrid_SevenSeasons) {
+    EpisodeStore episodes = makeShow();
+    std::ostringstream out;
+    while (state.keepRunning()) {
+        out.str("");
+        printShowGrid(episodes, 200, out);
+    }
+    state.counters["output_bytes"] = out.str().size();
+}
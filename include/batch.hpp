@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "downloader.hpp"
+#include "games.hpp"
+#include "tmdb.hpp"
+
+class BatchError : public std::runtime_error {
+public:
+    explicit BatchError(const std::string& message) : std::runtime_error(message) {}
+};
+
+struct BatchItem {
+    enum class Kind { Movie, Show, Game };
+
+    Kind kind;
+    std::string id;
+    int season = -1;         // -1 means every season
+    int first_episode = -1;  // -1 means the whole season
+    int last_episode = -1;
+};
+
+// A manifest is either JSON:
+//   {"jobs": 4, "items": [{"movie": "603"}, {"show": "1396", "season": 2, "episodes": "1-5"}, {"game": "42"}]}
+// or one item per line:
+//   movie 603
+//   show 1396 season 2 episodes 1-5
+//   game 42
+struct Manifest {
+    std::vector<BatchItem> items;
+    size_t jobs = 4;
+
+    static Manifest load(const std::string& path);
+    static Manifest parse(const std::string& text);
+};
+
+// Resolves every title in a manifest once, then runs all transfers through
+// a single Downloader::downloadFiles call.
+class BatchRunner {
+public:
+    BatchRunner(TMDB& tmdb, Games& games, Downloader& downloader, const std::string& output_dir, bool skip_specials);
+
+    std::vector<DownloadJob> plan(const Manifest& manifest);
+    void run(const Manifest& manifest);
+
+private:
+    TMDB& tmdb_;
+    Games& games_;
+    Downloader& downloader_;
+    std::string output_dir_;
+    bool skip_specials_;
+};
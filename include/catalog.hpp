@@ -0,0 +1,35 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include "games.hpp"
+#include "tmdb.hpp"
+
+// One search over TMDB and the games catalog at once
+namespace catalog {
+    struct Result {
+        std::string kind;   // "movie", "tv" or "game"
+        std::string id;
+        std::string title;
+        std::string date;   // release, first air or game date, may be empty
+        double score = 0;   // ranking across backends, higher first
+    };
+
+    // One backend's answer, or why there was none
+    struct Answer {
+        std::string backend;  // "TMDB" or "Games"
+        std::vector<Result> results;
+        std::string error;
+        double seconds = 0;
+    };
+
+    // Queries both backends concurrently, each bounded by its own request
+    // timeout, and calls `on_answer` on the calling thread as each one
+    // answers, fastest first. Returns the results of both, merged and ranked.
+    std::vector<Result> search(TMDB& tmdb, Games& games, const std::string& query,
+                               const std::function<void(const Answer&)>& on_answer = nullptr);
+
+    // How well `title` matches `query`, given it came in at `position` of
+    // its backend's own ranking
+    double score(const std::string& query, const std::string& title, size_t position);
+}
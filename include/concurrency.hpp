@@ -0,0 +1,90 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+struct TransferProgress;
+
+// AIMD limit on parallel work against one host. Holders of its slots are
+// measured over fixed windows: a window with failed or stalled transfers
+// halves the limit, one whose goodput beat the level below adds one, and
+// one where the last step bought nothing takes it back. The limit reached
+// is kept per host in ~/.yarrharr/concurrency.json, so the next run starts
+// near it instead of at the configured value, along with the goodput last
+// measured.
+class ConcurrencyController {
+public:
+    // Holds a slot for one transfer, which is measured through `progress`
+    // or whatever it reports with transferred(); a null controller makes
+    // it a no-op, for fixed concurrency
+    class Slot {
+    public:
+        Slot(ConcurrencyController* controller, const TransferProgress* progress = nullptr);
+        ~Slot();
+
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+
+        void transferred(uint64_t bytes);
+        void fail() { failed_ = true; }
+
+    private:
+        ConcurrencyController* controller_;
+        uint64_t id_ = 0;
+        bool failed_ = false;
+    };
+
+    // `kind` names the limit within the host, e.g. "transfers"
+    ConcurrencyController(const std::string& host, const std::string& kind, size_t initial, size_t max_limit,
+                          const std::string& path = getStatePath());
+
+    size_t limit() const;
+    size_t maxLimit() const { return max_; }
+    // Samples the slots' progress; call every second or so. True when it
+    // closed a window that changed the limit.
+    bool tick();
+    void save() const;
+
+    // Bytes/s last saved for `host`, 0 when nothing was measured
+    static double goodput(const std::string& host, const std::string& kind, const std::string& path = getStatePath());
+    static std::string hostOf(const std::string& url);
+    static std::string getStatePath();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Holder {
+        const TransferProgress* progress;
+        int64_t seen = 0;
+        Clock::time_point moved;  // last time its bytes advanced
+    };
+
+    std::string path_;
+    std::string host_;
+    std::string kind_;
+    size_t max_;
+    size_t limit_;
+    std::map<uint64_t, Holder> holders_;
+    uint64_t next_id_ = 0;
+    size_t waiting_ = 0;
+    std::map<size_t, double> goodput_;  // smoothed bytes/s seen at each limit
+    double rate_ = 0;                   // smoothed bytes/s over clean windows
+
+    // Current window
+    Clock::time_point window_start_;
+    uint64_t bytes_ = 0;
+    size_t failures_ = 0;
+    size_t stalls_ = 0;
+    bool saturated_ = true;  // every sample had all slots taken or waited for
+
+    mutable std::mutex mutex_;
+    std::condition_variable slot_cv_;
+
+    uint64_t acquire(const TransferProgress* progress);
+    void release(uint64_t id, bool failed);
+    void add(uint64_t bytes);
+    void adjust(double seconds);
+};
@@ -8,10 +8,24 @@ struct Config {
     std::string download_path;
     bool create_season_folders;
     bool create_show_folders;
+    int update_check_interval_hours = 24;
+    std::string tmdb_base_url = "https://api.themoviedb.org/3";
+    std::string api_base_url = "https://sleepy.engineer/api/yarrharr";
+    int ffmpeg_jobs = 0;  // concurrent ffmpeg processes, 0 = based on CPU count
+    bool dedupe_downloads = true;
+    int hls_max_height = 0;             // 0 = highest variant
+    uint64_t hls_max_bandwidth = 0;     // bits per second, 0 = no limit
+    std::string hls_audio_language;     // e.g. "eng"; empty keeps the playlist default
+    int hls_deadline_seconds = 0;       // switch down to finish within this, 0 = off
+    std::string staging_path;           // local disk for transfers and remuxing, empty = off
+    int mover_bandwidth_mbps = 0;       // cap on copies from staging, 0 = no limit
+    int max_concurrency = 16;           // ceiling for the adaptive transfer and connection
+                                        // counts, 0 = fixed at --jobs
     
     static Config load(const std::string& path);
     void save(const std::string& path) const;
     
     static std::string getConfigPath();
+    static std::string getDataPath(const std::string& name);
     static void ensureConfigDirectory();
 };
\ No newline at end of file
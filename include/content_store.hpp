@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct DedupeReport {
+    size_t files = 0;       // regular files seen
+    size_t hashed = 0;      // files sharing a size with another, so hashed
+    size_t linked = 0;      // duplicates replaced by links
+    uint64_t bytes_reclaimed = 0;
+};
+
+// Content-addressed index of downloaded files, stored in
+// ~/.yarrharr/content_store.json. Keys are SHA-256 digests of the bytes as
+// downloaded, suffixed with the remux applied when the file on disk is
+// ffmpeg output rather than the download itself. Entries remember size and
+// mtime so a file changed since it was recorded is never linked.
+class ContentStore {
+public:
+    explicit ContentStore(const std::string& path = getStorePath());
+
+    // Path of a recorded file with this key that is still unchanged on
+    // disk, or empty
+    std::string find(const std::string& key);
+    void add(const std::string& key, const std::string& path);
+
+    // Hashes every file under `roots` whose size matches another's, using
+    // `jobs` threads, and replaces duplicates with links to one copy
+    DedupeReport dedupe(const std::vector<std::string>& roots, size_t jobs, bool dry_run);
+
+    // Replaces `path` with a reflink (FICLONE) of `existing`, or a hardlink
+    // where reflinks are unsupported. False when neither works, e.g. across
+    // filesystems.
+    static bool link(const std::string& existing, const std::string& path);
+
+    static std::string getStorePath();
+
+private:
+    struct Entry {
+        std::string path;
+        uint64_t size = 0;
+        int64_t mtime = 0;  // nanoseconds, so a rewrite within the same second still counts
+    };
+
+    std::string path_;
+    std::map<std::string, Entry> entries_;
+    std::mutex mutex_;
+
+    bool record(const std::string& key, const std::string& path);
+    void save();
+};
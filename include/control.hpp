@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <nlohmann/json.hpp>
+
+class ControlError : public std::runtime_error {
+public:
+    explicit ControlError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Line-delimited JSON-RPC over a Unix domain socket. Each request is
+// {"id": n, "method": "...", "params": {...}} on one line, answered by
+// {"id": n, "result": ...} or {"id": n, "error": {"message": "..."}}.
+class ControlServer {
+public:
+    using Handler = std::function<nlohmann::json(const std::string& method, const nlohmann::json& params)>;
+
+    ControlServer(const std::string& path, Handler handler);
+    ~ControlServer();
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    void stop();
+
+private:
+    std::string path_;
+    Handler handler_;
+    int listen_fd_ = -1;
+    std::atomic<bool> running_{true};
+    std::thread thread_;
+
+    void serve();
+    void handleConnection(int fd);
+};
+
+namespace control {
+    std::string getSocketPath();
+
+    // True when a daemon is accepting connections on the socket
+    bool available(const std::string& path = getSocketPath());
+
+    nlohmann::json call(const std::string& method, const nlohmann::json& params,
+                        const std::string& path = getSocketPath());
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "control.hpp"
+#include "downloader.hpp"
+#include "follow.hpp"
+#include "games.hpp"
+#include "metadata_store.hpp"
+#include "tmdb.hpp"
+#include "worker_pool.hpp"
+
+struct TransferProgress;
+class ConcurrencyController;
+
+// Long-running process that keeps followed shows up to date. Each show is
+// polled on a schedule derived from its next air date, against a local copy
+// of its metadata that TMDB's change lists keep current, and only episodes
+// that aired since the last poll are handed to the transfer pool. Other
+// yarrharr invocations queue work on the same pool through the control
+// socket.
+class Daemon {
+public:
+    Daemon(TMDB& tmdb, Games& games, Downloader& downloader, const std::string& output_dir, size_t jobs);
+
+    void run();
+    void stop() { running_ = false; }
+    void setMetricsPath(const std::string& path) { metrics_path_ = path; }
+    // Caps running transfers below the pool size, adjusting as it learns
+    void setConcurrency(ConcurrencyController* controller) { concurrency_ = controller; }
+
+    static int64_t nextCheck(const ShowStatus& status, int64_t now);
+
+private:
+    struct Transfer {
+        std::string label;
+        std::shared_ptr<TransferProgress> progress;
+        bool active = false;
+    };
+
+    TMDB& tmdb_;
+    Games& games_;
+    Downloader& downloader_;
+    std::string output_dir_;
+    std::string metrics_path_;
+    ConcurrencyController* concurrency_ = nullptr;
+    FollowList follows_;
+    MetadataStore metadata_;
+    std::set<std::string> in_flight_;
+    std::map<uint64_t, Transfer> transfers_;
+    uint64_t next_transfer_ = 0;
+    size_t completed_ = 0;
+    size_t failed_ = 0;
+    size_t moving_ = 0;  // transfers whose outcome the mover has yet to report
+    std::mutex mutex_;
+    std::condition_variable moved_;
+    std::atomic<bool> running_{false};
+    WorkerPool pool_;
+
+    void poll(const std::string& id, int64_t now, const std::string& error);
+    void finishShow(const std::string& id, int season, int episode, bool complete);
+
+    uint64_t track(const std::string& label);
+    // Returns once the file is handed to the mover; `done` learns whether
+    // it reached the library, and the transfer is counted and logged then
+    void transfer(uint64_t id, const DownloadJob& job, std::function<void(bool)> done);
+    void enqueue(const std::string& label, std::function<DownloadJob()> makeJob);
+
+    nlohmann::json handleRequest(const std::string& method, const nlohmann::json& params);
+    nlohmann::json queueDownload(const nlohmann::json& params);
+    nlohmann::json queueGames(const nlohmann::json& params);
+    nlohmann::json status();
+};
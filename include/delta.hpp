@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+
+class DeltaError : public std::runtime_error {
+public:
+    explicit DeltaError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Binary patches between two releases, in the spirit of bsdiff: the new file
+// is described as approximate matches against the old one (stored as
+// byte-wise differences, which are mostly zero and run-length encoded) plus
+// literal bytes that have no match. Both files' SHA-256 sums are embedded so
+// a patch is only applied to the exact binary it was made from.
+namespace delta {
+    std::vector<uint8_t> create(const std::vector<uint8_t>& old_data, const std::vector<uint8_t>& new_data);
+    std::vector<uint8_t> apply(const std::vector<uint8_t>& old_data, const std::vector<uint8_t>& patch);
+
+    // Hex SHA-256 of the file a patch expects as input
+    std::string sourceChecksum(const std::vector<uint8_t>& patch);
+
+    std::vector<uint8_t> readFile(const std::string& path);
+    void writeFile(const std::string& path, const std::vector<uint8_t>& data);
+}
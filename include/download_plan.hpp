@@ -0,0 +1,47 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "downloader.hpp"
+
+// What a download takes before it starts: each file's size from a HEAD
+// request, the time that is at the goodput last measured against the host,
+// and whether the filesystem the library is on can hold it, as well as a
+// staging filesystem of its own while transfers are in flight there
+struct DownloadPlan {
+    struct Item {
+        DownloadJob job;
+        UrlProbe probe;
+        uint64_t replaces = 0;  // size of the file already at the destination
+        bool remuxed = false;   // input and remuxed output are on disk together
+    };
+
+    std::vector<Item> items;
+    std::vector<Item> dropped;     // trimmed off the end to fit
+    std::string target;
+    uint64_t available = 0;        // free bytes on the target's filesystem
+    double bytes_per_second = 0;   // 0 when nothing was measured
+    std::string staging;           // empty unless staged on another filesystem
+    uint64_t staging_available = 0;
+    size_t staging_slots = 1;      // most transfers staged at once
+    bool staging_backlog = false;  // moves are capped, so every file may wait there
+
+    uint64_t bytes() const;        // known sizes only
+    uint64_t needed() const;       // net of the files replaced, plus headroom
+    size_t stagingSlots() const { return std::min(staging_slots, items.size()); }
+    // The largest files, one per slot or all of them with a backlog and
+    // twice over when remuxed, plus headroom
+    uint64_t stagingNeeded() const;
+    std::string stagingReason() const;  // what stagingNeeded() is sized for
+    size_t unknown() const;        // HLS streams and servers that gave no size
+    bool fitsTarget() const { return needed() <= available; }
+    bool fitsStaging() const { return stagingNeeded() <= staging_available; }
+    bool fits() const { return fitsTarget() && fitsStaging(); }
+    // Drops files from the end until the rest fits, so earlier episodes are
+    // kept over later ones; false when nothing is left
+    bool trim();
+    std::vector<DownloadJob> jobs() const;
+    void print(std::ostream& out) const;
+};
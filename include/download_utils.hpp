@@ -7,6 +7,46 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <atomic>
+#include <string>
+#include "sha256.hpp"
+
+class MkvToMp4;
+
+// Progress of one transfer in a parallel batch, polled by the batch's
+// progress display instead of each transfer drawing its own bar
+struct TransferProgress {
+    std::atomic<curl_off_t> now{0};
+    std::atomic<curl_off_t> total{0};
+};
+
+// Output file plus the digest of everything written to it, so downloads are
+// hashed for deduplication without reading them back
+struct HashingWriter {
+    FILE* file;
+    Sha256 hash;
+};
 
 size_t writeCallback(void* ptr, size_t size, size_t nmemb, FILE* stream);
-int progressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow); 
\ No newline at end of file
+size_t hashingWriteCallback(void* ptr, size_t size, size_t nmemb, HashingWriter* writer);
+
+// Feeds a Matroska download to the MP4 remuxer while writing the raw
+// stream to `file` as well, so a stream the remuxer finds unsupported or
+// fails on partway can still go to ffmpeg. The first failure is kept in
+// `error` and the remuxer is fed nothing after it.
+struct RemuxingWriter {
+    FILE* file;
+    MkvToMp4* remux;
+    Sha256* hash = nullptr;
+    std::string error;
+};
+
+size_t remuxingWriteCallback(void* ptr, size_t size, size_t nmemb, RemuxingWriter* writer);
+// Completes the MP4; false with `error` set when the remux failed
+bool finishRemux(RemuxingWriter* writer);
+int progressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+int transferProgressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+
+// Defined in downloader.cpp
+size_t headerCallback(char* buffer, size_t size, size_t nitems, void* userdata);
+size_t ffmpegProgressCallback(void* ptr, size_t size, size_t nmemb, FILE* stream);
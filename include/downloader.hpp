@@ -1,31 +1,135 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <set>
 #include "tmdb.hpp"
+#include "games.hpp"
+#include "hls.hpp"
+#include "library_index.hpp"
+#include "readahead.hpp"
+
+struct TransferProgress;
+class ContentStore;
+class Mover;
+struct DownloadPlan;
+
+struct DownloadJob {
+    std::string url;
+    std::string output_path;
+    std::string label;
+    LibraryEntry item;  // kind, id and episode for the library index; empty kind when unknown
+};
+
+// What a HEAD request on a download URL found, redirects followed
+struct UrlProbe {
+    bool hls = false;
+    int64_t bytes = -1;  // -1 when unknown, always for HLS
+    std::string type;
+    std::string error;   // empty when the server answered
+};
 
 class Downloader {
 public:
     explicit Downloader(const std::string& base_url, bool mp4_mode = false, bool skip_specials = false);
+    ~Downloader();
     
     void setApiKey(const std::string& api_key) { api_key_ = api_key; }
+    // Downloads identical to a file already in the store become links to it
+    void setContentStore(ContentStore* store) { store_ = store; }
+    // Finished downloads are recorded in the library index
+    void setLibraryIndex(LibraryIndex* library) { library_ = library; }
+    void setHlsPolicy(const hls::Policy& policy) { hls_policy_ = policy; }
+    bool mp4Mode() const { return mp4_mode_; }
+    // Parallel transfers and stream connections adapt between 1 and
+    // `max_limit`, starting from what was learned for the host; 0 keeps
+    // them at the requested counts
+    void setConcurrency(size_t max_limit) { max_concurrency_ = max_limit; }
+    // Transfers and remuxes happen under `dir`, and finished files are
+    // handed to `mover` for the library; off while either is unset
+    void setStaging(const std::string& dir, Mover* mover) {
+        staging_dir_ = mover ? dir : "";
+        mover_ = mover;
+    }
     void downloadMovie(const Movie& movie, const std::string& output_dir);
-    void downloadEpisode(const Show& show, const Episode& episode, const std::string& output_dir);
+    void downloadEpisode(const Show& show, const EpisodeView& episode, const std::string& output_dir);
     void downloadSeason(const Show& show, int season, const std::string& output_dir);
     void downloadShow(const Show& show, const std::string& output_dir);
     
+    // `probe`, when given, receives what the HEAD request deciding the
+    // file's extension found
+    DownloadJob movieJob(const Movie& movie, const std::string& output_dir, UrlProbe* probe = nullptr);
+    DownloadJob episodeJob(const Show& show, const EpisodeView& episode, const std::string& output_dir,
+                           UrlProbe* probe = nullptr);
+    // Jobs for one season, or every season when `season` is negative,
+    // resolved in parallel
+    std::vector<DownloadJob> showJobs(const Show& show, int season, const std::string& output_dir,
+                                      std::vector<UrlProbe>* probes = nullptr);
+    DownloadJob gameJob(const Game& game, const std::string& output_dir);
+    
     void setProgressCallback(std::function<void(int, int)> callback);
     void downloadFile(const std::string& url, const std::string& output_path);
+    void downloadFile(const std::string& url, const std::string& output_path, TransferProgress* progress);
+    void downloadFile(const DownloadJob& job, TransferProgress* progress);
+    // Called once a file is in the library with null, or with why it did
+    // not get there; on the mover thread for a staged file
+    using Moved = std::function<void(std::exception_ptr)>;
+    // As above, but calls `fetched` once the transfer is done and before
+    // any remux, which moves no bytes and can take a while, and returns as
+    // soon as the output is handed to the mover; `moved` reports the rest.
+    // Transfer and remux failures still throw, and then `moved` is not called.
+    void downloadFile(const DownloadJob& job, TransferProgress* progress, const std::function<void()>& fetched,
+                      Moved moved);
+    void downloadFiles(const std::vector<DownloadJob>& jobs, size_t parallel);
+    // Sizes `jobs` against the free space under `target`, probing in
+    // parallel those without an entry in `probes`
+    DownloadPlan plan(const std::vector<DownloadJob>& jobs, std::vector<UrlProbe> probes, const std::string& target);
+    // Writes the job's bytes to `fd` in order as they arrive, fetching
+    // ranges or HLS segments ahead in parallel; nothing is saved, remuxed
+    // or recorded. False when the reader closed it early.
+    bool stream(const DownloadJob& job, int fd);
     void parseProgress(const std::string& line);
 
 private:
+    // Remux and move left to run on a finished transfer; empty output when
+    // none, empty input when only the move remains
+    struct PostProcess {
+        std::string input;
+        std::string output;
+        bool convert = false;  // to MP4, otherwise only stripping metadata
+        std::string key;       // content store key to record the output under
+        std::string audio;     // separately fetched audio rendition, muxed in
+        std::string move_to;   // library path for a staged output
+        LibraryEntry item;     // library index entry, recorded with the final path
+    };
+
     std::string base_url_;
     std::string api_key_;
     bool mp4_mode_;
     bool skip_specials_;
     std::function<void(int, int)> progress_callback_;
+    ContentStore* store_ = nullptr;
+    LibraryIndex* library_ = nullptr;
+    hls::Policy hls_policy_;
+    std::string staging_dir_;
+    Mover* mover_ = nullptr;
+    size_t max_concurrency_ = 0;
     
     std::string buildUrl(const std::string& tmdb_id, int season = 0, int episode = 0);
+    std::string finalPath(const std::string& output_path) const;
+    std::string stagedPath(const std::string& output_path) const;
+    PostProcess fetch(const DownloadJob& job, TransferProgress* progress);
+    PostProcess fetchHls(const std::string& url, const std::string& download_path, TransferProgress* progress);
+    // Ready once the output is in the library, which for a staged file is
+    // after the mover got to it; holds the move's failure
+    std::future<void> postProcess(const PostProcess& work, bool quiet);
+    void postProcess(const PostProcess& work, bool quiet, Moved done);
+    void remux(const PostProcess& work, bool quiet);
+    void record(const PostProcess& work, const std::string& path);
+    bool streamFile(const std::string& url, Readahead& readahead, const Readahead::Deliver& deliver);
+    bool streamHls(const std::string& url, int fd, Readahead& readahead, const Readahead::Deliver& deliver);
 };
\ No newline at end of file
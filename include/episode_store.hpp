@@ -0,0 +1,101 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+struct Episode;
+
+// Borrowed view of a stored episode, valid until the store is next modified
+struct EpisodeView {
+    int season;
+    int episode;
+    std::string_view name;
+    std::string_view air_date;
+};
+
+// Deduplicating string storage. Strings are appended to one buffer and
+// looked up through an open-addressed table of ids, so repeated values
+// ("Unknown", "TBA", shared air dates) are stored once.
+class StringPool {
+public:
+    uint32_t intern(std::string_view text);
+    std::string_view get(uint32_t id) const;
+    size_t size() const { return offsets_.size() - 1; }
+    size_t memoryUsage() const;
+
+private:
+    std::string data_;
+    std::vector<uint32_t> offsets_{0};
+    std::vector<uint32_t> slots_;  // id + 1, 0 marks an empty slot
+
+    void rehash(size_t capacity);
+};
+
+// Episodes of one show kept sorted by season and episode number, with a
+// per-season index so season lookups don't scan the whole show.
+class EpisodeStore {
+public:
+    class const_iterator {
+    public:
+        const_iterator(const EpisodeStore* store, size_t index) : store_(store), index_(index) {}
+
+        EpisodeView operator*() const { return (*store_)[index_]; }
+        const_iterator& operator++() { ++index_; return *this; }
+        bool operator==(const const_iterator& other) const { return index_ == other.index_; }
+        bool operator!=(const const_iterator& other) const { return index_ != other.index_; }
+
+    private:
+        const EpisodeStore* store_;
+        size_t index_;
+    };
+
+    struct Range {
+        const EpisodeStore* store;
+        size_t first;
+        size_t last;
+
+        const_iterator begin() const { return const_iterator(store, first); }
+        const_iterator end() const { return const_iterator(store, last); }
+        size_t size() const { return last - first; }
+        EpisodeView operator[](size_t index) const { return (*store)[first + index]; }
+    };
+
+    void add(int season, int episode, std::string_view name, std::string_view air_date);
+    void add(const Episode& episode);
+    void reserve(size_t count) { records_.reserve(count); }
+
+    size_t size() const { return records_.size(); }
+    bool empty() const { return records_.empty(); }
+    EpisodeView operator[](size_t index) const;
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, records_.size()); }
+
+    std::vector<int> seasons() const;
+    Range season(int season) const;
+    std::optional<EpisodeView> find(int season, int episode) const;
+
+    size_t memoryUsage() const;
+
+private:
+    struct Record {
+        int32_t season;
+        int32_t episode;
+        uint32_t name;
+        uint32_t air_date;
+    };
+
+    struct SeasonSpan {
+        int32_t season;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    std::vector<Record> records_;
+    std::vector<SeasonSpan> seasons_;
+    StringPool strings_;
+
+    void reindex();
+};
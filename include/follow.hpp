@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct FollowedShow {
+    std::string id;
+    std::string name;
+    int last_season = 0;   // newest episode already downloaded or skipped
+    int last_episode = 0;
+    int64_t next_check = 0;  // unix time of the next TMDB poll
+};
+
+// Shows the daemon keeps up to date, stored in ~/.yarrharr/followed.json
+class FollowList {
+public:
+    static FollowList load(const std::string& path);
+    void save() const;
+
+    std::vector<FollowedShow>& shows() { return shows_; }
+    const std::vector<FollowedShow>& shows() const { return shows_; }
+    FollowedShow* find(const std::string& id);
+    void add(const FollowedShow& show);
+    bool remove(const std::string& id);
+
+    static std::string getFollowPath();
+
+private:
+    std::string path_;
+    std::vector<FollowedShow> shows_;
+};
@@ -1,8 +1,13 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
 #include <nlohmann/json.hpp>
 #include <stdexcept>
+#include "worker_pool.hpp"
 
 class GameError : public std::runtime_error {
 public:
@@ -34,14 +39,27 @@ struct Game {
 
 class Games {
 public:
-    explicit Games(const std::string& api_key);
+    explicit Games(const std::string& api_key, size_t concurrency = 4,
+                   const std::string& base_url = "https://sleepy.engineer/api/yarrharr");
     
-    std::vector<Game> search(const std::string& query);
+    // Requests give up after this long; 0 waits as long as it takes
+    void setTimeout(long milliseconds) { timeout_ms_ = milliseconds; }
+
+    std::vector<Game> search(const std::string& query, size_t prefetch = 0);
     Game getGameDetails(const std::string& id);
+    std::shared_future<Game> getGameDetailsAsync(const std::string& id);
     std::string getDirectLink(const std::string& id);
 
 private:
     std::string api_key_;
+    std::string base_url_;
+    size_t concurrency_;
+    long timeout_ms_ = 0;
+    std::map<std::string, std::shared_future<Game>> details_;
+    std::mutex details_mutex_;
+    std::unique_ptr<WorkerPool> pool_;
+    
+    Game fetchGameDetails(const std::string& id);
     std::string makeRequest(const std::string& endpoint);
     void validateResponse(const nlohmann::json& json, const std::vector<std::string>& required_fields);
 }; 
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// HLS playlist parsing and rendition choice. Downloads fetch the segments of
+// one variant themselves, so which rendition is transferred is decided here
+// instead of by ffmpeg.
+namespace hls {
+    struct Variant {
+        std::string uri;
+        uint64_t bandwidth = 0;   // peak bits per second
+        int width = 0;
+        int height = 0;
+        std::string codecs;
+        std::string audio_group;
+    };
+
+    struct Rendition {
+        std::string type;         // AUDIO, SUBTITLES, CLOSED-CAPTIONS
+        std::string group_id;
+        std::string language;
+        std::string name;
+        std::string uri;          // empty when muxed into the variant
+        bool is_default = false;
+    };
+
+    struct Segment {
+        std::string uri;
+        double duration = 0;
+    };
+
+    struct Playlist {
+        bool master = false;
+        std::vector<Variant> variants;
+        std::vector<Rendition> renditions;
+
+        std::vector<Segment> segments;
+        std::string init_uri;     // EXT-X-MAP, fragmented MP4
+        bool encrypted = false;
+        bool byte_ranges = false;
+        bool ended = false;       // EXT-X-ENDLIST
+
+        double duration() const;
+        // A complete playlist whose segments concatenate into one stream
+        bool fetchable() const { return ended && !encrypted && !byte_ranges && !segments.empty(); }
+    };
+
+    // From the hls_* config settings; zero or empty means no preference
+    struct Policy {
+        int max_height = 0;
+        uint64_t max_bandwidth = 0;
+        std::string audio_language;
+        int deadline_seconds = 0;  // per download; switch down to meet it
+    };
+
+    // URIs in the playlist are resolved against `url`
+    Playlist parse(const std::string& text, const std::string& url);
+    std::string resolve(const std::string& base, const std::string& uri);
+
+    // Highest-bandwidth variant within the policy's limits, preferring ones
+    // with audio in the wanted language; the lowest variant when none fit.
+    // Throws std::runtime_error for a playlist without variants.
+    size_t chooseVariant(const Playlist& master, const Policy& policy);
+    // Next variant below `current` with the same codecs, keeping its audio
+    // group where possible and never leaving muxed audio for a separate
+    // rendition; `current` when there is none
+    size_t lowerVariant(const Playlist& master, size_t current);
+    // Audio rendition from the variant's group in the wanted language, else
+    // the default one; null when the variant has no audio group
+    const Rendition* chooseAudio(const Playlist& master, const Variant& variant, const Policy& policy);
+
+    // "en", "en-US" and "eng" all match "eng"
+    bool languageMatches(const std::string& tag, const std::string& wanted);
+}
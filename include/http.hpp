@@ -0,0 +1,9 @@
+#pragma once
+#include <curl/curl.h>
+
+namespace http {
+    // Attaches the calling thread's share handle, so easy handles created on
+    // one thread draw from one connection cache, DNS cache and TLS session
+    // cache
+    void share(CURL* curl);
+}
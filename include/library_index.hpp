@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct LibraryEntry {
+    std::string kind;       // "movie", "tv" or "game"
+    std::string id;         // TMDB or game id; empty for files only a rescan has seen
+    int season = 0;
+    int episode = 0;
+    std::string title;
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;      // nanoseconds
+    std::string hash;       // SHA-256 of the bytes as downloaded, empty when unknown
+};
+
+struct RescanReport {
+    size_t directories = 0;  // visited
+    size_t listed = 0;       // changed since the last scan, so read
+    size_t added = 0;
+    size_t updated = 0;
+    size_t removed = 0;
+};
+
+// Every file under download_path's Movies, TV Shows and Games folders, stored
+// as one file under ~/.yarrharr and memory-mapped read-only, so "is this
+// already downloaded?" never walks the library. Finished downloads are
+// recorded with their TMDB or game id; rescans only read directories whose
+// mtime changed since the last one. Changes are buffered and merged into a
+// freshly written file on flush(), as in SearchIndex.
+class LibraryIndex {
+public:
+    explicit LibraryIndex(const std::string& path = getIndexPath());
+    ~LibraryIndex();
+
+    LibraryIndex(const LibraryIndex&) = delete;
+    LibraryIndex& operator=(const LibraryIndex&) = delete;
+
+    // Files for a title; season and episode -1 match any
+    std::vector<LibraryEntry> find(const std::string& kind, const std::string& id,
+                                   int season = -1, int episode = -1) const;
+    // Case-insensitive match on titles and file names
+    std::vector<LibraryEntry> search(const std::string& text) const;
+    std::vector<LibraryEntry> entries() const;
+    size_t size() const;
+
+    // Records a finished download; size and mtime are read from entry.path
+    void add(LibraryEntry entry);
+    RescanReport rescan(const std::string& download_path);
+    void flush();
+
+    static std::string getIndexPath();
+
+private:
+    std::string path_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<LibraryEntry> pending_;
+    mutable std::mutex mutex_;
+
+    void map();
+    void unmap();
+    std::map<std::string, LibraryEntry> load() const;
+    std::map<std::string, int64_t> directories() const;
+    void write(const std::map<std::string, LibraryEntry>& files, const std::map<std::string, int64_t>& dirs);
+};
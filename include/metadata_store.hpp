@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "tmdb.hpp"
+
+// A followed show's seasons as last synced from TMDB
+struct ShowMetadata {
+    std::string name;
+    std::string status;       // TMDB status, e.g. "Returning Series"
+    int64_t last_sync = 0;    // unix time the data is current as of
+    std::map<int, std::vector<Episode>> seasons;
+
+    // What /tv/{id} would report on `today` (YYYY-MM-DD), from the stored
+    // air dates; specials never count as the last episode
+    ShowStatus airing(const std::string& id, const std::string& today) const;
+};
+
+struct SyncReport {
+    size_t requests = 0;      // TMDB requests made
+    size_t fetched = 0;       // shows fetched in full
+    size_t patched = 0;       // shows with changes applied
+    size_t seasons = 0;       // seasons re-fetched while patching
+    std::map<std::string, std::string> failed;  // show id -> error
+};
+
+// Local copy of followed shows' TMDB metadata in ~/.yarrharr/metadata.json,
+// kept current from TMDB's change lists rather than by fetching it again:
+// /tv/changes, read at most hourly, names the shows edited since the last
+// sync, /tv/{id}/changes which of their seasons, and only those seasons are
+// fetched and replaced in place. Shows never synced, or last synced before
+// the 14 days of changes TMDB keeps, are fetched in full.
+class MetadataStore {
+public:
+    static MetadataStore load(const std::string& path);
+    void save() const;
+
+    const ShowMetadata* find(const std::string& id) const;
+    // Drops shows that are no longer followed
+    void retain(const std::vector<std::string>& ids);
+    SyncReport sync(TMDB& tmdb, const std::vector<std::string>& ids, int64_t now);
+
+    static std::string getMetadataPath();
+
+private:
+    std::string path_;
+    std::map<std::string, ShowMetadata> shows_;
+    // /tv/changes has been read without gaps over [changes_from_, changes_until_]
+    int64_t changes_from_ = 0;
+    int64_t changes_until_ = 0;
+    std::map<std::string, int64_t> changed_;  // stored shows it listed, and when
+
+    void fetch(TMDB& tmdb, const std::string& id, int64_t now, SyncReport& report);
+    void patch(TMDB& tmdb, const std::string& id, int64_t now, SyncReport& report);
+};
@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <curl/curl.h>
+#include <nlohmann/json.hpp>
+
+namespace metrics {
+    class Counter {
+    public:
+        void add(uint64_t amount = 1) { value_.fetch_add(amount, std::memory_order_relaxed); }
+        uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value_{0};
+    };
+
+    // Latency histogram with fixed power-of-two buckets from 100us to about
+    // 52s. Observing is a couple of relaxed atomic adds, so it stays on.
+    class Histogram {
+    public:
+        static constexpr size_t BUCKETS = 20;
+
+        void observe(double seconds);
+        static double upperBound(size_t bucket);
+
+        uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+        double sum() const { return sum_micros_.load(std::memory_order_relaxed) / 1e6; }
+        uint64_t bucket(size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+        double quantile(double q) const;
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKETS + 1> buckets_{};
+        std::atomic<uint64_t> count_{0};
+        std::atomic<uint64_t> sum_micros_{0};
+    };
+
+    // Metrics are grouped into families by name; labels are stored already
+    // formatted (e.g. `kind="tmdb",phase="dns"`) so export is a plain walk.
+    // Returned references stay valid for the life of the process.
+    class Registry {
+    public:
+        static Registry& instance();
+
+        Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+        Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+        std::string prometheus();
+        nlohmann::json json();
+
+        // `.jsonl` paths get one summary line appended per call, anything
+        // else is rewritten in the Prometheus text format
+        void writeFile(const std::string& path);
+
+    private:
+        struct Family {
+            std::string help;
+            bool histogram = false;
+            std::map<std::string, std::unique_ptr<Counter>> counters;
+            std::map<std::string, std::unique_ptr<Histogram>> histograms;
+        };
+
+        std::mutex mutex_;
+        std::map<std::string, Family> families_;
+    };
+
+    // Times a stage of our own (probe, ffmpeg pass, ...) into
+    // yarrharr_stage_seconds{stage="..."}
+    class StageTimer {
+    public:
+        explicit StageTimer(const std::string& stage);
+        ~StageTimer();
+
+    private:
+        Histogram& histogram_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // Records curl's phase timings, bytes and connection reuse for a
+    // finished request
+    void recordRequest(CURL* curl, const std::string& kind, CURLcode result);
+
+    size_t peakRss();
+
+    class ScopedExport {
+    public:
+        explicit ScopedExport(const std::string& path) : path_(path) {}
+        ~ScopedExport();
+
+    private:
+        std::string path_;
+    };
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class RemuxError : public std::runtime_error {
+public:
+    explicit RemuxError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Streaming Matroska to MP4 conversion without re-encoding, for H.264/HEVC
+// video with AAC/AC-3 audio. Bytes are fed as they are downloaded: frames
+// go straight into the MP4's mdat and the moov is written in front of it
+// (faststart) once the stream ends. Subtitle tracks are dropped.
+//
+// Anything else is reported as Unsupported as soon as the track headers
+// have been read, before the output is created, and everything fed so far
+// is kept in probed() so the caller can write the Matroska file out and
+// fall back to ffmpeg.
+class MkvToMp4 {
+public:
+    enum class State { Probing, Remuxing, Unsupported };
+
+    explicit MkvToMp4(const std::string& output_path);
+    ~MkvToMp4();
+
+    MkvToMp4(const MkvToMp4&) = delete;
+    MkvToMp4& operator=(const MkvToMp4&) = delete;
+
+    // Throws RemuxError on malformed input or a failed write
+    void write(const void* data, size_t length);
+    // Writes the moov; a stream that ended while probing becomes Unsupported
+    void finish();
+
+    State state() const { return state_; }
+    const std::string& probed() const { return probed_; }
+    const std::string& reason() const { return reason_; }
+
+private:
+    enum class Codec { None, Avc, Hevc, Aac, Ac3 };
+
+    struct Track {
+        uint64_t number = 0;
+        uint64_t type = 0;
+        std::string codec_id;
+        std::string codec_private;
+        std::string language = "eng";  // the Matroska default
+        uint64_t default_duration = 0;  // ns
+        uint64_t width = 0, height = 0;
+        uint64_t display_width = 0, display_height = 0;
+        double sample_rate = 0;
+        uint64_t channels = 0;
+        bool encoded = false;
+
+        Codec codec = Codec::None;
+        std::vector<uint32_t> sizes;
+        std::vector<int64_t> pts;           // video, in Matroska ticks
+        std::vector<uint32_t> sync;         // video keyframes, 1-based
+        int64_t first_pts = 0;
+        std::vector<uint64_t> chunk_offsets;
+        std::vector<uint32_t> chunk_samples;
+        std::string ac3_header;             // first frame, for dac3
+    };
+
+    struct Master {
+        uint32_t id;
+        uint64_t end;
+    };
+
+    std::string output_path_;
+    State state_ = State::Probing;
+    std::string probed_;
+    std::string reason_;
+
+    std::string buffer_;
+    uint64_t position_ = 0;   // stream offset of buffer_[0]
+    uint64_t skip_ = 0;       // bytes of an ignored element still to come
+    std::vector<Master> stack_;
+
+    uint64_t timecode_scale_ = 1000000;
+    double duration_ = 0;
+    std::vector<Track> tracks_;
+    int64_t cluster_time_ = 0;
+    std::string group_block_;
+    bool group_referenced_ = false;
+
+    FILE* file_ = nullptr;
+    uint64_t reserve_ = 0;
+    uint64_t data_start_ = 0;
+    uint64_t data_end_ = 0;
+    Track* last_track_ = nullptr;
+    bool finished_ = false;
+
+    void parse();
+    int classify(uint32_t id) const;
+    void openMaster(uint32_t id);
+    void closeMaster(uint32_t id);
+    void element(uint32_t id, const uint8_t* data, size_t size);
+    void block(const uint8_t* data, size_t size, bool simple, bool keyframe);
+    void addSample(Track& track, int64_t pts, bool keyframe, const uint8_t* data, size_t size);
+    void decide();
+    std::string buildMoov(int64_t shift, bool co64);
+    void writeAt(uint64_t offset, const std::string& data);
+};
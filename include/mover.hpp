@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "worker_pool.hpp"
+
+// Moves finished downloads from the staging disk to the library. One
+// background thread handles the queue, so the library only ever sees one
+// sequential write at a time however many transfers run. A rename is used
+// when both paths are on the same filesystem; otherwise the file is copied
+// under a ".moving" name, synced and renamed into place, then the staged
+// copy is removed.
+class Mover {
+public:
+    // Called on the mover thread with the library path once a file has
+    // moved, or with why it could not be; `error` is empty on success
+    using Done = std::function<void(const std::string& destination, const std::string& error)>;
+
+    // `bytes_per_second` caps cross-filesystem copies; 0 = unlimited
+    explicit Mover(uint64_t bytes_per_second = 0);
+
+    void enqueue(const std::string& from, const std::string& to, Done done = {});
+    // Blocks until the queue is empty and returns the failures since the
+    // last call of moves enqueued without `done`, which get their own.
+    // Failed moves leave the file in staging.
+    std::vector<std::string> wait();
+    size_t pending() const { return pending_; }
+    uint64_t bandwidth() const { return bytes_per_second_; }
+
+    // Throws std::runtime_error; `to` is left untouched on failure
+    static void move(const std::string& from, const std::string& to, uint64_t bytes_per_second = 0);
+
+private:
+    uint64_t bytes_per_second_;
+    std::atomic<size_t> pending_{0};
+    std::mutex mutex_;
+    std::vector<std::string> failures_;
+    WorkerPool pool_;  // last, so it drains before the rest is destroyed
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class ProcessError : public std::runtime_error {
+public:
+    explicit ProcessError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Runs helper programs (ffmpeg) directly with posix_spawn and an argv vector,
+// so arguments never pass through a shell. Concurrent runs share a job
+// budget; callers beyond it wait for a slot.
+namespace process {
+    struct Options {
+        // Called with each line the child writes to stdout, newline stripped
+        std::function<void(const std::string& line)> on_line;
+        // Otherwise the child's stderr goes to /dev/null
+        bool inherit_stderr = false;
+        // The child writes its stdout here instead, and on_line is not called
+        int stdout_fd = -1;
+        // Polled while waiting; setting it terminates the child
+        const std::atomic<bool>* cancel = nullptr;
+    };
+
+    struct Result {
+        int exit_code = -1;
+        bool cancelled = false;
+
+        bool ok() const { return exit_code == 0 && !cancelled; }
+    };
+
+    // Absolute path of `name` on PATH, looked up once per process and cached.
+    // Empty when it is not installed.
+    std::string findProgram(const std::string& name);
+
+    // Throws ProcessError when the program cannot be found or spawned
+    Result run(const std::vector<std::string>& argv, const Options& options = {});
+
+    // Maximum number of children running at once; 0 picks a default from the
+    // CPU count
+    void setLimit(size_t jobs);
+    size_t limit();
+
+    // Terminates every running child. Only touches an atomic, so it is safe
+    // to call from a signal handler.
+    void cancelAll();
+}
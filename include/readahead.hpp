@@ -0,0 +1,33 @@
+#pragma once
+#include <functional>
+#include <string>
+
+class ConcurrencyController;
+
+// Fetches numbered pieces of one stream on a pool of threads, at most
+// `window` of them past the one being delivered, and hands them over
+// strictly in order. The consumer starts on piece 0 as soon as it lands
+// while later ones are still in flight, and memory stays bounded by the
+// window however far the fetchers could get ahead.
+class Readahead {
+public:
+    using Fetch = std::function<std::string(size_t index)>;
+    // Returning false stops the stream, e.g. when the reader went away
+    using Deliver = std::function<bool(const std::string& piece)>;
+
+    Readahead(size_t parallel, size_t window, int attempts = 3);
+
+    // Lets `controller` decide how many pieces are fetched at once, in
+    // place of `parallel`; the window grows to keep them all busy
+    void setController(ConcurrencyController* controller) { controller_ = controller; }
+
+    // Returns false when deliver stopped it. A piece that fails every
+    // attempt throws, after all pieces before it were delivered.
+    bool run(size_t count, const Fetch& fetch, const Deliver& deliver);
+
+private:
+    size_t parallel_;
+    size_t window_;
+    int attempts_;
+    ConcurrencyController* controller_ = nullptr;
+};
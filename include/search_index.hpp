@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+struct IndexEntry {
+    std::string media_type;  // "movie" or "tv", same values as TMDB's media_type
+    std::string id;
+    std::string title;
+    std::string year;
+};
+
+// Trigram index over every title yarrharr has resolved, stored as a single
+// file under ~/.yarrharr and memory-mapped read-only. New titles are buffered
+// and merged into a freshly written file on flush(), under a lock file so
+// concurrent flushes from the daemon and the CLI keep each other's titles.
+class SearchIndex {
+public:
+    explicit SearchIndex(const std::string& path);
+    ~SearchIndex();
+
+    SearchIndex(const SearchIndex&) = delete;
+    SearchIndex& operator=(const SearchIndex&) = delete;
+
+    std::vector<IndexEntry> search(const std::string& query, size_t limit = 10) const;
+    void add(const IndexEntry& entry);
+    void flush();
+    size_t size() const;
+
+    static std::string getIndexPath();
+
+private:
+    std::string path_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<IndexEntry> pending_;
+    mutable std::mutex mutex_;
+
+    void map();
+    void unmap();
+    bool valid() const;
+    std::vector<IndexEntry> entries() const;
+};
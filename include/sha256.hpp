@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Incremental SHA-256, fed as bytes arrive so files are hashed in the same
+// pass that writes them
+class Sha256 {
+public:
+    Sha256();
+
+    void update(const void* data, size_t length);
+    std::string hexDigest();
+    void digest(uint8_t out[32]);
+
+    static std::string hashFile(const std::string& path);
+
+private:
+    uint32_t state_[8];
+    uint8_t buffer_[64];
+    uint64_t length_ = 0;
+    size_t buffered_ = 0;
+
+    void transform(const uint8_t block[64]);
+    void compress(const uint8_t* data, size_t blocks);
+};
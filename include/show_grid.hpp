@@ -0,0 +1,6 @@
+#pragma once
+#include <ostream>
+#include "episode_store.hpp"
+
+// The season-per-column episode listing printed by `yarrharr show`
+void printShowGrid(const EpisodeStore& episodes, int termWidth, std::ostream& out);
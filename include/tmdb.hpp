@@ -1,7 +1,12 @@
 #pragma once
+#include <cstdint>
+#include <set>
 #include <string>
 #include <vector>
 #include <nlohmann/json.hpp>
+#include "episode_store.hpp"
+
+class SearchIndex;
 
 struct Episode {
     int season;
@@ -14,7 +19,25 @@ struct Show {
     std::string id;
     std::string name;
     std::string first_air_date;
-    std::vector<Episode> episodes;
+    EpisodeStore episodes;
+};
+
+// Just the airing state of a show, from a single /tv/{id} request
+struct ShowStatus {
+    std::string id;
+    std::string name;
+    std::string status;
+    int last_season = 0;
+    int last_episode = 0;
+    std::string last_air_date;
+    std::string next_air_date;
+    std::vector<int> seasons;  // season numbers the show lists
+};
+
+// What /tv/{id}/changes reports as edited since a given time
+struct ShowChanges {
+    bool changed = false;
+    std::set<int> seasons;  // seasons whose episodes were added, removed or edited
 };
 
 struct Movie {
@@ -25,14 +48,28 @@ struct Movie {
 
 class TMDB {
 public:
-    explicit TMDB(const std::string& api_key);
+    explicit TMDB(const std::string& api_key, const std::string& base_url = "https://api.themoviedb.org/3");
+    
+    void setSearchIndex(SearchIndex* index) { index_ = index; }
+    // Requests give up after this long; 0 waits as long as it takes
+    void setTimeout(long milliseconds) { timeout_ms_ = milliseconds; }
     
     std::vector<nlohmann::json> search(const std::string& query);
     Show getShowDetails(const std::string& id);
+    ShowStatus getShowStatus(const std::string& id);
     Movie getMovieDetails(const std::string& id);
     std::vector<Episode> getSeasonEpisodes(const std::string& show_id, int season);
+    // Ids of every show edited on TMDB between two unix times, at most 14
+    // days apart, from all pages of /tv/changes
+    std::vector<std::string> getChangedShows(int64_t since, int64_t until);
+    ShowChanges getShowChanges(const std::string& id, int64_t since);
+    
+    static std::vector<Episode> parseSeasonEpisodes(const std::string& response, int season);
 
 private:
     std::string api_key_;
+    std::string base_url_;
+    SearchIndex* index_ = nullptr;
+    long timeout_ms_ = 0;
     std::string makeRequest(const std::string& endpoint);
 };
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Chrome/Perfetto trace-event output for --trace. Spans are appended to a
+// per-thread ring buffer (no shared state on the hot path) and only merged
+// into JSON when the session ends. With no session running a Span costs one
+// relaxed atomic load.
+namespace trace {
+    extern std::atomic<bool> active;
+
+    inline bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    // Names the calling thread's track in the viewer
+    void setThreadName(const std::string& name);
+
+    class Span {
+    public:
+        Span(const char* category, const char* name, const std::string& detail = "");
+        ~Span();
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* category_;
+        const char* name_;
+        std::string detail_;
+        uint64_t start_ = 0;
+    };
+
+    // Collects events for its lifetime and writes them to path when it ends.
+    // An empty path leaves tracing off.
+    class Session {
+    public:
+        explicit Session(const std::string& path);
+        ~Session();
+
+    private:
+        std::string path_;
+    };
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <string>
+
+namespace updater {
+    // Release asset suffix for this build, e.g. "linux-x86_64"; empty when
+    // self-update isn't supported on this platform
+    std::string platformName();
+
+    bool updateBinary(const char* execPath);
+}
@@ -1,7 +1,11 @@
 #pragma once
+#include <cstdint>
+#include <ctime>
 #include <string>
 #include <vector>
 
+struct stat;
+
 namespace utils {
     std::string sanitizeFilename(const std::string& filename);
     std::string formatFileSize(size_t bytes);
@@ -10,4 +14,37 @@ namespace utils {
     bool createDirectoryIfNotExists(const std::string& path);
     std::vector<std::string> wrapText(const std::string& text, size_t width);
     std::string padNumber(int num, int width);
+    std::string urlEncode(const std::string& text);
+    // UTC calendar dates as TMDB writes them, "2024-06-10"; parseDate also
+    // takes a time after the date ("2024-06-10 08:49:57 UTC") and returns 0
+    // for anything it can't read
+    std::string formatDate(int64_t time);
+    int64_t parseDate(const std::string& text);
+    // stat times; Linux calls them st_atim/st_mtim, macOS st_atimespec/st_mtimespec
+    timespec accessTime(const struct stat& st);
+    timespec modifyTime(const struct stat& st);
+    // Portable stand-ins for SOCK_CLOEXEC/accept4 and MSG_NOSIGNAL, which
+    // are Linux-only: marks a new socket close-on-exec and, where there is
+    // SO_NOSIGPIPE, keeps it from raising SIGPIPE; -1 passes through
+    int prepareSocket(int fd);
+    int sendFlags();  // for send(), MSG_NOSIGNAL where it exists
+    // Replaces path with data through a uniquely named file in the same
+    // directory, fsyncing the file and the directory, so concurrent writers
+    // never share a temp file and a crash leaves either the old or the new
+    // contents; throws std::runtime_error
+    void writeFileAtomically(const std::string& path, const std::string& data);
+
+    // Exclusive flock() on path, created if missing, held for the object's
+    // lifetime; serializes read-merge-write cycles between processes
+    class FileLock {
+    public:
+        explicit FileLock(const std::string& path);
+        ~FileLock();
+
+        FileLock(const FileLock&) = delete;
+        FileLock& operator=(const FileLock&) = delete;
+
+    private:
+        int fd_;
+    };
 }
\ No newline at end of file
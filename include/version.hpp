@@ -1,6 +1,11 @@
 #pragma once
 #include <string>
 #include <string_view>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 
 namespace version {
     constexpr std::string_view CURRENT_VERSION = "3.0.0";
@@ -10,4 +15,29 @@ namespace version {
     bool isUpdateAvailable();
     
     bool isVersionNewer(const std::string& version1, const std::string& version2);
-} 
\ No newline at end of file
+
+    // Startup update check that stays off the critical path. The latest
+    // release is cached in ~/.yarrharr/update_check.json and refreshed in the
+    // background at most once per interval; the notice prints on destruction.
+    class UpdateNotifier {
+    public:
+        explicit UpdateNotifier(int interval_hours);
+        ~UpdateNotifier();
+
+        UpdateNotifier(const UpdateNotifier&) = delete;
+        UpdateNotifier& operator=(const UpdateNotifier&) = delete;
+
+    private:
+        struct State {
+            std::mutex mutex;
+            std::condition_variable finished;
+            bool done = false;
+            std::atomic<bool> cancelled{false};  // aborts the request in flight
+            std::string latest;
+        };
+
+        std::string cached_latest_;
+        std::shared_ptr<State> refresh_;
+        std::thread thread_;
+    };
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of threads draining a FIFO of tasks. Exceptions thrown by
+// tasks submitted through async() are delivered through the returned future.
+// With max_queued set, submit() blocks while that many tasks are waiting,
+// which pushes back on whatever is producing them.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t threads, size_t max_queued = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void submit(std::function<void()> task);
+    void wait();
+    size_t threads() const { return workers_.size(); }
+
+    template <typename F>
+    auto async(F&& fn) -> std::future<decltype(fn())> {
+        using Result = decltype(fn());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(fn));
+        auto future = task->get_future();
+        submit([task] { (*task)(); });
+        return future;
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable task_cv_;
+    std::condition_variable idle_cv_;
+    std::condition_variable space_cv_;
+    size_t max_queued_;
+    size_t active_ = 0;
+    bool stopping_ = false;
+
+    void run();
+};
@@ -0,0 +1,65 @@
+#!/bin/bash
+# Builds a profile-guided release: an instrumented build trains on the
+# benchmark suite and the loopback workload (JSON decoding, progress and
+# header parsing, transfers), then the final build uses the profile.
+# A plain Release build is benchmarked alongside for comparison.
+#
+# Usage: scripts/pgo.sh [build-root] [extra cmake args...]
+set -e
+
+ROOT=${1:-build-pgo}
+shift || true
+CMAKE_ARGS=("$@")
+mkdir -p "$ROOT"
+ROOT=$(cd "$ROOT" && pwd)
+PROFILES="$ROOT/profiles"
+JOBS=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)
+
+configure() {
+    cmake -S . -B "$1" -DCMAKE_BUILD_TYPE=Release -DYARRHARR_BUILD_BENCH=ON \
+        -DYARRHARR_PGO_DIR="$PROFILES" "${CMAKE_ARGS[@]}" "${@:2}"
+    cmake --build "$1" -j"$JOBS"
+}
+
+train() {
+    "$1/yarrharr_bench" --min-time 0.05 --repetitions 1 > /dev/null
+    "$1/yarrharr_loopback" --concurrency 1,4 --size-mb 4 > /dev/null
+    "$1/yarrharr_loopback" --concurrency 4 --size-mb 1 --faults 0.1 > /dev/null
+}
+
+rm -rf "$PROFILES"
+mkdir -p "$PROFILES"
+
+# GCC names profiles after the object paths, so both stages share a build tree
+echo "==> Instrumented build"
+configure "$ROOT/pgo" -DYARRHARR_PGO=GENERATE
+echo "==> Training"
+train "$ROOT/pgo"
+
+if ls "$PROFILES"/*.profraw > /dev/null 2>&1; then
+    PROFDATA=$(command -v llvm-profdata || xcrun -f llvm-profdata)
+    "$PROFDATA" merge -o "$PROFILES/default.profdata" "$PROFILES"/*.profraw
+fi
+
+echo "==> Optimized build"
+configure "$ROOT/pgo" -DYARRHARR_PGO=USE
+echo "==> Baseline build"
+configure "$ROOT/baseline"
+
+echo "==> Benchmarks"
+"$ROOT/baseline/yarrharr_bench" --json "$ROOT/baseline.json"
+"$ROOT/pgo/yarrharr_bench" --json "$ROOT/pgo.json"
+
+if command -v python3 > /dev/null; then
+    python3 - "$ROOT/baseline.json" "$ROOT/pgo.json" <<'EOF'
+import json, sys
+load = lambda path: {b["name"]: b["real_time"] for b in json.load(open(path))["benchmarks"]}
+baseline, pgo = load(sys.argv[1]), load(sys.argv[2])
+print(f"{'benchmark':<44} {'baseline':>12} {'pgo':>12} {'change':>8}")
+for name, time in baseline.items():
+    if name in pgo:
+        print(f"{name:<44} {time:>12.1f} {pgo[name]:>12.1f} {(pgo[name] / time - 1) * 100:>+7.1f}%")
+EOF
+fi
+
+echo "Optimized binary: $ROOT/pgo/yarrharr"
@@ -0,0 +1,241 @@
+#include "batch.hpp"
+#include "worker_pool.hpp"
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace {
+    void parseEpisodeRange(const std::string& text, BatchItem& item) {
+        try {
+            size_t dash = text.find('-');
+            item.first_episode = std::stoi(text.substr(0, dash));
+            item.last_episode = dash == std::string::npos ? item.first_episode : std::stoi(text.substr(dash + 1));
+        } catch (const std::exception&) {
+            throw BatchError("Invalid episode range: " + text);
+        }
+    }
+
+    std::string idString(const nlohmann::json& value) {
+        return value.is_string() ? value.get<std::string>() : std::to_string(value.get<std::int64_t>());
+    }
+
+    BatchItem parseJsonItem(const nlohmann::json& json) {
+        BatchItem item;
+        if (json.contains("movie")) {
+            item.kind = BatchItem::Kind::Movie;
+            item.id = idString(json["movie"]);
+        } else if (json.contains("show")) {
+            item.kind = BatchItem::Kind::Show;
+            item.id = idString(json["show"]);
+        } else if (json.contains("game")) {
+            item.kind = BatchItem::Kind::Game;
+            item.id = idString(json["game"]);
+        } else {
+            throw BatchError("Manifest item needs a movie, show or game id: " + json.dump());
+        }
+
+        if (json.contains("season")) {
+            item.season = json["season"].get<int>();
+        }
+        if (json.contains("episodes")) {
+            const auto& episodes = json["episodes"];
+            parseEpisodeRange(episodes.is_string() ? episodes.get<std::string>() : std::to_string(episodes.get<int>()), item);
+        } else if (json.contains("episode")) {
+            item.first_episode = item.last_episode = json["episode"].get<int>();
+        }
+        return item;
+    }
+
+    BatchItem parseLineItem(std::istringstream& tokens, const std::string& kind, int lineNumber) {
+        BatchItem item;
+        if (kind == "movie") {
+            item.kind = BatchItem::Kind::Movie;
+        } else if (kind == "show") {
+            item.kind = BatchItem::Kind::Show;
+        } else if (kind == "game") {
+            item.kind = BatchItem::Kind::Game;
+        } else {
+            throw BatchError("Line " + std::to_string(lineNumber) + ": unknown item type '" + kind + "'");
+        }
+
+        if (!(tokens >> item.id)) {
+            throw BatchError("Line " + std::to_string(lineNumber) + ": missing id");
+        }
+
+        std::string key, value;
+        while (tokens >> key >> value) {
+            if (key == "season") {
+                item.season = std::stoi(value);
+            } else if (key == "episode" || key == "episodes") {
+                parseEpisodeRange(value, item);
+            } else {
+                throw BatchError("Line " + std::to_string(lineNumber) + ": unknown option '" + key + "'");
+            }
+        }
+        return item;
+    }
+}
+
+Manifest Manifest::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw BatchError("Could not open manifest: " + path);
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return parse(buffer.str());
+}
+
+Manifest Manifest::parse(const std::string& text) {
+    Manifest manifest;
+    size_t start = text.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        return manifest;
+    }
+
+    if (text[start] == '{' || text[start] == '[') {
+        try {
+            auto json = nlohmann::json::parse(text);
+            const auto& items = json.is_array() ? json : json["items"];
+            if (json.is_object() && json.contains("jobs")) {
+                manifest.jobs = json["jobs"].get<size_t>();
+            }
+            for (const auto& item : items) {
+                manifest.items.push_back(parseJsonItem(item));
+            }
+        } catch (const nlohmann::json::exception& e) {
+            throw BatchError(std::string("Invalid manifest: ") + e.what());
+        }
+        return manifest;
+    }
+
+    std::istringstream lines(text);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(lines, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string kind;
+        if (!(tokens >> kind)) {
+            continue;
+        }
+        if (kind == "jobs") {
+            tokens >> manifest.jobs;
+            continue;
+        }
+        try {
+            manifest.items.push_back(parseLineItem(tokens, kind, lineNumber));
+        } catch (const std::invalid_argument&) {
+            throw BatchError("Line " + std::to_string(lineNumber) + ": expected a number");
+        }
+    }
+    return manifest;
+}
+
+BatchRunner::BatchRunner(TMDB& tmdb, Games& games, Downloader& downloader, const std::string& output_dir, bool skip_specials)
+    : tmdb_(tmdb), games_(games), downloader_(downloader), output_dir_(output_dir), skip_specials_(skip_specials) {}
+
+std::vector<DownloadJob> BatchRunner::plan(const Manifest& manifest) {
+    WorkerPool pool(manifest.jobs);
+
+    // Every title is resolved once no matter how many items refer to it
+    std::map<std::string, std::future<Show>> shows;
+    std::map<std::string, std::future<Movie>> movies;
+    std::map<std::string, std::shared_future<Game>> games;
+    for (const auto& item : manifest.items) {
+        switch (item.kind) {
+        case BatchItem::Kind::Show:
+            if (!shows.count(item.id)) {
+                shows.emplace(item.id, pool.async([this, id = item.id] { return tmdb_.getShowDetails(id); }));
+            }
+            break;
+        case BatchItem::Kind::Movie:
+            if (!movies.count(item.id)) {
+                movies.emplace(item.id, pool.async([this, id = item.id] { return tmdb_.getMovieDetails(id); }));
+            }
+            break;
+        case BatchItem::Kind::Game:
+            if (!games.count(item.id)) {
+                games.emplace(item.id, games_.getGameDetailsAsync(item.id));
+            }
+            break;
+        }
+    }
+
+    std::map<std::string, Show> resolvedShows;
+    for (auto& [id, future] : shows) {
+        try {
+            resolvedShows.emplace(id, future.get());
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping show " << id << ": " << e.what() << "\n";
+        }
+    }
+
+    // Building a job probes its URL, so those run on the pool as well
+    std::vector<std::future<DownloadJob>> pending;
+    for (const auto& item : manifest.items) {
+        if (item.kind == BatchItem::Kind::Movie) {
+            auto& future = movies.at(item.id);
+            if (!future.valid()) continue;
+            try {
+                auto movie = future.get();
+                pending.push_back(pool.async([this, movie] { return downloader_.movieJob(movie, output_dir_); }));
+            } catch (const std::exception& e) {
+                std::cerr << "Skipping movie " << item.id << ": " << e.what() << "\n";
+            }
+        } else if (item.kind == BatchItem::Kind::Game) {
+            try {
+                auto game = games.at(item.id).get();
+                pending.push_back(pool.async([this, game] { return downloader_.gameJob(game, output_dir_); }));
+            } catch (const std::exception& e) {
+                std::cerr << "Skipping game " << item.id << ": " << e.what() << "\n";
+            }
+        } else {
+            auto it = resolvedShows.find(item.id);
+            if (it == resolvedShows.end()) continue;
+            const Show& show = it->second;
+
+            std::vector<int> seasons = item.season >= 0 ? std::vector<int>{item.season} : show.episodes.seasons();
+            for (int season : seasons) {
+                if (skip_specials_ && season == 0 && item.season < 0) continue;
+                for (const auto& episode : show.episodes.season(season)) {
+                    if (item.first_episode >= 0 &&
+                        (episode.episode < item.first_episode || episode.episode > item.last_episode)) {
+                        continue;
+                    }
+                    pending.push_back(pool.async([this, &show, episode] {
+                        return downloader_.episodeJob(show, episode, output_dir_);
+                    }));
+                }
+            }
+        }
+    }
+
+    std::vector<DownloadJob> jobs;
+    std::set<std::string> planned;
+    for (auto& future : pending) {
+        try {
+            auto job = future.get();
+            if (planned.insert(job.output_path).second) {
+                jobs.push_back(std::move(job));
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping item: " << e.what() << "\n";
+        }
+    }
+    return jobs;
+}
+
+void BatchRunner::run(const Manifest& manifest) {
+    std::cout << "Resolving " << manifest.items.size() << " manifest items...\n";
+    auto jobs = plan(manifest);
+    if (jobs.empty()) {
+        std::cout << "Nothing to download.\n";
+        return;
+    }
+    downloader_.downloadFiles(jobs, manifest.jobs);
+}
@@ -0,0 +1,129 @@
+#include "catalog.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "worker_pool.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+
+namespace {
+    std::vector<std::string> words(const std::string& text) {
+        std::vector<std::string> result;
+        std::string word;
+        for (char c : text + " ") {
+            if (std::isalnum(static_cast<unsigned char>(c))) {
+                word += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            } else if (!word.empty()) {
+                result.push_back(word);
+                word.clear();
+            }
+        }
+        return result;
+    }
+
+    std::vector<catalog::Result> searchTmdb(TMDB& tmdb, const std::string& query) {
+        std::vector<catalog::Result> results;
+        for (const auto& item : tmdb.search(query)) {
+            std::string kind = item.value("media_type", "");
+            if (kind != "movie" && kind != "tv") continue;
+            catalog::Result result;
+            result.kind = kind;
+            result.id = std::to_string(item["id"].get<std::int64_t>());
+            result.title = kind == "movie" ? item.value("title", "") : item.value("name", "");
+            std::string date = kind == "movie" ? "release_date" : "first_air_date";
+            if (item.contains(date) && item[date].is_string()) {
+                result.date = item[date].get<std::string>();
+            }
+            results.push_back(result);
+        }
+        return results;
+    }
+
+    std::vector<catalog::Result> searchGames(Games& games, const std::string& query) {
+        std::vector<catalog::Result> results;
+        for (const auto& game : games.search(query)) {
+            results.push_back({"game", game.id, game.title, game.date});
+        }
+        return results;
+    }
+}
+
+namespace catalog {
+    double score(const std::string& query, const std::string& title, size_t position) {
+        auto wanted = words(query);
+        auto found = words(title);
+        std::set<std::string> have(found.begin(), found.end());
+
+        // Share of the query's words in the title, with a bonus for the
+        // title being exactly the query or starting with it; the backend's
+        // own order only breaks ties between similar matches
+        double matched = 0;
+        for (const auto& word : wanted) {
+            matched += have.count(word);
+        }
+        double result = wanted.empty() ? 0 : matched / wanted.size();
+        if (!wanted.empty() && found == wanted) {
+            result += 0.5;
+        } else if (!wanted.empty() && found.size() > wanted.size() &&
+                   std::equal(wanted.begin(), wanted.end(), found.begin())) {
+            result += 0.25;
+        }
+        return result + 0.3 / (1.0 + position);
+    }
+
+    std::vector<Result> search(TMDB& tmdb, Games& games, const std::string& query,
+                               const std::function<void(const Answer&)>& on_answer) {
+        trace::Span span("search", "catalog", query);
+        std::mutex mutex;
+        std::condition_variable answered;
+        std::vector<Answer> answers;
+
+        auto started = std::chrono::steady_clock::now();
+        auto ask = [&](const std::string& backend, std::function<std::vector<Result>()> run) {
+            Answer answer{backend};
+            try {
+                answer.results = run();
+            } catch (const std::exception& e) {
+                answer.error = e.what();
+            }
+            answer.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            metrics::Registry::instance()
+                .histogram("yarrharr_search_backend_seconds", "Time for a search backend to answer",
+                           "backend=\"" + backend + "\"")
+                .observe(answer.seconds);
+            std::lock_guard<std::mutex> lock(mutex);
+            answers.push_back(std::move(answer));
+            answered.notify_one();
+        };
+
+        // Backends that time out end on their own, so the pool's join
+        // never waits past the slower timeout
+        WorkerPool pool(2);
+        pool.submit([&] { ask("TMDB", [&] { return searchTmdb(tmdb, query); }); });
+        pool.submit([&] { ask("Games", [&] { return searchGames(games, query); }); });
+
+        std::vector<Result> merged;
+        for (size_t handled = 0; handled < 2; handled++) {
+            Answer answer;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                answered.wait(lock, [&] { return answers.size() > handled; });
+                answer = answers[handled];
+            }
+            for (size_t i = 0; i < answer.results.size(); i++) {
+                answer.results[i].score = score(query, answer.results[i].title, i);
+            }
+            if (on_answer) {
+                on_answer(answer);
+            }
+            merged.insert(merged.end(), answer.results.begin(), answer.results.end());
+        }
+
+        std::stable_sort(merged.begin(), merged.end(),
+                         [](const Result& a, const Result& b) { return a.score > b.score; });
+        return merged;
+    }
+}
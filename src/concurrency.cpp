@@ -0,0 +1,206 @@
+#include "concurrency.hpp"
+#include "config.hpp"
+#include "download_utils.hpp"
+#include "metrics.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+namespace {
+    // Long enough for a transfer to reach speed; short enough that a run of
+    // a few minutes still converges
+    constexpr std::chrono::seconds WINDOW(5);
+    constexpr std::chrono::seconds STALL(15);
+    // Goodput a step up has to add to count as an improvement
+    constexpr double GAIN = 1.05;
+}
+
+ConcurrencyController::Slot::Slot(ConcurrencyController* controller, const TransferProgress* progress)
+    : controller_(controller) {
+    if (controller_) {
+        id_ = controller_->acquire(progress);
+    }
+}
+
+ConcurrencyController::Slot::~Slot() {
+    if (controller_) {
+        controller_->release(id_, failed_);
+    }
+}
+
+void ConcurrencyController::Slot::transferred(uint64_t bytes) {
+    if (controller_) {
+        controller_->add(bytes);
+    }
+}
+
+ConcurrencyController::ConcurrencyController(const std::string& host, const std::string& kind, size_t initial,
+                                             size_t max_limit, const std::string& path)
+    : path_(path), host_(host), kind_(kind), max_(std::max<size_t>(max_limit, 1)), limit_(initial),
+      window_start_(Clock::now()) {
+    try {
+        std::ifstream file(path_);
+        if (file.is_open()) {
+            nlohmann::json j;
+            file >> j;
+            limit_ = j.at(host_).at(kind_).get<size_t>();
+        }
+    } catch (const std::exception&) {
+        // Nothing learned for this host yet
+    }
+    limit_ = std::clamp<size_t>(limit_, 1, max_);
+}
+
+size_t ConcurrencyController::limit() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limit_;
+}
+
+uint64_t ConcurrencyController::acquire(const TransferProgress* progress) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    waiting_++;
+    slot_cv_.wait(lock, [this] { return holders_.size() < limit_; });
+    waiting_--;
+    uint64_t id = next_id_++;
+    holders_[id] = {progress, progress ? static_cast<int64_t>(progress->now.load()) : 0, Clock::now()};
+    return id;
+}
+
+void ConcurrencyController::release(uint64_t id, bool failed) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = holders_.find(id);
+        if (it != holders_.end()) {
+            if (it->second.progress) {
+                bytes_ += std::max<int64_t>(0, it->second.progress->now.load() - it->second.seen);
+            }
+            holders_.erase(it);
+        }
+        failures_ += failed ? 1 : 0;
+    }
+    slot_cv_.notify_one();
+}
+
+void ConcurrencyController::add(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_ += bytes;
+}
+
+bool ConcurrencyController::tick() {
+    size_t before;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        before = limit_;
+        auto now = Clock::now();
+        for (auto& [id, holder] : holders_) {
+            if (!holder.progress) continue;
+            int64_t seen = holder.progress->now.load();
+            if (seen != holder.seen) {
+                bytes_ += std::max<int64_t>(0, seen - holder.seen);
+                holder.seen = seen;
+                holder.moved = now;
+            } else if (now - holder.moved >= STALL) {
+                stalls_++;
+                holder.moved = now;
+            }
+        }
+        saturated_ = saturated_ && holders_.size() + waiting_ >= limit_;
+
+        if (now - window_start_ >= WINDOW) {
+            adjust(std::chrono::duration<double>(now - window_start_).count());
+            window_start_ = now;
+            bytes_ = 0;
+            failures_ = 0;
+            stalls_ = 0;
+            saturated_ = true;
+        }
+    }
+    slot_cv_.notify_all();
+    return limit() != before;
+}
+
+void ConcurrencyController::adjust(double seconds) {
+    size_t before = limit_;
+    if (failures_ > 0 || stalls_ > 0) {
+        // Multiplicative decrease; the goodput seen higher up was measured
+        // before whatever is failing now
+        limit_ = std::max<size_t>(1, limit_ / 2);
+        goodput_.erase(goodput_.upper_bound(limit_), goodput_.end());
+    } else {
+        double rate = bytes_ / seconds;
+        rate_ = rate_ == 0 ? rate : 0.5 * rate_ + 0.5 * rate;
+        double& seen = goodput_[limit_];
+        seen = seen == 0 ? rate : 0.5 * seen + 0.5 * rate;
+
+        // Not every slot was in use, so the limit was not what held it back
+        if (!saturated_ || rate == 0) {
+            return;
+        }
+        auto below = goodput_.find(limit_ - 1);
+        if (below != goodput_.end() && seen < below->second * GAIN) {
+            limit_--;
+        } else if (limit_ < max_) {
+            limit_++;
+        }
+    }
+
+    if (limit_ != before) {
+        metrics::Registry::instance()
+            .counter("yarrharr_concurrency_changes_total", "Adaptive concurrency limit changes",
+                     "kind=\"" + kind_ + "\",direction=\"" + (limit_ > before ? "up" : "down") + "\"")
+            .add();
+    }
+}
+
+void ConcurrencyController::save() const {
+    nlohmann::json j = nlohmann::json::object();
+    {
+        std::ifstream file(path_);
+        if (file.is_open()) {
+            try {
+                file >> j;
+            } catch (const std::exception&) {
+                j = nlohmann::json::object();
+            }
+        }
+    }
+    j[host_][kind_] = limit();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (rate_ > 0) {
+            j[host_]["goodput"][kind_] = rate_;
+        }
+    }
+
+    try {
+        utils::writeFileAtomically(path_, j.dump(2));
+    } catch (const std::exception&) {
+    }
+}
+
+double ConcurrencyController::goodput(const std::string& host, const std::string& kind, const std::string& path) {
+    try {
+        std::ifstream file(path);
+        if (file.is_open()) {
+            nlohmann::json j;
+            file >> j;
+            return j.at(host).at("goodput").at(kind).get<double>();
+        }
+    } catch (const std::exception&) {
+    }
+    return 0;
+}
+
+std::string ConcurrencyController::hostOf(const std::string& url) {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    size_t end = url.find_first_of("/?#", start);
+    std::string host = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+    return host;
+}
+
+std::string ConcurrencyController::getStatePath() {
+    return Config::getDataPath("concurrency.json");
+}
@@ -14,6 +14,11 @@ std::string Config::getConfigPath() {
     return (fs::path(home) / ".yarrharr" / "config.json").string();
 }
 
+std::string Config::getDataPath(const std::string& name) {
+    ensureConfigDirectory();
+    return (fs::path(getenv("HOME")) / ".yarrharr" / name).string();
+}
+
 void Config::ensureConfigDirectory() {
     const char* home = getenv("HOME");
     if (!home) {
@@ -48,13 +53,26 @@ Config Config::load(const std::string& path) {
     nlohmann::json j;
     file >> j;
     
-    return Config{
+    Config config{
         j["tmdb_api_key"].get<std::string>(),
         j["yarrharr_api_key"].get<std::string>(),
         j["download_path"].get<std::string>(),
         j["create_season_folders"].get<bool>(),
-        j["create_show_folders"].get<bool>()
+        j["create_show_folders"].get<bool>(),
+        j.value("update_check_interval_hours", 24)
     };
+    config.tmdb_base_url = j.value("tmdb_base_url", config.tmdb_base_url);
+    config.api_base_url = j.value("api_base_url", config.api_base_url);
+    config.ffmpeg_jobs = j.value("ffmpeg_jobs", config.ffmpeg_jobs);
+    config.dedupe_downloads = j.value("dedupe_downloads", config.dedupe_downloads);
+    config.hls_max_height = j.value("hls_max_height", config.hls_max_height);
+    config.hls_max_bandwidth = j.value("hls_max_bandwidth", config.hls_max_bandwidth);
+    config.hls_audio_language = j.value("hls_audio_language", config.hls_audio_language);
+    config.hls_deadline_seconds = j.value("hls_deadline_seconds", config.hls_deadline_seconds);
+    config.staging_path = j.value("staging_path", config.staging_path);
+    config.mover_bandwidth_mbps = j.value("mover_bandwidth_mbps", config.mover_bandwidth_mbps);
+    config.max_concurrency = j.value("max_concurrency", config.max_concurrency);
+    return config;
 }
 
 void Config::save(const std::string& path) const {
@@ -66,6 +84,18 @@ void Config::save(const std::string& path) const {
     j["download_path"] = download_path;
     j["create_season_folders"] = create_season_folders;
     j["create_show_folders"] = create_show_folders;
+    j["update_check_interval_hours"] = update_check_interval_hours;
+    j["tmdb_base_url"] = tmdb_base_url;
+    j["api_base_url"] = api_base_url;
+    j["ffmpeg_jobs"] = ffmpeg_jobs;
+    j["dedupe_downloads"] = dedupe_downloads;
+    j["hls_max_height"] = hls_max_height;
+    j["hls_max_bandwidth"] = hls_max_bandwidth;
+    j["hls_audio_language"] = hls_audio_language;
+    j["hls_deadline_seconds"] = hls_deadline_seconds;
+    j["staging_path"] = staging_path;
+    j["mover_bandwidth_mbps"] = mover_bandwidth_mbps;
+    j["max_concurrency"] = max_concurrency;
     
     std::ofstream file(path);
     file << j.dump(4);
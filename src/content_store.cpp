@@ -0,0 +1,247 @@
+#include "content_store.hpp"
+#include "config.hpp"
+#include "metrics.hpp"
+#include "sha256.hpp"
+#include "utils.hpp"
+#include "worker_pool.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <set>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+    struct FileInfo {
+        std::string path;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        dev_t device = 0;
+        ino_t inode = 0;
+    };
+
+    bool describe(const std::string& path, FileInfo& info) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+        info.path = path;
+        info.size = st.st_size;
+        timespec mtime = utils::modifyTime(st);
+        info.mtime = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+        info.device = st.st_dev;
+        info.inode = st.st_ino;
+        return true;
+    }
+
+    bool reflink(const std::string& from, const std::string& to) {
+#ifdef FICLONE
+        int source = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source < 0) return false;
+        int target = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (target < 0) {
+            close(source);
+            return false;
+        }
+        bool cloned = ioctl(target, FICLONE, source) == 0;
+        close(source);
+        close(target);
+        if (!cloned) {
+            unlink(to.c_str());
+        }
+        return cloned;
+#else
+        return false;
+#endif
+    }
+
+    std::map<std::string, nlohmann::json> readEntries(const std::string& path) {
+        std::map<std::string, nlohmann::json> entries;
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            return entries;
+        }
+        try {
+            nlohmann::json j;
+            file >> j;
+            for (const auto& [key, value] : j["files"].items()) {
+                entries[key] = value;
+            }
+        } catch (const nlohmann::json::exception&) {
+            // A corrupt index only costs missed links; it is rebuilt as
+            // files are added
+        }
+        return entries;
+    }
+}
+
+std::string ContentStore::getStorePath() {
+    return Config::getDataPath("content_store.json");
+}
+
+ContentStore::ContentStore(const std::string& path) : path_(path) {
+    for (const auto& [key, value] : readEntries(path_)) {
+        entries_[key] = {value.value("path", ""), value.value("size", uint64_t(0)), value.value("mtime", int64_t(0))};
+    }
+}
+
+std::string ContentStore::find(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        return "";
+    }
+
+    FileInfo info;
+    if (!describe(it->second.path, info) || info.size != it->second.size || info.mtime != it->second.mtime) {
+        entries_.erase(it);
+        return "";
+    }
+    return info.path;
+}
+
+void ContentStore::add(const std::string& key, const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (record(key, path)) {
+        save();
+    }
+}
+
+bool ContentStore::record(const std::string& key, const std::string& path) {
+    FileInfo info;
+    if (!describe(path, info)) {
+        return false;
+    }
+    entries_[key] = {fs::absolute(path).string(), info.size, info.mtime};
+    return true;
+}
+
+void ContentStore::save() {
+    // Merge with what other processes (the daemon, a parallel CLI run)
+    // recorded since this store was loaded
+    for (const auto& [key, value] : readEntries(path_)) {
+        if (!entries_.count(key)) {
+            entries_[key] = {value.value("path", ""), value.value("size", uint64_t(0)), value.value("mtime", int64_t(0))};
+        }
+    }
+
+    nlohmann::json j;
+    j["files"] = nlohmann::json::object();
+    for (const auto& [key, entry] : entries_) {
+        j["files"][key] = {{"path", entry.path}, {"size", entry.size}, {"mtime", entry.mtime}};
+    }
+
+    utils::writeFileAtomically(path_, j.dump(1));
+}
+
+bool ContentStore::link(const std::string& existing, const std::string& path) {
+    std::string tempPath = path + ".dedupe";
+    std::error_code error;
+    fs::remove(tempPath, error);
+
+    if (!reflink(existing, tempPath)) {
+        fs::create_hard_link(existing, tempPath, error);
+        if (error) {
+            return false;
+        }
+    }
+    fs::rename(tempPath, path, error);
+    if (error) {
+        fs::remove(tempPath, error);
+        return false;
+    }
+
+    uint64_t size = fs::file_size(path, error);
+    auto& registry = metrics::Registry::instance();
+    registry.counter("yarrharr_dedupe_links_total", "Files replaced by links to identical content").add();
+    registry.counter("yarrharr_dedupe_bytes_total", "Bytes shared with identical files instead of stored").add(error ? 0 : size);
+    return true;
+}
+
+DedupeReport ContentStore::dedupe(const std::vector<std::string>& roots, size_t jobs, bool dry_run) {
+    DedupeReport report;
+
+    // Only files that share a size with another can be duplicates, and
+    // paths that are already links to one inode need hashing once
+    std::map<uint64_t, std::vector<FileInfo>> bySize;
+    std::set<std::pair<dev_t, ino_t>> seen;
+    for (const auto& root : roots) {
+        std::error_code error;
+        fs::recursive_directory_iterator it(fs::absolute(root), fs::directory_options::skip_permission_denied, error), end;
+        for (; !error && it != end; it.increment(error)) {
+            FileInfo info;
+            if (!it->is_regular_file(error) || it->is_symlink(error) || !describe(it->path().string(), info)) {
+                continue;
+            }
+            report.files++;
+            if (info.size == 0 || !seen.insert({info.device, info.inode}).second) {
+                continue;
+            }
+            bySize[info.size].push_back(info);
+        }
+    }
+
+    std::vector<FileInfo> candidates;
+    for (auto& [size, files] : bySize) {
+        if (files.size() > 1) {
+            candidates.insert(candidates.end(), files.begin(), files.end());
+        }
+    }
+    report.hashed = candidates.size();
+
+    std::vector<std::future<std::string>> hashes;
+    {
+        WorkerPool pool(std::max<size_t>(jobs, 1));
+        for (const auto& file : candidates) {
+            hashes.push_back(pool.async([path = file.path] { return Sha256::hashFile(path); }));
+        }
+        pool.wait();
+    }
+
+    std::map<std::string, std::vector<FileInfo>> byHash;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        try {
+            byHash[hashes[i].get()].push_back(candidates[i]);
+        } catch (const std::exception&) {
+            // Unreadable files are left alone
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string>> kept;
+    for (auto& [hash, files] : byHash) {
+        // Keep the copy the store already points at, otherwise the oldest
+        std::string recorded = find(hash);
+        std::sort(files.begin(), files.end(), [&](const FileInfo& a, const FileInfo& b) {
+            if ((a.path == recorded) != (b.path == recorded)) return a.path == recorded;
+            return std::tie(a.mtime, a.path) < std::tie(b.mtime, b.path);
+        });
+
+        const FileInfo& keep = files.front();
+        for (size_t i = 1; i < files.size(); i++) {
+            if (dry_run || link(keep.path, files[i].path)) {
+                report.linked++;
+                report.bytes_reclaimed += files[i].size;
+            }
+        }
+        kept.emplace_back(hash, keep.path);
+    }
+
+    if (!dry_run && !kept.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [hash, path] : kept) {
+            record(hash, path);
+        }
+        save();
+    }
+    return report;
+}
@@ -0,0 +1,183 @@
+#include "control.hpp"
+#include "config.hpp"
+#include "utils.hpp"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    sockaddr_un socketAddress(const std::string& path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw ControlError("Socket path too long: " + path);
+        }
+        std::strcpy(addr.sun_path, path.c_str());
+        return addr;
+    }
+
+    int connectTo(const std::string& path) {
+        sockaddr_un addr = socketAddress(path);
+        int fd = utils::prepareSocket(socket(AF_UNIX, SOCK_STREAM, 0));
+        if (fd < 0) {
+            throw ControlError(std::string("socket: ") + std::strerror(errno));
+        }
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    void setTimeout(int fd, int seconds) {
+        timeval tv{seconds, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    bool writeAll(int fd, const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, utils::sendFlags());
+            if (n <= 0) return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    // Reads one '\n'-terminated line, keeping whatever follows it in buffer
+    bool readLine(int fd, std::string& buffer, std::string& line) {
+        char chunk[4096];
+        size_t newline;
+        while ((newline = buffer.find('\n')) == std::string::npos) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) return false;
+            buffer.append(chunk, n);
+            if (buffer.size() > (1 << 20)) return false;
+        }
+        line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        return true;
+    }
+}
+
+ControlServer::ControlServer(const std::string& path, Handler handler)
+    : path_(path), handler_(std::move(handler)) {
+    int existing = connectTo(path_);
+    if (existing >= 0) {
+        close(existing);
+        throw ControlError("Another yarrharr daemon is already listening on " + path_);
+    }
+    unlink(path_.c_str());
+
+    sockaddr_un addr = socketAddress(path_);
+    listen_fd_ = utils::prepareSocket(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (listen_fd_ < 0) {
+        throw ControlError(std::string("socket: ") + std::strerror(errno));
+    }
+    // Created owner-only, so no other user can connect before it is chmod'ed
+    mode_t mask = umask(S_IRWXG | S_IRWXO);
+    int bound = bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    int bindErrno = errno;
+    umask(mask);
+    errno = bindErrno;
+    if (bound != 0 || listen(listen_fd_, 16) != 0) {
+        std::string error = std::strerror(errno);
+        close(listen_fd_);
+        throw ControlError("Could not listen on " + path_ + ": " + error);
+    }
+    chmod(path_.c_str(), S_IRUSR | S_IWUSR);
+
+    thread_ = std::thread(&ControlServer::serve, this);
+}
+
+ControlServer::~ControlServer() {
+    stop();
+}
+
+void ControlServer::stop() {
+    if (!running_.exchange(false)) return;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    close(listen_fd_);
+    unlink(path_.c_str());
+}
+
+void ControlServer::serve() {
+    while (running_) {
+        pollfd pfd{listen_fd_, POLLIN, 0};
+        if (poll(&pfd, 1, 250) <= 0) continue;
+
+        int fd = utils::prepareSocket(accept(listen_fd_, nullptr, nullptr));
+        if (fd < 0) continue;
+        // A stuck client must not wedge the daemon
+        setTimeout(fd, 5);
+        handleConnection(fd);
+        close(fd);
+    }
+}
+
+void ControlServer::handleConnection(int fd) {
+    std::string buffer;
+    std::string line;
+    while (running_ && readLine(fd, buffer, line)) {
+        nlohmann::json response;
+        try {
+            auto request = nlohmann::json::parse(line);
+            response["id"] = request.value("id", nlohmann::json());
+            try {
+                response["result"] = handler_(request.at("method").get<std::string>(),
+                                              request.value("params", nlohmann::json::object()));
+            } catch (const std::exception& e) {
+                response["error"] = {{"message", e.what()}};
+            }
+        } catch (const nlohmann::json::exception& e) {
+            response["id"] = nullptr;
+            response["error"] = {{"message", std::string("Invalid request: ") + e.what()}};
+        }
+
+        if (!writeAll(fd, response.dump() + "\n")) return;
+    }
+}
+
+namespace control {
+    std::string getSocketPath() {
+        return Config::getDataPath("control.sock");
+    }
+
+    bool available(const std::string& path) {
+        int fd = connectTo(path);
+        if (fd < 0) return false;
+        close(fd);
+        return true;
+    }
+
+    nlohmann::json call(const std::string& method, const nlohmann::json& params, const std::string& path) {
+        int fd = connectTo(path);
+        if (fd < 0) {
+            throw ControlError("No yarrharr daemon is running");
+        }
+        // Resolving titles happens before the daemon answers
+        setTimeout(fd, 120);
+
+        nlohmann::json request = {{"id", 1}, {"method", method}, {"params", params}};
+        std::string buffer;
+        std::string line;
+        bool ok = writeAll(fd, request.dump() + "\n") && readLine(fd, buffer, line);
+        close(fd);
+        if (!ok) {
+            throw ControlError("Lost connection to the yarrharr daemon");
+        }
+
+        auto response = nlohmann::json::parse(line);
+        if (response.contains("error")) {
+            throw ControlError(response["error"].value("message", "Unknown error"));
+        }
+        return response["result"];
+    }
+}
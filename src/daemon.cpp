@@ -0,0 +1,496 @@
+#include "daemon.hpp"
+#include "concurrency.hpp"
+#include "download_utils.hpp"
+#include "metrics.hpp"
+#include "process.hpp"
+#include "utils.hpp"
+#include <chrono>
+#include <csignal>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr int64_t HOUR = 3600;
+    constexpr int64_t DAY = 24 * HOUR;
+
+    std::atomic<bool> stop_requested{false};
+    std::mutex log_mutex;
+
+    // A second signal stops waiting for ffmpeg jobs
+    void handleSignal(int) {
+        if (stop_requested) {
+            process::cancelAll();
+        }
+        stop_requested = true;
+    }
+
+    int64_t unixNow() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // One poll's episodes of a show. Moves finish in the order they were
+    // queued, so an episode that reaches the library before the first
+    // failure is past every episode ahead of it
+    struct ShowRun {
+        std::mutex mutex;
+        size_t failed_at = SIZE_MAX;  // index of the first episode that failed
+        int season = 0;
+        int episode = 0;
+        size_t pending = 1;           // transfers still moving, plus the task
+    };
+
+    void log(const std::string& message) {
+        std::time_t now = std::time(nullptr);
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cout << "[" << stamp << "] " << message << std::endl;
+    }
+
+    bool isNewer(int season1, int episode1, int season2, int episode2) {
+        return season1 != season2 ? season1 > season2 : episode1 > episode2;
+    }
+
+    fs::file_time_type modifiedTime(const std::string& path) {
+        std::error_code ec;
+        auto time = fs::last_write_time(path, ec);
+        return ec ? fs::file_time_type::min() : time;
+    }
+}
+
+Daemon::Daemon(TMDB& tmdb, Games& games, Downloader& downloader, const std::string& output_dir, size_t jobs)
+    : tmdb_(tmdb), games_(games), downloader_(downloader), output_dir_(output_dir),
+      follows_(FollowList::load(FollowList::getFollowPath())),
+      metadata_(MetadataStore::load(MetadataStore::getMetadataPath())), pool_(jobs) {}
+
+int64_t Daemon::nextCheck(const ShowStatus& status, int64_t now) {
+    // Spread shows across the hour so they don't all poll at once
+    int64_t jitter = std::hash<std::string>{}(status.id) % HOUR;
+
+    if (!status.next_air_date.empty()) {
+        int64_t airs = utils::parseDate(status.next_air_date);
+        if (airs + 6 * HOUR > now) {
+            // Nothing can change before the next episode airs
+            return airs + 6 * HOUR + jitter;
+        }
+        // Aired but not showing up yet
+        return now + 6 * HOUR + jitter;
+    }
+
+    if (status.status == "Ended" || status.status == "Canceled") {
+        return now + 7 * DAY + jitter;
+    }
+    return now + DAY + jitter;
+}
+
+void Daemon::run() {
+    running_ = true;
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    ControlServer control(control::getSocketPath(),
+        [this](const std::string& method, const nlohmann::json& params) { return handleRequest(method, params); });
+
+    std::string path = FollowList::getFollowPath();
+    auto loadedAt = modifiedTime(path);
+    auto metricsWritten = std::chrono::steady_clock::now();
+    log("Following " + std::to_string(follows_.shows().size()) + " shows, listening on " + control::getSocketPath());
+
+    while (running_ && !stop_requested) {
+        int64_t now = unixNow();
+        std::vector<std::string> due;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            // `yarrharr follow` edits the file directly; pick changes up
+            if (modifiedTime(path) != loadedAt) {
+                follows_ = FollowList::load(path);
+                loadedAt = modifiedTime(path);
+            }
+
+            for (const auto& show : follows_.shows()) {
+                if (show.next_check <= now && !in_flight_.count(show.id)) {
+                    due.push_back(show.id);
+                }
+            }
+        }
+
+        if (!due.empty()) {
+            // One batch for every due show, so a quiet night costs a single
+            // change-list request
+            SyncReport report = metadata_.sync(tmdb_, due, now);
+            if (report.fetched + report.patched > 0) {
+                log("Synced TMDB metadata with " + std::to_string(report.requests) + " request(s): " +
+                    std::to_string(report.fetched) + " fetched, " + std::to_string(report.patched) + " patched");
+            }
+            for (const auto& id : due) {
+                auto failed = report.failed.find(id);
+                poll(id, now, failed == report.failed.end() ? "" : failed->second);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<std::string> followed;
+            for (const auto& show : follows_.shows()) {
+                followed.push_back(show.id);
+            }
+            metadata_.retain(followed);
+            metadata_.save();
+            follows_.save();
+            loadedAt = modifiedTime(path);
+        }
+
+        if (concurrency_ && concurrency_->tick()) {
+            log("Running up to " + std::to_string(concurrency_->limit()) + " transfers at once");
+            concurrency_->save();
+        }
+
+        if (!metrics_path_.empty() && std::chrono::steady_clock::now() - metricsWritten >= std::chrono::seconds(15)) {
+            try {
+                metrics::Registry::instance().writeFile(metrics_path_);
+            } catch (const std::exception& e) {
+                log(std::string("Failed to write metrics: ") + e.what());
+            }
+            metricsWritten = std::chrono::steady_clock::now();
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    control.stop();
+    log("Stopping, waiting for active transfers to finish (interrupt again to cancel ffmpeg jobs)");
+    pool_.wait();
+    // Finished transfers report from the mover, which outlives the daemon
+    std::unique_lock<std::mutex> lock(mutex_);
+    moved_.wait(lock, [this] { return moving_ == 0; });
+    follows_.save();
+}
+
+void Daemon::poll(const std::string& id, int64_t now, const std::string& error) {
+    FollowedShow known;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FollowedShow* show = follows_.find(id);
+        if (!show) return;
+        known = *show;
+    }
+
+    const ShowMetadata* metadata = metadata_.find(id);
+    if (!error.empty() || !metadata) {
+        log("Failed to check " + (known.name.empty() ? id : known.name) + ": " +
+            (error.empty() ? "no TMDB metadata synced for it yet" : error));
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (FollowedShow* followed = follows_.find(id)) {
+            followed->next_check = now + HOUR;
+        }
+        return;
+    }
+
+    auto show = std::make_shared<Show>();
+    ShowStatus status = metadata->airing(id, utils::formatDate(now));
+    show->id = id;
+    show->name = status.name;
+
+    if (isNewer(status.last_season, status.last_episode, known.last_season, known.last_episode)) {
+        for (const auto& [season, episodes] : metadata->seasons) {
+            if (season < std::max(known.last_season, 1) || season > status.last_season) {
+                continue;
+            }
+            for (const auto& episode : episodes) {
+                if (isNewer(episode.season, episode.episode, known.last_season, known.last_episode) &&
+                    !isNewer(episode.season, episode.episode, status.last_season, status.last_episode)) {
+                    show->episodes.add(episode);
+                }
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FollowedShow* followed = follows_.find(id);
+        if (!followed) return;
+        followed->name = status.name;
+        followed->next_check = nextCheck(status, now);
+        if (show->episodes.empty()) return;
+        in_flight_.insert(id);
+    }
+
+    log(status.name + ": " + std::to_string(show->episodes.size()) + " new episode(s)");
+
+    std::vector<uint64_t> ids;
+    for (const auto& ep : show->episodes) {
+        ids.push_back(track(show->name + " S" + std::to_string(ep.season) + "E" + std::to_string(ep.episode)));
+    }
+
+    // A show's episodes download in order, so a failure leaves the
+    // follow position at the last episode that actually arrived. The
+    // position is settled once the last of them is moved, not when the
+    // transfers end, so a slow move holds up no transfer
+    pool_.submit([this, show, id, ids] {
+        auto run = std::make_shared<ShowRun>();
+        auto release = [this, id, run] {
+            {
+                std::lock_guard<std::mutex> lock(run->mutex);
+                if (--run->pending > 0) return;
+            }
+            finishShow(id, run->season, run->episode, run->failed_at == SIZE_MAX);
+        };
+
+        size_t i = 0;
+        for (const auto& ep : show->episodes) {
+            size_t index = i;
+            uint64_t tid = ids[i++];
+            bool failed;
+            {
+                std::lock_guard<std::mutex> lock(run->mutex);
+                failed = run->failed_at != SIZE_MAX;
+                run->pending += !failed;
+            }
+            if (failed) {
+                // Drop the rest; they are retried from the follow position
+                std::lock_guard<std::mutex> lock(mutex_);
+                transfers_.erase(tid);
+                continue;
+            }
+            int season = ep.season;
+            int episode = ep.episode;
+            auto done = [run, release, index, season, episode](bool moved) {
+                {
+                    std::lock_guard<std::mutex> lock(run->mutex);
+                    if (!moved) {
+                        run->failed_at = std::min(run->failed_at, index);
+                    } else if (index < run->failed_at) {
+                        run->season = season;
+                        run->episode = episode;
+                    }
+                }
+                release();
+            };
+            try {
+                transfer(tid, downloader_.episodeJob(*show, ep, output_dir_), done);
+            } catch (const std::exception& e) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (transfers_.erase(tid)) {
+                        failed_++;
+                    }
+                }
+                log("Failed " + show->name + ": " + e.what());
+                done(false);
+            }
+        }
+        release();
+    });
+}
+
+void Daemon::finishShow(const std::string& id, int season, int episode, bool complete) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_.erase(id);
+
+    FollowedShow* show = follows_.find(id);
+    if (!show) return;
+    if (season > 0) {
+        show->last_season = season;
+        show->last_episode = episode;
+    }
+    if (!complete) {
+        show->next_check = unixNow() + 6 * HOUR;
+    }
+    follows_.save();
+}
+
+uint64_t Daemon::track(const std::string& label) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t id = next_transfer_++;
+    transfers_[id] = {label, std::make_shared<TransferProgress>(), false};
+    return id;
+}
+
+void Daemon::transfer(uint64_t id, const DownloadJob& job, std::function<void(bool)> done) {
+    std::shared_ptr<TransferProgress> progress;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entry = transfers_[id];
+        entry.label = job.label;
+        entry.active = true;
+        progress = entry.progress;
+        moving_++;
+    }
+
+    // Counts and logs the outcome once the file is in the library, or
+    // failed on the way
+    auto finish = [this, id, label = job.label, done](const std::string& error) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            transfers_.erase(id);
+            (error.empty() ? completed_ : failed_)++;
+        }
+        log(error.empty() ? "Finished " + label : "Failed " + label + ": " + error);
+        if (done) {
+            done(error.empty());
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        moving_--;
+        moved_.notify_all();
+    };
+
+    log("Downloading " + job.label);
+    // Held for the transfer only; a long remux moves no bytes and would
+    // read as a stall
+    std::optional<ConcurrencyController::Slot> slot;
+    slot.emplace(concurrency_, progress.get());
+    try {
+        downloader_.downloadFile(job, progress.get(), [&] { slot.reset(); },
+                                 [finish](std::exception_ptr error) {
+                                     std::string message;
+                                     try {
+                                         if (error) {
+                                             std::rethrow_exception(error);
+                                         }
+                                     } catch (const std::exception& e) {
+                                         message = e.what();
+                                     }
+                                     finish(message);
+                                 });
+    } catch (const std::exception& e) {
+        if (slot) {
+            slot->fail();
+        }
+        finish(e.what());
+    }
+}
+
+void Daemon::enqueue(const std::string& label, std::function<DownloadJob()> makeJob) {
+    uint64_t id = track(label);
+    pool_.submit([this, id, label, makeJob] {
+        try {
+            transfer(id, makeJob(), nullptr);
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (transfers_.erase(id)) {
+                failed_++;
+            }
+            log("Failed " + label + ": " + e.what());
+        }
+    });
+}
+
+nlohmann::json Daemon::handleRequest(const std::string& method, const nlohmann::json& params) {
+    if (method == "download") {
+        return queueDownload(params);
+    }
+    if (method == "games.download") {
+        return queueGames(params);
+    }
+    if (method == "status") {
+        return status();
+    }
+    if (method == "metrics") {
+        return metrics::Registry::instance().prometheus();
+    }
+    throw std::runtime_error("Unknown method: " + method);
+}
+
+nlohmann::json Daemon::queueDownload(const nlohmann::json& params) {
+    std::string id = params.at("id").get<std::string>();
+    // Conversion is set for the whole daemon, so a request that differs
+    // is left for the caller to download itself
+    if (params.value("mp4", false) != downloader_.mp4Mode()) {
+        throw std::runtime_error(downloader_.mp4Mode() ? "the daemon was started with --mp4"
+                                                       : "the daemon was started without --mp4");
+    }
+    std::string outputDir = params.value("output_dir", output_dir_);
+
+    // Details are looked up on the pool rather than here, so a slow TMDB
+    // request holds up no other control call
+    if (params.value("movie", false)) {
+        std::string label = "movie " + id;
+        enqueue(label, [this, id, outputDir] { return downloader_.movieJob(tmdb_.getMovieDetails(id), outputDir); });
+        return {{"queued", {label}}};
+    }
+
+    int season = params.value("season", -1);
+    int episode = params.value("episode", -1);
+    bool skipSpecials = params.value("skip_specials", false);
+    std::string label = "show " + id;
+    if (season >= 0) {
+        label += " S" + std::to_string(season);
+        if (episode >= 0) {
+            label += "E" + std::to_string(episode);
+        }
+    }
+
+    // Listed as queued until the show is resolved into its episodes
+    uint64_t tid = track(label);
+    pool_.submit([this, tid, label, id, season, episode, skipSpecials, outputDir] {
+        try {
+            auto show = std::make_shared<Show>(tmdb_.getShowDetails(id));
+            std::vector<int> seasons = season >= 0 ? std::vector<int>{season} : show->episodes.seasons();
+            for (int s : seasons) {
+                if (skipSpecials && s == 0) continue;
+                for (const auto& ep : show->episodes.season(s)) {
+                    if (episode >= 0 && ep.episode != episode) continue;
+                    int epSeason = ep.season;
+                    int epNumber = ep.episode;
+                    enqueue(show->name + " S" + std::to_string(epSeason) + "E" + std::to_string(epNumber),
+                            [this, show, epSeason, epNumber, outputDir] {
+                                return downloader_.episodeJob(*show, *show->episodes.find(epSeason, epNumber),
+                                                              outputDir);
+                            });
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            transfers_.erase(tid);
+        } catch (const std::exception& e) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (transfers_.erase(tid)) {
+                    failed_++;
+                }
+            }
+            log("Failed " + label + ": " + e.what());
+        }
+    });
+    return {{"queued", {label}}};
+}
+
+nlohmann::json Daemon::queueGames(const nlohmann::json& params) {
+    std::vector<std::string> queued;
+    for (const auto& value : params.at("ids")) {
+        std::string id = value.get<std::string>();
+        auto details = games_.getGameDetailsAsync(id);
+        enqueue("game " + id, [this, details] { return downloader_.gameJob(details.get(), output_dir_); });
+        queued.push_back("game " + id);
+    }
+    return {{"queued", queued}};
+}
+
+nlohmann::json Daemon::status() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    nlohmann::json active = nlohmann::json::array();
+    size_t queued = 0;
+    for (const auto& [id, transfer] : transfers_) {
+        if (!transfer.active) {
+            queued++;
+            continue;
+        }
+        active.push_back({
+            {"label", transfer.label},
+            {"downloaded", static_cast<int64_t>(transfer.progress->now.load())},
+            {"total", static_cast<int64_t>(transfer.progress->total.load())}
+        });
+    }
+    return {
+        {"active", active},
+        {"queued", queued},
+        {"completed", completed_},
+        {"failed", failed_},
+        {"following", follows_.shows().size()}
+    };
+}
@@ -0,0 +1,317 @@
+#include "delta.hpp"
+#include "sha256.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+#include <unistd.h>
+
+namespace {
+    constexpr char MAGIC[8] = {'Y', 'H', 'D', 'E', 'L', 'T', 'A', '1'};
+    constexpr size_t HEADER_SIZE = 8 + 8 + 32 + 8 + 32;
+    constexpr size_t MIN_MATCH = 24;
+    // Far beyond any release binary; a larger size means a corrupt header
+    constexpr uint64_t MAX_OUTPUT = 1ull << 30;
+
+    void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    void putU64(std::vector<uint8_t>& out, uint64_t value) {
+        for (int i = 0; i < 8; i++) {
+            out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+        }
+    }
+
+    class Reader {
+    public:
+        explicit Reader(const std::vector<uint8_t>& data) : data_(data) {}
+
+        uint64_t varint() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                uint8_t byte = next();
+                value |= uint64_t(byte & 0x7F) << shift;
+                if (!(byte & 0x80)) return value;
+            }
+            throw DeltaError("Corrupt patch: varint too long");
+        }
+
+        uint64_t u64() {
+            uint64_t value = 0;
+            for (int i = 0; i < 8; i++) {
+                value |= uint64_t(next()) << (i * 8);
+            }
+            return value;
+        }
+
+        const uint8_t* take(size_t length) {
+            if (length > data_.size() - pos_) {
+                throw DeltaError("Corrupt patch: truncated");
+            }
+            const uint8_t* p = data_.data() + pos_;
+            pos_ += length;
+            return p;
+        }
+
+    private:
+        const std::vector<uint8_t>& data_;
+        size_t pos_ = 0;
+
+        uint8_t next() { return *take(1); }
+    };
+
+    std::string hex(const uint8_t* raw) {
+        static const char digits[] = "0123456789abcdef";
+        std::string result;
+        for (int i = 0; i < 32; i++) {
+            result += digits[raw[i] >> 4];
+            result += digits[raw[i] & 0x0F];
+        }
+        return result;
+    }
+
+    uint64_t load64(const uint8_t* p) {
+        uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    // Length of the best approximate match: keeps extending while more than
+    // half of the bytes agree, and gives up after a long stretch without
+    // improvement
+    size_t extend(const std::vector<uint8_t>& old_data, size_t o,
+                  const std::vector<uint8_t>& new_data, size_t n) {
+        size_t matches = 0;
+        size_t best = 0;
+        long bestScore = 0;
+        for (size_t i = 0; o + i < old_data.size() && n + i < new_data.size(); i++) {
+            if (old_data[o + i] == new_data[n + i]) matches++;
+            long score = 2 * long(matches) - long(i + 1);
+            if (score > bestScore) {
+                bestScore = score;
+                best = i + 1;
+            }
+            if (i + 1 - best > 64) break;
+        }
+        return best;
+    }
+
+    void putDiff(std::vector<uint8_t>& out, const uint8_t* diff, size_t length) {
+        size_t i = 0;
+        while (i < length) {
+            size_t zeros = 0;
+            while (i + zeros < length && diff[i + zeros] == 0) zeros++;
+            i += zeros;
+
+            // A literal run ends where at least four zeros start
+            size_t literal = 0;
+            while (i + literal < length) {
+                size_t z = 0;
+                while (z < 4 && i + literal + z < length && diff[i + literal + z] == 0) z++;
+                if (z == 4 || (z > 0 && i + literal + z == length)) break;
+                literal += z + 1;
+            }
+            literal = std::min(literal, length - i);
+
+            putVarint(out, zeros);
+            putVarint(out, literal);
+            out.insert(out.end(), diff + i, diff + i + literal);
+            i += literal;
+        }
+    }
+}
+
+namespace delta {
+    std::vector<uint8_t> create(const std::vector<uint8_t>& old_data, const std::vector<uint8_t>& new_data) {
+        std::vector<uint8_t> patch(MAGIC, MAGIC + sizeof(MAGIC));
+        uint8_t checksum[32];
+
+        putU64(patch, old_data.size());
+        Sha256 oldHash;
+        oldHash.update(old_data.data(), old_data.size());
+        oldHash.digest(checksum);
+        patch.insert(patch.end(), checksum, checksum + 32);
+
+        putU64(patch, new_data.size());
+        Sha256 newHash;
+        newHash.update(new_data.data(), new_data.size());
+        newHash.digest(checksum);
+        patch.insert(patch.end(), checksum, checksum + 32);
+
+        std::unordered_map<uint64_t, uint32_t> index;
+        if (old_data.size() >= 8) {
+            index.reserve(old_data.size());
+            for (size_t i = 0; i + 8 <= old_data.size(); i++) {
+                index.emplace(load64(&old_data[i]), static_cast<uint32_t>(i));
+            }
+        }
+
+        size_t pos = 0;
+        size_t extraStart = 0;
+        size_t prevOldEnd = 0;
+        size_t prevNewEnd = 0;
+        bool havePrev = false;
+        std::vector<uint8_t> diff;
+
+        while (pos + 8 <= new_data.size()) {
+            size_t bestLength = 0;
+            size_t bestOld = 0;
+
+            // Code that merely moved keeps matching at the previous alignment
+            if (havePrev) {
+                size_t aligned = prevOldEnd + (pos - prevNewEnd);
+                if (aligned < old_data.size()) {
+                    bestLength = extend(old_data, aligned, new_data, pos);
+                    bestOld = aligned;
+                }
+            }
+
+            auto it = index.find(load64(&new_data[pos]));
+            if (it != index.end() && it->second != bestOld) {
+                size_t length = extend(old_data, it->second, new_data, pos);
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestOld = it->second;
+                }
+            }
+
+            if (bestLength < MIN_MATCH) {
+                pos++;
+                continue;
+            }
+
+            putVarint(patch, pos - extraStart);
+            patch.insert(patch.end(), new_data.begin() + extraStart, new_data.begin() + pos);
+
+            diff.resize(bestLength);
+            for (size_t i = 0; i < bestLength; i++) {
+                diff[i] = new_data[pos + i] - old_data[bestOld + i];
+            }
+            putVarint(patch, bestOld);
+            putVarint(patch, bestLength);
+            putDiff(patch, diff.data(), bestLength);
+
+            pos += bestLength;
+            extraStart = pos;
+            prevOldEnd = bestOld + bestLength;
+            prevNewEnd = pos;
+            havePrev = true;
+        }
+
+        if (extraStart < new_data.size()) {
+            putVarint(patch, new_data.size() - extraStart);
+            patch.insert(patch.end(), new_data.begin() + extraStart, new_data.end());
+            putVarint(patch, 0);
+            putVarint(patch, 0);
+        }
+        return patch;
+    }
+
+    std::string sourceChecksum(const std::vector<uint8_t>& patch) {
+        if (patch.size() < HEADER_SIZE || std::memcmp(patch.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            throw DeltaError("Not a yarrharr patch");
+        }
+        return hex(patch.data() + 16);
+    }
+
+    std::vector<uint8_t> apply(const std::vector<uint8_t>& old_data, const std::vector<uint8_t>& patch) {
+        std::string expectedSource = sourceChecksum(patch);
+
+        Reader reader(patch);
+        reader.take(sizeof(MAGIC));
+        uint64_t oldSize = reader.u64();
+        reader.take(32);
+        uint64_t newSize = reader.u64();
+        std::string expectedResult = hex(reader.take(32));
+
+        if (oldSize != old_data.size()) {
+            throw DeltaError("Patch was made for a different binary");
+        }
+        Sha256 oldHash;
+        oldHash.update(old_data.data(), old_data.size());
+        if (oldHash.hexDigest() != expectedSource) {
+            throw DeltaError("Patch was made for a different binary");
+        }
+
+        if (newSize > MAX_OUTPUT) {
+            throw DeltaError("Corrupt patch: implausible output size");
+        }
+
+        // Lengths are compared against what remains, so huge values can't
+        // wrap past the checks
+        std::vector<uint8_t> result;
+        result.reserve(newSize);
+        while (result.size() < newSize) {
+            uint64_t extraLength = reader.varint();
+            if (extraLength > newSize - result.size()) {
+                throw DeltaError("Corrupt patch: extra data out of range");
+            }
+            const uint8_t* extra = reader.take(extraLength);
+            result.insert(result.end(), extra, extra + extraLength);
+
+            uint64_t oldOffset = reader.varint();
+            uint64_t diffLength = reader.varint();
+            if (oldOffset > old_data.size() || diffLength > old_data.size() - oldOffset ||
+                diffLength > newSize - result.size()) {
+                throw DeltaError("Corrupt patch: match out of range");
+            }
+
+            uint64_t done = 0;
+            while (done < diffLength) {
+                uint64_t zeros = reader.varint();
+                uint64_t literal = reader.varint();
+                if (zeros > diffLength - done || literal > diffLength - done - zeros) {
+                    throw DeltaError("Corrupt patch: diff overrun");
+                }
+                for (uint64_t i = 0; i < zeros; i++, done++) {
+                    result.push_back(old_data[oldOffset + done]);
+                }
+                const uint8_t* bytes = reader.take(literal);
+                for (uint64_t i = 0; i < literal; i++, done++) {
+                    result.push_back(static_cast<uint8_t>(old_data[oldOffset + done] + bytes[i]));
+                }
+            }
+        }
+
+        Sha256 newHash;
+        newHash.update(result.data(), result.size());
+        if (result.size() != newSize || newHash.hexDigest() != expectedResult) {
+            throw DeltaError("Patched binary failed checksum verification");
+        }
+        return result;
+    }
+
+    std::vector<uint8_t> readFile(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw DeltaError("Failed to read " + path);
+        }
+        return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw DeltaError("Failed to write " + path);
+        }
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = write(fd, data.data() + written, data.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            written += n;
+        }
+        // Durable before the updater renames it over the running binary
+        bool ok = written == data.size() && fsync(fd) == 0;
+        if (close(fd) != 0 || !ok) {
+            throw DeltaError("Failed to write " + path);
+        }
+    }
+}
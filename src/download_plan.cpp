@@ -0,0 +1,149 @@
+#include "download_plan.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+    // Left free so a download that fits does not leave the filesystem full
+    constexpr uint64_t HEADROOM = 1ull << 30;
+
+    uint64_t netBytes(const DownloadPlan::Item& item) {
+        uint64_t bytes = item.probe.bytes > 0 ? static_cast<uint64_t>(item.probe.bytes) : 0;
+        return bytes > item.replaces ? bytes - item.replaces : 0;
+    }
+
+    std::string formatDuration(double seconds) {
+        long total = static_cast<long>(seconds + 0.5);
+        std::ostringstream out;
+        if (total >= 86400) {
+            out << total / 86400 << "d " << total % 86400 / 3600 << "h";
+        } else if (total >= 3600) {
+            out << total / 3600 << "h " << total % 3600 / 60 << "m";
+        } else if (total >= 60) {
+            out << total / 60 << "m " << total % 60 << "s";
+        } else {
+            out << total << "s";
+        }
+        return out.str();
+    }
+}
+
+uint64_t DownloadPlan::bytes() const {
+    uint64_t total = 0;
+    for (const auto& item : items) {
+        total += item.probe.bytes > 0 ? static_cast<uint64_t>(item.probe.bytes) : 0;
+    }
+    return total;
+}
+
+uint64_t DownloadPlan::needed() const {
+    uint64_t total = 0;
+    for (const auto& item : items) {
+        total += netBytes(item);
+    }
+    return total == 0 ? 0 : total + HEADROOM;
+}
+
+uint64_t DownloadPlan::stagingNeeded() const {
+    if (staging.empty() || items.empty()) {
+        return 0;
+    }
+    std::vector<uint64_t> sizes;
+    for (const auto& item : items) {
+        uint64_t bytes = item.probe.bytes > 0 ? static_cast<uint64_t>(item.probe.bytes) : 0;
+        sizes.push_back(item.remuxed ? 2 * bytes : bytes);
+    }
+    std::sort(sizes.begin(), sizes.end(), std::greater<uint64_t>());
+    size_t held = staging_backlog ? sizes.size() : stagingSlots();
+    uint64_t total = 0;
+    for (size_t i = 0; i < held; i++) {
+        total += sizes[i];
+    }
+    return total == 0 ? 0 : total + HEADROOM;
+}
+
+std::string DownloadPlan::stagingReason() const {
+    if (staging_backlog) {
+        return "to hold every file while moves are capped";
+    }
+    return "for " + std::to_string(stagingSlots()) + " transfer(s) at once";
+}
+
+size_t DownloadPlan::unknown() const {
+    size_t count = 0;
+    for (const auto& item : items) {
+        count += item.probe.error.empty() && item.probe.bytes < 0;
+    }
+    return count;
+}
+
+bool DownloadPlan::trim() {
+    while (!items.empty() && !fits()) {
+        dropped.insert(dropped.begin(), items.back());
+        items.pop_back();
+    }
+    return !items.empty();
+}
+
+std::vector<DownloadJob> DownloadPlan::jobs() const {
+    std::vector<DownloadJob> result;
+    for (const auto& item : items) {
+        result.push_back(item.job);
+    }
+    return result;
+}
+
+void DownloadPlan::print(std::ostream& out) const {
+    size_t width = 0;
+    for (const auto& item : items) {
+        width = std::max(width, item.job.label.size());
+    }
+    for (const auto& item : items) {
+        out << "  " << std::left << std::setw(width) << item.job.label << std::right << "  ";
+        if (!item.probe.error.empty()) {
+            out << "unavailable (" << item.probe.error << ")";
+        } else if (item.probe.bytes < 0) {
+            out << (item.probe.hls ? "unknown size (HLS)" : "unknown size");
+        } else {
+            out << utils::formatFileSize(item.probe.bytes);
+            if (item.replaces > 0) {
+                out << ", replaces " << utils::formatFileSize(item.replaces);
+            }
+        }
+        out << "\n";
+    }
+    for (const auto& item : dropped) {
+        out << "  " << std::left << std::setw(width) << item.job.label << std::right << "  trimmed, "
+            << utils::formatFileSize(netBytes(item)) << "\n";
+    }
+
+    out << "Total: " << utils::formatFileSize(bytes()) << " in " << items.size() << " file(s)";
+    if (unknown() > 0) {
+        out << ", plus " << unknown() << " of unknown size";
+    }
+    out << "\n";
+    if (bytes_per_second > 0) {
+        out << "Estimated time: " << formatDuration(bytes() / bytes_per_second) << " at "
+            << utils::formatFileSize(static_cast<size_t>(bytes_per_second)) << "/s, as last measured\n";
+    } else {
+        out << "Estimated time: unknown, no throughput measured for this host yet\n";
+    }
+    out << "Free space on " << target << ": " << utils::formatFileSize(available);
+    if (fitsTarget()) {
+        out << ", " << utils::formatFileSize(available - needed() + (needed() > 0 ? HEADROOM : 0)) << " left after\n";
+    } else {
+        out << ", not enough: " << utils::formatFileSize(needed()) << " needed with "
+            << utils::formatFileSize(HEADROOM) << " kept free\n";
+    }
+    if (!staging.empty()) {
+        out << "Free space on " << staging << " (staging): " << utils::formatFileSize(staging_available);
+        if (fitsStaging()) {
+            out << ", " << utils::formatFileSize(stagingNeeded()) << " needed " << stagingReason() << "\n";
+        } else {
+            out << ", not enough: " << utils::formatFileSize(stagingNeeded()) << " needed " << stagingReason()
+                << " with " << utils::formatFileSize(HEADROOM) << " kept free\n";
+        }
+    }
+}
@@ -1,9 +1,47 @@
 #include "download_utils.hpp"
+#include "mkv_remux.hpp"
 
 size_t writeCallback(void* ptr, size_t size, size_t nmemb, FILE* stream) {
     return fwrite(ptr, size, nmemb, stream);
 }
 
+size_t hashingWriteCallback(void* ptr, size_t size, size_t nmemb, HashingWriter* writer) {
+    size_t written = fwrite(ptr, size, nmemb, writer->file);
+    writer->hash.update(ptr, written * size);
+    return written;
+}
+
+size_t remuxingWriteCallback(void* ptr, size_t size, size_t nmemb, RemuxingWriter* writer) {
+    size_t length = size * nmemb;
+    if (writer->hash) {
+        writer->hash->update(ptr, length);
+    }
+    if (fwrite(ptr, 1, length, writer->file) != length) {
+        return 0;
+    }
+    if (writer->error.empty()) {
+        try {
+            writer->remux->write(ptr, length);
+        } catch (const RemuxError& e) {
+            writer->error = e.what();
+        }
+    }
+    return length;
+}
+
+bool finishRemux(RemuxingWriter* writer) {
+    if (!writer->error.empty()) {
+        return false;
+    }
+    try {
+        writer->remux->finish();
+    } catch (const RemuxError& e) {
+        writer->error = e.what();
+        return false;
+    }
+    return true;
+}
+
 int progressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
     if (dltotal <= 0) return 0;
     
@@ -54,4 +92,11 @@ int progressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_o
     }
     
     return 0;
-} 
\ No newline at end of file
+}
+
+int transferProgressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    auto* progress = static_cast<TransferProgress*>(clientp);
+    progress->now = dlnow;
+    progress->total = dltotal;
+    return 0;
+}
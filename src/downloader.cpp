@@ -2,6 +2,7 @@
 #include "utils.hpp"
 #include <curl/curl.h>
 #include <filesystem>
+#include <memory>
 #include <thread>
 #include <queue>
 #include <mutex>
@@ -13,30 +14,285 @@
 #include <chrono>
 #include <cstdlib>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "download_utils.hpp"
+#include "worker_pool.hpp"
+#include "http.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "process.hpp"
+#include "content_store.hpp"
+#include "mkv_remux.hpp"
+#include "mover.hpp"
+#include "readahead.hpp"
+#include "concurrency.hpp"
+#include "download_plan.hpp"
 #include <algorithm>  // for std::transform
+#include <cerrno>
+#include <cstring>
+#include <exception>
 
 namespace fs = std::filesystem;
 
 std::string formatTime(double seconds);
 
-bool isFFmpegAvailable() {
-    #ifdef _WIN32
-    return system("where ffmpeg >nul 2>nul") == 0;
-    #else
-    return system("which ffmpeg >/dev/null 2>&1") == 0;
-    #endif
-}
+namespace {
+    // Copies video, audio and subtitle streams unchanged while dropping the
+    // container and stream metadata. With a second input, the audio comes
+    // from that one; `input_options` are repeated before each input.
+    std::vector<std::string> remuxCommand(std::vector<std::string> options, const std::vector<std::string>& input_options,
+                                          const std::vector<std::string>& inputs, const std::string& output) {
+        std::vector<std::string> argv = {"ffmpeg"};
+        argv.insert(argv.end(), options.begin(), options.end());
+        for (const auto& input : inputs) {
+            argv.insert(argv.end(), input_options.begin(), input_options.end());
+            argv.push_back("-i");
+            argv.push_back(input);
+        }
+        for (const char* arg : {"-map", "0:v", "-map", inputs.size() > 1 ? "1:a" : "0:a", "-map", "0:s?",
+                                "-map_metadata", "-1"}) {
+            argv.push_back(arg);
+        }
+        for (const char* field : {"title", "description", "comment", "synopsis", "show", "episode_id",
+                                  "network", "genre"}) {
+            argv.push_back("-metadata");
+            argv.push_back(std::string(field) + "=");
+        }
+        for (const char* arg : {"-c", "copy", output.c_str(), "-y"}) {
+            argv.push_back(arg);
+        }
+        return argv;
+    }
+
+    size_t stringWriteCallback(void* ptr, size_t size, size_t nmemb, std::string* out) {
+        out->append(static_cast<char*>(ptr), size * nmemb);
+        return size * nmemb;
+    }
+
+    // Byte progress across all segments of one HLS download; the total is
+    // an estimate that firms up as segments arrive
+    struct SegmentProgress {
+        TransferProgress* shared = nullptr;
+        curl_off_t done = 0;
+        curl_off_t total = 0;
+    };
+
+    int segmentProgressCallback(void* clientp, curl_off_t, curl_off_t dlnow, curl_off_t, curl_off_t) {
+        auto* progress = static_cast<SegmentProgress*>(clientp);
+        curl_off_t now = progress->done + dlnow;
+        curl_off_t total = std::max(progress->total, now);
+        if (progress->shared) {
+            progress->shared->now = now;
+            progress->shared->total = total;
+            return 0;
+        }
+        return progressCallback(nullptr, total, now, 0, 0);
+    }
+
+    // One easy handle for a playlist and all its segments, so they share a
+    // connection
+    class SegmentClient {
+    public:
+        explicit SegmentClient(const std::string& api_key) : curl_(curl_easy_init()) {
+            if (!curl_) {
+                throw std::runtime_error("Failed to initialize CURL");
+            }
+            if (!api_key.empty()) {
+                headers_ = curl_slist_append(headers_, ("X-API-Key: " + api_key).c_str());
+            }
+        }
+
+        ~SegmentClient() {
+            curl_slist_free_all(headers_);
+            curl_easy_cleanup(curl_);
+        }
+
+        SegmentClient(const SegmentClient&) = delete;
+        SegmentClient& operator=(const SegmentClient&) = delete;
+
+        // `location` gets the URL after redirects, which relative URIs in
+        // the playlist resolve against
+        std::string text(const std::string& url, std::string* location = nullptr) {
+            std::string body;
+            curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, stringWriteCallback);
+            curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &body);
+            curl_easy_setopt(curl_, CURLOPT_NOPROGRESS, 1L);
+            trace::Span span("http", "playlist", url);
+            perform(url, "playlist");
+            if (location) {
+                char* effective = nullptr;
+                curl_easy_getinfo(curl_, CURLINFO_EFFECTIVE_URL, &effective);
+                *location = effective ? effective : url;
+            }
+            return body;
+        }
+
+        void append(const std::string& url, FILE* out, SegmentProgress& progress) {
+            curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, writeCallback);
+            curl_easy_setopt(curl_, CURLOPT_WRITEDATA, out);
+            curl_easy_setopt(curl_, CURLOPT_XFERINFOFUNCTION, segmentProgressCallback);
+            curl_easy_setopt(curl_, CURLOPT_XFERINFODATA, &progress);
+            curl_easy_setopt(curl_, CURLOPT_NOPROGRESS, 0L);
+            trace::Span span("http", "segment", url);
+            perform(url, "segment");
+
+            curl_off_t bytes = 0;
+            curl_easy_getinfo(curl_, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+            progress.done += bytes;
+        }
+
+    private:
+        CURL* curl_;
+        struct curl_slist* headers_ = nullptr;
+
+        void perform(const std::string& url, const char* kind) {
+            curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl_, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl_, CURLOPT_FAILONERROR, 1L);
+            curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headers_);
+            http::share(curl_);
+            CURLcode res = curl_easy_perform(curl_);
+            metrics::recordRequest(curl_, kind, res);
+            if (res != CURLE_OK) {
+                throw std::runtime_error("Download failed: " + std::string(curl_easy_strerror(res)));
+            }
+        }
+    };
+
+    // Audio renditions still to fetch are budgeted at 128 kbps when
+    // projecting whether a download meets its deadline
+    constexpr double AUDIO_BYTES_PER_SECOND = 16000;
+
+    std::string describeVariant(const hls::Variant& variant) {
+        std::ostringstream out;
+        if (variant.height > 0) {
+            out << variant.width << "x" << variant.height << ", ";
+        }
+        out << variant.bandwidth / 1000 << " kbps";
+        return out.str();
+    }
+
+    // Streams open with a small range so playback can start after one
+    // round trip, then grow to full-size ranges fetched in parallel
+    constexpr curl_off_t STREAM_FIRST_PIECE = 1 << 20;
+    constexpr curl_off_t STREAM_PIECE = 8 << 20;
+    constexpr size_t STREAM_CONNECTIONS = 4;
+    constexpr size_t STREAM_WINDOW = 8;
+
+    // HEAD requests in flight while a show's jobs are resolved or planned
+    constexpr size_t PROBE_CONNECTIONS = 8;
+
+    // 0, or the errno that stopped the write
+    int writeAll(int fd, const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t n = write(fd, data, length);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            data += n;
+            length -= n;
+        }
+        return 0;
+    }
+
+    // A whole HLS segment, or bytes [first, last] of a file
+    std::string fetchPiece(const std::string& url, const std::string& api_key, curl_off_t first = -1,
+                           curl_off_t last = -1) {
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            throw std::runtime_error("Failed to initialize CURL");
+        }
+        std::string body;
+        struct curl_slist* headers = nullptr;
+        if (!api_key.empty()) {
+            headers = curl_slist_append(headers, ("X-API-Key: " + api_key).c_str());
+        }
+        std::string range = std::to_string(first) + "-" + std::to_string(last);
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stringWriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+        if (first >= 0) {
+            curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+        }
+        http::share(curl);
+
+        CURLcode res;
+        {
+            trace::Span span("http", "stream_piece", url);
+            res = curl_easy_perform(curl);
+        }
+        metrics::recordRequest(curl, "stream", res);
+        long code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+        curl_slist_free_all(headers);
+        curl_easy_cleanup(curl);
 
-bool convertToMp4(const std::string& input_path, const std::string& output_path) {
-    std::string command = "ffmpeg -v quiet -stats_period 0.1 -i \"" + input_path + 
-                         "\" -map 0:v -map 0:a -map 0:s? -map_metadata -1 " +
-                         "-metadata title= -metadata description= -metadata comment= " +
-                         "-metadata synopsis= -metadata show= -metadata episode_id= " +
-                         "-metadata network= -metadata genre= " +
-                         "-c copy \"" + output_path + "\" -y";
-    return system(command.c_str()) == 0;
+        if (res != CURLE_OK) {
+            throw std::runtime_error("Download failed: " + std::string(curl_easy_strerror(res)));
+        }
+        if (first >= 0 && (code != 206 || static_cast<curl_off_t>(body.size()) != last - first + 1)) {
+            throw std::runtime_error("Download failed: short range " + range + " from " + url);
+        }
+        return body;
+    }
+
+    // The first range of a direct download, which also tells whether the
+    // server takes ranges at all. One that answers 200 is sending the whole
+    // file, and that goes straight to the reader instead.
+    struct StreamProbe {
+        CURL* curl;
+        const Readahead::Deliver* deliver;
+        std::string body;
+        curl_off_t total = -1;  // from Content-Range
+        bool started = false;
+        bool whole = false;
+        bool closed = false;    // the reader went away
+        std::exception_ptr error;
+    };
+
+    size_t probeWriteCallback(void* ptr, size_t size, size_t nmemb, StreamProbe* probe) {
+        size_t bytes = size * nmemb;
+        if (!probe->started) {
+            long code = 0;
+            curl_easy_getinfo(probe->curl, CURLINFO_RESPONSE_CODE, &code);
+            probe->whole = code == 200;
+            probe->started = true;
+        }
+        if (!probe->whole) {
+            probe->body.append(static_cast<char*>(ptr), bytes);
+            return bytes;
+        }
+        try {
+            if (!(*probe->deliver)(std::string(static_cast<char*>(ptr), bytes))) {
+                probe->closed = true;
+                return 0;
+            }
+        } catch (...) {
+            probe->error = std::current_exception();
+            return 0;
+        }
+        return bytes;
+    }
+
+    size_t probeHeaderCallback(char* buffer, size_t size, size_t nitems, StreamProbe* probe) {
+        std::string header(buffer, size * nitems);
+        std::string lower = header;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        size_t slash = header.rfind('/');
+        if (lower.rfind("content-range:", 0) == 0 && slash != std::string::npos) {
+            try {
+                probe->total = std::stoll(header.substr(slash + 1));
+            } catch (const std::exception&) {
+                probe->total = -1;
+            }
+        }
+        return size * nitems;
+    }
 }
 
 size_t headerCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
@@ -54,19 +310,23 @@ size_t headerCallback(char* buffer, size_t size, size_t nitems, void* userdata)
     return size * nitems;
 }
 
-bool isM3U8Url(const std::string& url, const std::string& api_key = "") {
+UrlProbe probeUrl(const std::string& url, const std::string& api_key = "") {
+    trace::Span span("http", "probe", url);
+    UrlProbe probe;
     CURL* curl = curl_easy_init();
     if (!curl) {
-        return false;
+        probe.error = "Failed to initialize CURL";
+        return probe;
     }
 
-    std::string contentType;
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &contentType);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &probe.type);
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+    http::share(curl);
     
     struct curl_slist* headers = NULL;
     if (!api_key.empty()) {
@@ -75,18 +335,22 @@ bool isM3U8Url(const std::string& url, const std::string& api_key = "") {
     }
 
     CURLcode res = curl_easy_perform(curl);
+    metrics::recordRequest(curl, "probe", res);
+    if (res == CURLE_OK) {
+        curl_off_t length = -1;
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        probe.hls = probe.type == "application/vnd.apple.mpegurl" || probe.type == "application/x-mpegurl";
+        // A playlist's length says nothing about the media behind it
+        probe.bytes = probe.hls ? -1 : length;
+    } else {
+        probe.error = curl_easy_strerror(res);
+    }
     
     if (headers) {
         curl_slist_free_all(headers);
     }
     curl_easy_cleanup(curl);
-
-    if (res != CURLE_OK) {
-        return false;
-    }
-    
-    return contentType == "application/vnd.apple.mpegurl" || 
-           contentType == "application/x-mpegurl";
+    return probe;
 }
 
 size_t ffmpegProgressCallback(void* ptr, size_t size, size_t nmemb, FILE* stream) {
@@ -154,29 +418,37 @@ size_t ffmpegProgressCallback(void* ptr, size_t size, size_t nmemb, FILE* stream
 }
 
 Downloader::Downloader(const std::string& base_url, bool mp4_mode, bool skip_specials) 
-    : base_url_(base_url), mp4_mode_(mp4_mode), skip_specials_(skip_specials) {
-    if (mp4_mode_ && !isFFmpegAvailable()) {
-        throw std::runtime_error("FFmpeg not found in PATH. Required for MP4 conversion.");
+    : base_url_(base_url), mp4_mode_(mp4_mode), skip_specials_(skip_specials) {}
+
+Downloader::~Downloader() {
+    // Queued moves record themselves through this downloader
+    if (mover_) {
+        mover_->wait();
     }
 }
 
-void Downloader::downloadMovie(const Movie& movie, const std::string& output_dir) {
+DownloadJob Downloader::movieJob(const Movie& movie, const std::string& output_dir, UrlProbe* probe) {
     // Build URL first
     std::string url = buildUrl(movie.id);
     
     // Now we can use the URL to determine the extension
+    UrlProbe found = probeUrl(url, api_key_);
+    if (probe) {
+        *probe = found;
+    }
     std::string filename = utils::sanitizeFilename(
         movie.title + " (" + movie.release_date.substr(0, 4) + ")" + 
-        (isM3U8Url(url, api_key_) ? ".mp4" : ".mkv")
+        (found.hls ? ".mp4" : ".mkv")
     );
     
     std::string output_path = (fs::path(output_dir) / "Movies" / filename).string();
     utils::createDirectoryIfNotExists((fs::path(output_dir) / "Movies").string());
     
-    downloadFile(url, output_path);
+    return {url, output_path, movie.title, {"movie", movie.id, 0, 0, movie.title}};
 }
 
-void Downloader::downloadEpisode(const Show& show, const Episode& episode, const std::string& output_dir) {
+DownloadJob Downloader::episodeJob(const Show& show, const EpisodeView& episode, const std::string& output_dir,
+                                   UrlProbe* probe) {
     std::string show_dir = (fs::path(output_dir) / "TV Shows" / utils::sanitizeFilename(show.name)).string();
     
     std::string season_dir = (fs::path(show_dir) / 
@@ -186,41 +458,73 @@ void Downloader::downloadEpisode(const Show& show, const Episode& episode, const
     utils::createDirectoryIfNotExists(season_dir);
     
     std::string url = buildUrl(show.id, episode.season, episode.episode);
+    UrlProbe found = probeUrl(url, api_key_);
+    if (probe) {
+        *probe = found;
+    }
     
-    std::string filename = utils::sanitizeFilename(
-        show.name + " - S" + 
+    std::string code = std::string("S") + 
         (episode.season < 10 ? "0" : "") + std::to_string(episode.season) + "E" + 
-        (episode.episode < 10 ? "0" : "") + std::to_string(episode.episode) + " - " + 
-        (isM3U8Url(url, api_key_) ? ".mp4" : ".mkv")
+        (episode.episode < 10 ? "0" : "") + std::to_string(episode.episode);
+    std::string filename = utils::sanitizeFilename(
+        show.name + " - " + code + " - " + 
+        (found.hls ? ".mp4" : ".mkv")
     );
     
     std::string output_path = (fs::path(season_dir) / filename).string();
-    downloadFile(url, output_path);
+    return {url, output_path, show.name + " " + code, {"tv", show.id, episode.season, episode.episode, show.name}};
 }
 
-void Downloader::downloadSeason(const Show& show, int season, const std::string& output_dir) {
-    if (skip_specials_ && season == 0) {
-        return; 
-    }
+DownloadJob Downloader::gameJob(const Game& game, const std::string& output_dir) {
+    std::string games_dir = (fs::path(output_dir) / "Games").string();
+    utils::createDirectoryIfNotExists(games_dir);
     
-    for (const auto& episode : show.episodes) {
-        if (episode.season == season) {
-            downloadEpisode(show, episode, output_dir);
-        }
-    }
+    std::string filename = utils::sanitizeFilename(game.title) + ".rar";
+    return {game.direct_link, (fs::path(games_dir) / filename).string(), game.title, {"game", game.id, 0, 0, game.title}};
 }
 
-void Downloader::downloadShow(const Show& show, const std::string& output_dir) {
-    std::set<int, std::less<int>> seasons;
-    for (const auto& episode : show.episodes) {
-        if (!skip_specials_ || episode.season > 0) { 
-            seasons.insert(episode.season);
+void Downloader::downloadMovie(const Movie& movie, const std::string& output_dir) {
+    downloadFile(movieJob(movie, output_dir), nullptr);
+}
+
+void Downloader::downloadEpisode(const Show& show, const EpisodeView& episode, const std::string& output_dir) {
+    downloadFile(episodeJob(show, episode, output_dir), nullptr);
+}
+
+std::vector<DownloadJob> Downloader::showJobs(const Show& show, int season, const std::string& output_dir,
+                                              std::vector<UrlProbe>* probes) {
+    std::vector<EpisodeView> episodes;
+    for (int number : show.episodes.seasons()) {
+        if ((season < 0 || number == season) && !(skip_specials_ && number == 0)) {
+            for (const auto& episode : show.episodes.season(number)) {
+                episodes.push_back(episode);
+            }
         }
     }
-    
-    for (int season : seasons) {
-        downloadSeason(show, season, output_dir);
+
+    // Each job waits on a HEAD request, so a long show resolves in parallel
+    std::vector<UrlProbe> found(episodes.size());
+    std::vector<std::future<DownloadJob>> pending;
+    WorkerPool pool(std::min(PROBE_CONNECTIONS, std::max<size_t>(episodes.size(), 1)));
+    for (size_t i = 0; i < episodes.size(); i++) {
+        pending.push_back(pool.async([&, i] { return episodeJob(show, episodes[i], output_dir, &found[i]); }));
     }
+    std::vector<DownloadJob> jobs;
+    for (auto& job : pending) {
+        jobs.push_back(job.get());
+    }
+    if (probes) {
+        *probes = std::move(found);
+    }
+    return jobs;
+}
+
+void Downloader::downloadSeason(const Show& show, int season, const std::string& output_dir) {
+    downloadFiles(showJobs(show, season, output_dir), 1);
+}
+
+void Downloader::downloadShow(const Show& show, const std::string& output_dir) {
+    downloadFiles(showJobs(show, -1, output_dir), 1);
 }
 
 std::string Downloader::buildUrl(const std::string& tmdb_id, int season, int episode) {
@@ -232,118 +536,901 @@ std::string Downloader::buildUrl(const std::string& tmdb_id, int season, int epi
 }
 
 void Downloader::downloadFile(const std::string& url, const std::string& output_path) {
-    std::string download_path = output_path;
-    std::string final_path;
-    
-    if (mp4_mode_) {
-        if (output_path.substr(output_path.length() - 4) == ".mkv") {
-            final_path = output_path.substr(0, output_path.length() - 4) + ".mp4";
-            download_path = output_path;
+    downloadFile(url, output_path, nullptr);
+}
+
+void Downloader::downloadFiles(const std::vector<DownloadJob>& jobs, size_t parallel) {
+    if (jobs.size() == 1) {
+        std::cout << "Downloading " << jobs[0].label << " to " << jobs[0].output_path << "\n";
+        downloadFile(jobs[0], nullptr);
+        return;
+    }
+    if (jobs.empty()) {
+        return;
+    }
+
+    std::vector<TransferProgress> progress(jobs.size());
+    std::vector<std::string> failures;
+    std::vector<std::future<void>> moves;
+    std::atomic<size_t> finished{0};
+    std::atomic<size_t> processing{0};
+    std::mutex output_mutex;
+
+    auto report = [&](size_t i, const std::string& error) {
+        std::string result = error.empty() ? "Finished: " + jobs[i].label
+                                           : "Failed: " + jobs[i].label + " (" + error + ")";
+        {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            if (!error.empty()) {
+                failures.push_back(result);
+            }
+            std::cout << "\033[2K\r" << result << std::endl;
         }
+        finished++;
+    };
+
+    // Adaptive, `parallel` is only where a host nothing was learned for starts
+    std::unique_ptr<ConcurrencyController> transfers;
+    if (max_concurrency_ > 0) {
+        transfers = std::make_unique<ConcurrencyController>(ConcurrencyController::hostOf(jobs[0].url), "transfers",
+                                                            parallel, max_concurrency_);
+        parallel = transfers->limit();
     }
+    parallel = std::min(std::max<size_t>(parallel, 1), jobs.size());
+    std::cout << "Downloading " << jobs.size() << " files, " << (transfers ? "starting at " : "") << parallel
+              << " at a time\n";
 
-    std::cout << "Downloading to: " << (final_path.empty() ? download_path : final_path) << std::endl;
-    std::cout << std::endl;
-    
-    if (isM3U8Url(url, api_key_)) {
-        std::string headers = !api_key_.empty() ? " -headers \"X-API-Key: " + api_key_ + "\"" : "";
-        std::string command = "ffmpeg -nostats -hide_banner -loglevel error " + headers +
-                              " -i \"" + url + "\" -map 0:v -map 0:a -map 0:s? -map_metadata -1 " +
-                              "-metadata title= -metadata description= -metadata comment= " +
-                              "-metadata synopsis= -metadata show= -metadata episode_id= " +
-                              "-metadata network= -metadata genre= " +
-                              "-c copy \"" + download_path + "\" -y " +
-                              "-progress pipe:1 2>/dev/null";
-
-        FILE* pipe = popen(command.c_str(), "r");
-        if (!pipe) {
-            throw std::runtime_error("Failed to start ffmpeg");
-        }
-
-        std::string line;
-        char buffer[128];
-        while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-            line = buffer;
-            parseProgress(line);
-        }
-
-        int status = pclose(pipe);
-        if (status != 0) {
-            fs::remove(download_path);
-            throw std::runtime_error("FFmpeg exited with an error.");
+    // Remuxing is disk bound and downloading network bound, so they run as
+    // separate stages: the next transfer starts while the last one is
+    // remuxed, and a full remux queue holds back new transfers
+    size_t remuxers = process::limit();
+    WorkerPool post(remuxers, remuxers);
+    WorkerPool pool(transfers ? std::min(transfers->maxLimit(), jobs.size()) : parallel);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        pool.submit([&, i] {
+            try {
+                PostProcess work;
+                {
+                    ConcurrencyController::Slot slot(transfers.get(), &progress[i]);
+                    trace::Span span("download", "job", jobs[i].label);
+                    try {
+                        work = fetch(jobs[i], &progress[i]);
+                    } catch (...) {
+                        slot.fail();
+                        throw;
+                    }
+                }
+                if (work.input.empty()) {
+                    // Nothing to remux; at most a hand-off to the mover
+                    auto moved = postProcess(work, true);
+                    {
+                        std::lock_guard<std::mutex> lock(output_mutex);
+                        moves.push_back(std::move(moved));
+                    }
+                    report(i, "");
+                    return;
+                }
+                processing++;
+                post.submit([&, i, work] {
+                    try {
+                        trace::Span span("download", "post_process", jobs[i].label);
+                        auto moved = postProcess(work, true);
+                        {
+                            std::lock_guard<std::mutex> lock(output_mutex);
+                            moves.push_back(std::move(moved));
+                        }
+                        processing--;
+                        report(i, "");
+                    } catch (const std::exception& e) {
+                        processing--;
+                        report(i, e.what());
+                    }
+                });
+            } catch (const std::exception& e) {
+                report(i, e.what());
+            }
+        });
+    }
+
+    auto lastUpdate = std::chrono::steady_clock::now();
+    curl_off_t lastBytes = 0;
+    while (finished < jobs.size()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+        curl_off_t now = 0;
+        curl_off_t total = 0;
+        for (const auto& p : progress) {
+            now += p.now;
+            total += p.total;
         }
-    } else {
-        CURL* curl = curl_easy_init();
-        if (!curl) {
-            throw std::runtime_error("Failed to initialize CURL");
+        auto time = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(time - lastUpdate).count();
+        double speedMB = (now - lastBytes) / seconds / 1024.0 / 1024.0;
+        lastUpdate = time;
+        lastBytes = now;
+
+        if (transfers) {
+            transfers->tick();
         }
-        
-        FILE* fp = fopen(download_path.c_str(), "wb");
-        if (!fp) {
-            curl_easy_cleanup(curl);
-            throw std::runtime_error("Failed to open output file: " + download_path);
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << "\033[2K\r[" << finished << "/" << jobs.size() << " done";
+        if (transfers) {
+            std::cout << ", " << transfers->limit() << " at a time";
         }
-        
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        if (processing > 0) {
+            std::cout << ", " << processing << " remuxing";
+        }
+        if (mover_ && mover_->pending() > 0) {
+            std::cout << ", " << mover_->pending() << " moving";
+        }
+        std::cout << "] " << std::fixed << std::setprecision(2)
+                  << now / 1024.0 / 1024.0 << "MB/" << total / 1024.0 / 1024.0 << "MB @ "
+                  << std::max(0.0, speedMB) << "MB/s" << std::flush;
+    }
+    pool.wait();
+    post.wait();
+    if (transfers) {
+        transfers->save();
+    }
+    std::cout << "\033[2K\r";
+    if (mover_) {
+        if (mover_->pending() > 0) {
+            std::cout << "Moving " << mover_->pending() << " file(s) to the library..." << std::flush;
+        }
+        mover_->wait();
+        for (auto& moved : moves) {
+            try {
+                moved.get();
+            } catch (const std::exception& e) {
+                failures.push_back("Failed: " + std::string(e.what()));
+            }
+        }
+        std::cout << "\033[2K\r";
+    }
+    if (library_) {
+        library_->flush();
+    }
+
+    if (!failures.empty()) {
+        std::string message = std::to_string(failures.size()) + " of " + 
+                              std::to_string(jobs.size()) + " downloads failed";
+        for (const auto& failure : failures) {
+            message += "\n  " + failure;
+        }
+        throw std::runtime_error(message);
+    }
+}
+
+DownloadPlan Downloader::plan(const std::vector<DownloadJob>& jobs, std::vector<UrlProbe> probes,
+                              const std::string& target) {
+    trace::Span span("download", "plan", target);
+    DownloadPlan plan;
+    plan.target = target;
+    if (probes.size() != jobs.size()) {
+        probes.assign(jobs.size(), UrlProbe{});
+        WorkerPool pool(std::min(PROBE_CONNECTIONS, std::max<size_t>(jobs.size(), 1)));
+        for (size_t i = 0; i < jobs.size(); i++) {
+            pool.submit([&, i] { probes[i] = probeUrl(jobs[i].url, api_key_); });
+        }
+        pool.wait();
+    }
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        DownloadPlan::Item item{jobs[i], probes[i]};
+        std::error_code ec;
+        auto existing = fs::file_size(finalPath(jobs[i].output_path), ec);
+        item.replaces = ec ? 0 : existing;
+        // Converted or stripped, by the MP4 remuxer or ffmpeg
+        auto extension = fs::path(jobs[i].output_path).extension();
+        item.remuxed = extension == ".mkv" || extension == ".mp4";
+        plan.items.push_back(item);
+    }
+
+    std::error_code ec;
+    auto space = fs::space(target, ec);
+    plan.available = ec ? 0 : space.available;
+    // Staged files sit on their own filesystem until moved, so it has to
+    // hold every transfer in flight with its remux, and with moves capped
+    // below the network, every file waiting for the mover
+    struct stat target_st{}, staging_st{};
+    if (!staging_dir_.empty() && ::stat(staging_dir_.c_str(), &staging_st) == 0 &&
+        (::stat(target.c_str(), &target_st) != 0 || target_st.st_dev != staging_st.st_dev)) {
+        plan.staging = staging_dir_;
+        auto staging_space = fs::space(staging_dir_, ec);
+        plan.staging_available = ec ? 0 : staging_space.available;
+        plan.staging_slots = max_concurrency_ > 0 ? max_concurrency_ : 1;
+        plan.staging_backlog = mover_->bandwidth() > 0;
+    }
+    if (!jobs.empty()) {
+        plan.bytes_per_second =
+            ConcurrencyController::goodput(ConcurrencyController::hostOf(jobs[0].url), "transfers");
+    }
+    return plan;
+}
+
+void Downloader::downloadFile(const std::string& url, const std::string& output_path, TransferProgress* progress) {
+    downloadFile(DownloadJob{url, output_path, ""}, progress);
+}
+
+void Downloader::downloadFile(const DownloadJob& job, TransferProgress* progress) {
+    bool quiet = progress != nullptr;
+    if (!quiet) {
+        std::cout << "Downloading to: " << finalPath(job.output_path) << std::endl;
+        std::cout << std::endl;
+    }
+
+    PostProcess work = fetch(job, progress);
+    auto moved = postProcess(work, quiet);
+    // A staged file only counts once it reached the library, so a failed
+    // move fails the download here rather than going unnoticed
+    bool moving = moved.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    if (!quiet && moving) {
+        std::cout << "\033[2K\rMoving to the library..." << std::flush;
+    }
+    std::exception_ptr error;
+    try {
+        moved.get();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (library_) {
+        library_->flush();
+    }
+    if (!quiet) {
+        std::cout << (moving ? "\033[2K\r" : "") << std::endl;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void Downloader::downloadFile(const DownloadJob& job, TransferProgress* progress, const std::function<void()>& fetched,
+                              Moved moved) {
+    PostProcess work = fetch(job, progress);
+    if (fetched) {
+        fetched();
+    }
+    postProcess(work, true, [this, moved](std::exception_ptr error) {
+        if (library_) {
+            library_->flush();
+        }
+        moved(error);
+    });
+}
+
+std::string Downloader::finalPath(const std::string& output_path) const {
+    if (mp4_mode_ && fs::path(output_path).extension() == ".mkv") {
+        return fs::path(output_path).replace_extension(".mp4").string();
+    }
+    return output_path;
+}
+
+std::string Downloader::stagedPath(const std::string& output_path) const {
+    if (staging_dir_.empty()) {
+        return output_path;
+    }
+    // Prefixed with a hash of the destination so equally named files bound
+    // for different folders can be staged at once
+    std::ostringstream name;
+    name << std::hex << std::hash<std::string>{}(fs::absolute(output_path).string()) << "-"
+         << fs::path(output_path).filename().string();
+    return (fs::path(staging_dir_) / name.str()).string();
+}
+
+Downloader::PostProcess Downloader::fetch(const DownloadJob& job, TransferProgress* progress) {
+    const std::string& url = job.url;
+    const std::string& output_path = job.output_path;
+    bool quiet = progress != nullptr;
+    std::string download_path = stagedPath(output_path);
+    std::string final_path = finalPath(download_path);
+    // Library path the staged result moves to, empty without staging
+    std::string move_to = download_path != output_path ? finalPath(output_path) : "";
+
+    if (probeUrl(url, api_key_).hls) {
+        PostProcess work = fetchHls(url, download_path, progress);
+        work.item = job.item;
+        if (!move_to.empty()) {
+            if (work.output.empty()) {
+                work.output = final_path;
+            }
+            work.move_to = move_to;
+        }
+        return work;
+    }
+
+    CURL* curl = curl_easy_init();
+    if (!curl) {
+        throw std::runtime_error("Failed to initialize CURL");
+    }
+    
+    FILE* fp = fopen(download_path.c_str(), "wb");
+    if (!fp) {
+        curl_easy_cleanup(curl);
+        throw std::runtime_error("Failed to open output file: " + download_path);
+    }
+    
+    // Matroska downloads bound for MP4 are remuxed as they arrive; the .mkv
+    // is kept until the MP4 is complete, for ffmpeg if the remuxer gives up
+    HashingWriter writer{fp, {}};
+    std::unique_ptr<MkvToMp4> remux;
+    if (final_path != download_path) {
+        remux = std::make_unique<MkvToMp4>(final_path);
+    }
+    RemuxingWriter remuxing{fp, remux.get(), store_ ? &writer.hash : nullptr};
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    if (remux) {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, remuxingWriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &remuxing);
+    } else if (store_) {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, hashingWriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &writer);
+    } else {
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    }
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    http::share(curl);
+    if (quiet) {
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, transferProgressCallback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, progress);
+    } else {
         curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progressCallback);
-        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-        
-        struct curl_slist* headers = NULL;
-        if (!api_key_.empty()) {
-            headers = curl_slist_append(headers, ("X-API-Key: " + api_key_).c_str());
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        }
-        
-        CURLcode res = curl_easy_perform(curl);
-        
-        if (headers) {
-            curl_slist_free_all(headers);
-        }
-        
+    }
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    
+    struct curl_slist* headers = NULL;
+    if (!api_key_.empty()) {
+        headers = curl_slist_append(headers, ("X-API-Key: " + api_key_).c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    }
+    
+    CURLcode res;
+    {
+        trace::Span span("http", "transfer", url);
+        res = curl_easy_perform(curl);
+    }
+    metrics::recordRequest(curl, "download", res);
+    
+    if (headers) {
+        curl_slist_free_all(headers);
+    }
+    
+    if (remux && res == CURLE_OK) {
+        trace::Span span("disk", "mp4_finish", final_path);
+        finishRemux(&remuxing);
+    }
+    {
+        trace::Span span("disk", "flush", download_path);
         fclose(fp);
-        curl_easy_cleanup(curl);
-        
+    }
+    curl_easy_cleanup(curl);
+    
+    if (!quiet) {
         std::cout << std::endl;
-        
-        if (res != CURLE_OK) {
+    }
+    
+    if (res != CURLE_OK) {
+        fs::remove(download_path);
+        throw std::runtime_error("Download failed: " + std::string(curl_easy_strerror(res)));
+    }
+
+    bool remuxed = remux && remux->state() == MkvToMp4::State::Remuxing && remuxing.error.empty();
+    if (remux) {
+        auto& registry = metrics::Registry::instance();
+        if (remuxed) {
             fs::remove(download_path);
-            throw std::runtime_error("Download failed: " + std::string(curl_easy_strerror(res)));
+            registry.counter("yarrharr_remux_native_total", "MP4 conversions done while downloading").add();
+        } else {
+            std::string reason = remuxing.error.empty() ? remux->reason() : "remux failed: " + remuxing.error;
+            // Drops the partial MP4 a remux that failed partway left behind
+            remux.reset();
+            fs::remove(final_path);
+            registry.counter("yarrharr_remux_fallback_total", "MP4 conversions handed to ffmpeg").add();
+            if (process::findProgram("ffmpeg").empty()) {
+                throw std::runtime_error("FFmpeg not found in PATH. Required for MP4 conversion (" + reason +
+                                         "); the download was kept as " + download_path);
+            }
         }
+    }
 
-        if (output_path.find(".mkv") != std::string::npos || 
-            output_path.find(".mp4") != std::string::npos) {
-            
-            std::string tempPath = download_path + ".processing";
-            std::rename(download_path.c_str(), tempPath.c_str());
-            
-            std::string command = "ffmpeg -stats_period 0.1 -i \"" + tempPath + 
-                                "\" -map 0:v -map 0:a -map 0:s? -map_metadata -1 " +
-                                "-metadata title= -metadata description= -metadata comment= " +
-                                "-metadata synopsis= -metadata show= -metadata episode_id= " +
-                                "-metadata network= -metadata genre= " +
-                                "-c copy \"" + download_path + "\" -y";
-            
-            if (system(command.c_str()) != 0) {
-                fs::remove(tempPath);
-                throw std::runtime_error("Failed to strip metadata");
+    // The MP4 remux drops metadata too, so converting never needs a
+    // separate strip pass
+    PostProcess work;
+    if (remuxed) {
+        // Already written to final_path
+    } else if (final_path != download_path) {
+        work = {download_path, final_path, true};
+    } else if (download_path.find(".mkv") != std::string::npos || 
+               download_path.find(".mp4") != std::string::npos) {
+        work = {download_path, download_path, false};
+    }
+
+    work.item = job.item;
+    std::string target = remuxed ? final_path : work.output.empty() ? download_path : work.output;
+    if (store_) {
+        // Remuxed files are keyed by the downloaded bytes plus the remux,
+        // which is deterministic, so a repeat download skips ffmpeg as well
+        work.item.hash = writer.hash.hexDigest();
+        work.key = work.item.hash;
+        if (remuxed || !work.output.empty()) {
+            work.key += remuxed || work.convert ? "/mp4" : "/stripped";
+        }
+        // Staged files are linked straight into the library, and recorded
+        // there once the mover is done with them
+        std::string linked = move_to.empty() ? target : move_to;
+        std::string existing = store_->find(work.key);
+        if (!existing.empty() && existing != fs::absolute(linked).string() && ContentStore::link(existing, linked)) {
+            for (const auto& path : {download_path, target}) {
+                if (path != linked) {
+                    fs::remove(path);
+                }
             }
-            fs::remove(tempPath);
+            record(work, linked);
+            return {};
         }
     }
+    if (work.output.empty() && move_to.empty()) {
+        record(work, target);
+    }
 
-    if (mp4_mode_ && !final_path.empty()) {
-        std::cout << "\033[2K\rConverting to MP4..." << std::flush;
-        if (!convertToMp4(download_path, final_path)) {
+    if (!work.output.empty() && !work.convert) {
+        work.input = download_path + ".processing";
+        std::rename(download_path.c_str(), work.input.c_str());
+    }
+    if (!move_to.empty()) {
+        if (work.output.empty()) {
+            work.output = remuxed ? final_path : download_path;
+        }
+        work.move_to = move_to;
+    }
+    return work;
+}
+
+Downloader::PostProcess Downloader::fetchHls(const std::string& url, const std::string& download_path,
+                                             TransferProgress* progress) {
+    bool quiet = progress != nullptr;
+    std::string final_path = finalPath(download_path);
+    SegmentClient client(api_key_);
+
+    // Pick the rendition here rather than letting ffmpeg take the first.
+    // Playlists resolve relative URIs against where they were served from,
+    // which for /direct is after a redirect
+    std::string location;
+    std::string text = client.text(url, &location);
+    hls::Playlist master = hls::parse(text, location);
+    hls::Playlist media = master;
+    hls::Playlist audio;
+    size_t variant = 0;
+    const hls::Rendition* rendition = nullptr;
+    if (master.master) {
+        variant = hls::chooseVariant(master, hls_policy_);
+        const hls::Variant& chosen = master.variants[variant];
+        text = client.text(chosen.uri, &location);
+        media = hls::parse(text, location);
+        rendition = hls::chooseAudio(master, chosen, hls_policy_);
+        if (rendition && !rendition->uri.empty()) {
+            text = client.text(rendition->uri, &location);
+            audio = hls::parse(text, location);
+        }
+        if (!quiet) {
+            std::cout << "Variant: " << describeVariant(chosen);
+            if (rendition && !rendition->language.empty()) {
+                std::cout << ", audio: " << rendition->language;
+            }
+            std::cout << std::endl;
+        }
+    }
+    bool separateAudio = !audio.segments.empty();
+
+    if (!media.fetchable() || (separateAudio && !audio.fetchable())) {
+        // Encrypted, byte-range and live playlists are left to ffmpeg, which
+        // is still handed the chosen rendition instead of the master
+        std::vector<std::string> options = {"-nostats", "-hide_banner", "-loglevel", "error"};
+        std::vector<std::string> input_options;
+        if (!api_key_.empty()) {
+            input_options = {"-headers", "X-API-Key: " + api_key_ + "\r\n"};
+        }
+        std::vector<std::string> inputs = {master.master ? master.variants[variant].uri : url};
+        if (separateAudio) {
+            inputs.push_back(rendition->uri);
+        }
+        auto command = remuxCommand(options, input_options, inputs, download_path);
+        command.push_back("-progress");
+        command.push_back("pipe:1");
+
+        process::Options run;
+        if (!quiet) {
+            run.on_line = [this](const std::string& line) { parseProgress(line); };
+        }
+
+        metrics::StageTimer timer("hls_ffmpeg");
+        trace::Span span("ffmpeg", "hls", download_path);
+        if (!process::run(command, run).ok()) {
             fs::remove(download_path);
-            throw std::runtime_error("Failed to convert to MP4");
+            throw std::runtime_error("FFmpeg exited with an error.");
         }
-        fs::remove(download_path);
+
+        // ffmpeg already dropped the metadata while writing
+        if (final_path != download_path) {
+            return {download_path, final_path, true};
+        }
+        return {};
+    }
+
+    PostProcess work{download_path + ".hls", final_path, true};
+    if (separateAudio) {
+        work.audio = download_path + ".hls-audio";
+    }
+    auto discard = [&] {
+        fs::remove(work.input);
+        if (!work.audio.empty()) fs::remove(work.audio);
+    };
+
+    SegmentProgress bytes{progress};
+    double totalSeconds = media.duration() + audio.duration();
+    auto estimate = [&](double fetchedSeconds, uint64_t bandwidth) {
+        // Bytes per media second seen so far, the advertised bandwidth
+        // before the first segment lands
+        double rate = fetchedSeconds > 0 ? bytes.done / fetchedSeconds : bandwidth / 8.0;
+        bytes.total = static_cast<curl_off_t>(rate * totalSeconds);
+        return rate;
+    };
+
+    auto fetchPlaylist = [&](const std::string& path, bool adaptive) {
+        FILE* out = fopen(path.c_str(), "wb");
+        if (!out) {
+            throw std::runtime_error("Failed to open output file: " + path);
+        }
+        try {
+            const std::string& init = adaptive ? media.init_uri : audio.init_uri;
+            if (!init.empty()) {
+                client.append(init, out, bytes);
+            }
+
+            const hls::Playlist* playlist = adaptive ? &media : &audio;
+            uint64_t bandwidth = adaptive && master.master ? master.variants[variant].bandwidth : 0;
+            curl_off_t variantStartBytes = bytes.done;
+            double variantStartSeconds = 0, fetchedSeconds = 0, throughput = 0;
+            int sinceSwitch = 0;
+            auto started = std::chrono::steady_clock::now();
+
+            size_t i = 0;
+            while (i < playlist->segments.size()) {
+                const hls::Segment& segment = playlist->segments[i++];
+                estimate(fetchedSeconds + (adaptive ? 0 : media.duration()), bandwidth);
+                auto before = std::chrono::steady_clock::now();
+                curl_off_t doneBefore = bytes.done;
+                client.append(segment.uri, out, bytes);
+                double took = std::chrono::duration<double>(std::chrono::steady_clock::now() - before).count();
+                double rate = (bytes.done - doneBefore) / std::max(took, 1e-3);
+                throughput = throughput == 0 ? rate : 0.7 * throughput + 0.3 * rate;
+                fetchedSeconds += segment.duration;
+                sinceSwitch++;
+
+                // Switch down at a segment boundary when the rest of the
+                // episode, at this variant's byte rate and the throughput of
+                // the last few segments, would overrun the deadline. Variants
+                // share segment timing, so the next one starts where this
+                // left off; fragmented MP4 would need a second init segment
+                // mid-file, so those stay put.
+                if (!adaptive || hls_policy_.deadline_seconds <= 0 || !master.master || sinceSwitch < 2 ||
+                    !media.init_uri.empty()) {
+                    continue;
+                }
+                double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+                double variantSeconds = fetchedSeconds - variantStartSeconds;
+                double bytesPerSecond = variantSeconds > 0 ? (bytes.done - variantStartBytes) / variantSeconds : bandwidth / 8.0;
+                double remaining = (media.duration() - fetchedSeconds) * bytesPerSecond + audio.duration() * AUDIO_BYTES_PER_SECOND;
+                if (remaining / throughput <= hls_policy_.deadline_seconds - elapsed) {
+                    continue;
+                }
+                size_t lower = hls::lowerVariant(master, variant);
+                if (lower == variant) {
+                    continue;
+                }
+                // A lower variant that can't be fetched leaves the download
+                // where it is rather than failing it
+                hls::Playlist next;
+                try {
+                    std::string nextUrl;
+                    std::string nextText = client.text(master.variants[lower].uri, &nextUrl);
+                    next = hls::parse(nextText, nextUrl);
+                } catch (const std::exception&) {
+                    sinceSwitch = 0;
+                    continue;
+                }
+                if (!next.fetchable() || !next.init_uri.empty()) {
+                    continue;
+                }
+
+                size_t resume = 0;
+                double start = 0;
+                while (resume < next.segments.size() && start + next.segments[resume].duration / 2 <= fetchedSeconds) {
+                    start += next.segments[resume++].duration;
+                }
+                variant = lower;
+                media = std::move(next);
+                playlist = &media;
+                bandwidth = master.variants[variant].bandwidth;
+                fetchedSeconds = variantStartSeconds = start;
+                variantStartBytes = bytes.done;
+                sinceSwitch = 0;
+                i = resume;
+
+                metrics::Registry::instance()
+                    .counter("yarrharr_hls_downswitch_total", "HLS downloads moved to a lower variant mid-transfer")
+                    .add();
+                if (!quiet) {
+                    std::cout << "\033[2K\rThroughput too low for the " << hls_policy_.deadline_seconds
+                              << "s deadline, switching to " << describeVariant(master.variants[variant]) << std::endl;
+                }
+            }
+        } catch (...) {
+            fclose(out);
+            throw;
+        }
+        trace::Span span("disk", "flush", path);
+        if (fclose(out) != 0) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+    };
+
+    try {
+        fetchPlaylist(work.input, true);
+        if (separateAudio) {
+            fetchPlaylist(work.audio, false);
+        }
+    } catch (...) {
+        discard();
+        throw;
+    }
+    if (!quiet) {
+        std::cout << std::endl;
+    }
+    return work;
+}
+
+bool Downloader::stream(const DownloadJob& job, int fd) {
+    metrics::StageTimer timer("stream");
+    trace::Span span("http", "stream", job.label);
+    auto started = std::chrono::steady_clock::now();
+    auto& registry = metrics::Registry::instance();
+
+    uint64_t written = 0;
+    Readahead::Deliver deliver = [&](const std::string& piece) {
+        if (written == 0 && !piece.empty()) {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            registry.histogram("yarrharr_stream_startup_seconds", "Time from starting a stream to its first bytes")
+                .observe(seconds);
+            std::cerr << "First bytes after " << std::fixed << std::setprecision(2) << seconds << "s" << std::endl;
+        }
+        int error = writeAll(fd, piece.data(), piece.size());
+        if (error == EPIPE) {
+            return false;
+        }
+        if (error != 0) {
+            throw std::runtime_error(std::string("Failed to write the stream: ") + std::strerror(error));
+        }
+        written += piece.size();
+        return true;
+    };
+
+    Readahead readahead(STREAM_CONNECTIONS, STREAM_WINDOW);
+    std::unique_ptr<ConcurrencyController> connections;
+    if (max_concurrency_ > 0) {
+        connections = std::make_unique<ConcurrencyController>(ConcurrencyController::hostOf(job.url), "connections",
+                                                              STREAM_CONNECTIONS, max_concurrency_);
+        readahead.setController(connections.get());
+    }
+    bool complete = probeUrl(job.url, api_key_).hls ? streamHls(job.url, fd, readahead, deliver)
+                                                    : streamFile(job.url, readahead, deliver);
+    if (connections) {
+        connections->save();
+    }
+    registry.counter("yarrharr_stream_bytes_total", "Bytes written to --stdout and --fifo streams").add(written);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cerr << (complete ? "Streamed " : "Reader closed the stream after ") << utils::formatFileSize(written)
+              << " in " << formatTime(seconds) << std::endl;
+    return complete;
+}
+
+bool Downloader::streamFile(const std::string& url, Readahead& readahead, const Readahead::Deliver& deliver) {
+    CURL* curl = curl_easy_init();
+    if (!curl) {
+        throw std::runtime_error("Failed to initialize CURL");
+    }
+    StreamProbe probe{curl, &deliver};
+    struct curl_slist* headers = nullptr;
+    if (!api_key_.empty()) {
+        headers = curl_slist_append(headers, ("X-API-Key: " + api_key_).c_str());
+    }
+    std::string range = "0-" + std::to_string(STREAM_FIRST_PIECE - 1);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, probeWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &probe);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, probeHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &probe);
+    http::share(curl);
+
+    CURLcode res;
+    {
+        trace::Span span("http", "stream_probe", url);
+        res = curl_easy_perform(curl);
+    }
+    metrics::recordRequest(curl, "stream", res);
+    // Later ranges skip the /direct redirect
+    char* effective = nullptr;
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective);
+    std::string location = effective ? effective : url;
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+
+    if (probe.error) {
+        std::rethrow_exception(probe.error);
+    }
+    if (probe.closed) {
+        return false;
+    }
+    if (res != CURLE_OK) {
+        throw std::runtime_error("Download failed: " + std::string(curl_easy_strerror(res)));
+    }
+    if (probe.whole) {
+        return true;
+    }
+    if (probe.total < 0) {
+        throw std::runtime_error("Download failed: no Content-Range in the response from " + location);
+    }
+
+    // Piece 0 is the probe itself; each later one doubles up to STREAM_PIECE
+    std::vector<std::pair<curl_off_t, curl_off_t>> ranges = {{0, static_cast<curl_off_t>(probe.body.size()) - 1}};
+    curl_off_t length = STREAM_FIRST_PIECE;
+    for (curl_off_t offset = probe.body.size(); offset < probe.total; offset += length) {
+        length = std::min(length * 2, STREAM_PIECE);
+        ranges.push_back({offset, std::min(offset + length, probe.total) - 1});
+    }
+
+    return readahead.run(ranges.size(), [&](size_t i) {
+        if (i == 0) {
+            return std::move(probe.body);
+        }
+        return fetchPiece(location, api_key_, ranges[i].first, ranges[i].second);
+    }, deliver);
+}
+
+bool Downloader::streamHls(const std::string& url, int fd, Readahead& readahead, const Readahead::Deliver& deliver) {
+    SegmentClient client(api_key_);
+    std::string media_url;
+    std::string text = client.text(url, &media_url);
+    hls::Playlist master = hls::parse(text, media_url);
+    hls::Playlist media = master;
+    const hls::Rendition* rendition = nullptr;
+    if (master.master) {
+        const hls::Variant& chosen = master.variants[hls::chooseVariant(master, hls_policy_)];
+        text = client.text(chosen.uri, &media_url);
+        media = hls::parse(text, media_url);
+        rendition = hls::chooseAudio(master, chosen, hls_policy_);
+        std::cerr << "Variant: " << describeVariant(chosen) << std::endl;
+    }
+    bool separateAudio = rendition && !rendition->uri.empty();
+
+    if (!media.fetchable() || separateAudio) {
+        // Audio in its own rendition has to be muxed in, and encrypted or
+        // live playlists are ffmpeg's to fetch, so it writes MPEG-TS to the
+        // reader directly
+        std::vector<std::string> input_options;
+        if (!api_key_.empty()) {
+            input_options = {"-headers", "X-API-Key: " + api_key_ + "\r\n"};
+        }
+        std::vector<std::string> inputs = {media_url};
+        if (separateAudio) {
+            inputs.push_back(rendition->uri);
+        }
+        auto command = remuxCommand({"-nostats", "-hide_banner", "-loglevel", "error"}, input_options, inputs, "pipe:1");
+        command.insert(command.end() - 2, {"-f", "mpegts"});
+
+        process::Options options;
+        options.stdout_fd = fd;
+        options.inherit_stderr = true;
+        trace::Span span("ffmpeg", "hls_stream", url);
+        if (!process::run(command, options).ok()) {
+            throw std::runtime_error("FFmpeg exited with an error.");
+        }
+        return true;
+    }
+
+    std::vector<std::string> pieces;
+    if (!media.init_uri.empty()) {
+        pieces.push_back(media.init_uri);
+    }
+    for (const auto& segment : media.segments) {
+        pieces.push_back(segment.uri);
+    }
+    return readahead.run(pieces.size(), [&](size_t i) { return fetchPiece(pieces[i], api_key_); }, deliver);
+}
+
+std::future<void> Downloader::postProcess(const PostProcess& work, bool quiet) {
+    auto done = std::make_shared<std::promise<void>>();
+    auto moved = done->get_future();
+    postProcess(work, quiet, [done](std::exception_ptr error) {
+        if (error) {
+            done->set_exception(error);
+        } else {
+            done->set_value();
+        }
+    });
+    return moved;
+}
+
+void Downloader::postProcess(const PostProcess& work, bool quiet, Moved done) {
+    if (work.output.empty()) {
+        done(nullptr);
+        return;
+    }
+    if (!work.input.empty()) {
+        remux(work, quiet);
+    }
+    if (!work.move_to.empty()) {
+        mover_->enqueue(work.output, work.move_to,
+                        [this, work, done](const std::string& path, const std::string& error) {
+                            std::exception_ptr failure;
+                            try {
+                                if (!error.empty()) {
+                                    throw std::runtime_error(error);
+                                }
+                                record(work, path);
+                            } catch (...) {
+                                failure = std::current_exception();
+                            }
+                            done(failure);
+                        });
+    } else {
+        record(work, work.output);
+        done(nullptr);
+    }
+}
+
+void Downloader::record(const PostProcess& work, const std::string& path) {
+    if (store_ && !work.key.empty()) {
+        store_->add(work.key, path);
+    }
+    if (library_ && !work.item.kind.empty()) {
+        LibraryEntry item = work.item;
+        item.path = path;
+        library_->add(item);
+    }
+}
+
+void Downloader::remux(const PostProcess& work, bool quiet) {
+    const char* stage = work.convert ? "mp4_convert" : "strip_metadata";
+    if (!quiet && work.convert) {
+        std::cout << "\033[2K\rConverting to MP4..." << std::flush;
+    }
+
+    std::vector<std::string> verbosity = quiet ? std::vector<std::string>{"-nostats", "-loglevel", "error"}
+                                               : std::vector<std::string>{"-hide_banner", "-loglevel", "error",
+                                                                          "-stats_period", "0.1"};
+    process::Options options;
+    options.inherit_stderr = true;
+
+    metrics::StageTimer timer(stage);
+    trace::Span span("ffmpeg", stage, work.output);
+    std::vector<std::string> inputs = {work.input};
+    if (!work.audio.empty()) {
+        inputs.push_back(work.audio);
+    }
+    bool ok = process::run(remuxCommand(verbosity, {}, inputs, work.output), options).ok();
+    for (const auto& input : inputs) {
+        fs::remove(input);
+    }
+    if (!ok) {
+        throw std::runtime_error(work.convert ? "Failed to convert to MP4" : "Failed to strip metadata");
     }
-    
-    std::cout << std::endl;
 }
 
 void Downloader::parseProgress(const std::string& line) {
@@ -0,0 +1,131 @@
+#include "episode_store.hpp"
+#include "tmdb.hpp"
+#include <algorithm>
+#include <functional>
+
+uint32_t StringPool::intern(std::string_view text) {
+    if ((size() + 1) * 2 > slots_.size()) {
+        rehash(std::max<size_t>(16, slots_.size() * 2));
+    }
+
+    size_t mask = slots_.size() - 1;
+    size_t slot = std::hash<std::string_view>{}(text) & mask;
+    while (slots_[slot] != 0) {
+        uint32_t id = slots_[slot] - 1;
+        if (get(id) == text) {
+            return id;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    uint32_t id = size();
+    data_.append(text.data(), text.size());
+    offsets_.push_back(data_.size());
+    slots_[slot] = id + 1;
+    return id;
+}
+
+std::string_view StringPool::get(uint32_t id) const {
+    return std::string_view(data_.data() + offsets_[id], offsets_[id + 1] - offsets_[id]);
+}
+
+size_t StringPool::memoryUsage() const {
+    return data_.capacity() +
+           offsets_.capacity() * sizeof(uint32_t) +
+           slots_.capacity() * sizeof(uint32_t);
+}
+
+void StringPool::rehash(size_t capacity) {
+    slots_.assign(capacity, 0);
+    size_t mask = capacity - 1;
+    for (uint32_t id = 0; id < size(); id++) {
+        size_t slot = std::hash<std::string_view>{}(get(id)) & mask;
+        while (slots_[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot] = id + 1;
+    }
+}
+
+void EpisodeStore::add(int season, int episode, std::string_view name, std::string_view air_date) {
+    Record record{season, episode, strings_.intern(name), strings_.intern(air_date)};
+    auto before = [](const Record& a, const Record& b) {
+        return a.season != b.season ? a.season < b.season : a.episode < b.episode;
+    };
+
+    // TMDB hands seasons over in order, so this is almost always an append
+    if (records_.empty() || !before(record, records_.back())) {
+        records_.push_back(record);
+        if (seasons_.empty() || seasons_.back().season != season) {
+            uint32_t index = records_.size() - 1;
+            seasons_.push_back({season, index, index + 1});
+        } else {
+            seasons_.back().end++;
+        }
+        return;
+    }
+
+    records_.insert(std::upper_bound(records_.begin(), records_.end(), record, before), record);
+    reindex();
+}
+
+void EpisodeStore::add(const Episode& episode) {
+    add(episode.season, episode.episode, episode.name, episode.air_date);
+}
+
+EpisodeView EpisodeStore::operator[](size_t index) const {
+    const Record& record = records_[index];
+    return {record.season, record.episode, strings_.get(record.name), strings_.get(record.air_date)};
+}
+
+std::vector<int> EpisodeStore::seasons() const {
+    std::vector<int> result;
+    result.reserve(seasons_.size());
+    for (const auto& span : seasons_) {
+        result.push_back(span.season);
+    }
+    return result;
+}
+
+EpisodeStore::Range EpisodeStore::season(int season) const {
+    auto it = std::lower_bound(seasons_.begin(), seasons_.end(), season,
+        [](const SeasonSpan& span, int value) { return span.season < value; });
+    if (it == seasons_.end() || it->season != season) {
+        return {this, records_.size(), records_.size()};
+    }
+    return {this, it->begin, it->end};
+}
+
+std::optional<EpisodeView> EpisodeStore::find(int season, int episode) const {
+    auto it = std::lower_bound(seasons_.begin(), seasons_.end(), season,
+        [](const SeasonSpan& span, int value) { return span.season < value; });
+    if (it == seasons_.end() || it->season != season) {
+        return std::nullopt;
+    }
+
+    auto first = records_.begin() + it->begin;
+    auto last = records_.begin() + it->end;
+    auto match = std::lower_bound(first, last, episode,
+        [](const Record& record, int value) { return record.episode < value; });
+    if (match == last || match->episode != episode) {
+        return std::nullopt;
+    }
+    return (*this)[match - records_.begin()];
+}
+
+size_t EpisodeStore::memoryUsage() const {
+    return records_.capacity() * sizeof(Record) +
+           seasons_.capacity() * sizeof(SeasonSpan) +
+           strings_.memoryUsage();
+}
+
+void EpisodeStore::reindex() {
+    seasons_.clear();
+    for (uint32_t i = 0; i < records_.size(); i++) {
+        if (seasons_.empty() || seasons_.back().season != records_[i].season) {
+            seasons_.push_back({records_[i].season, i, i + 1});
+        } else {
+            seasons_.back().end++;
+        }
+    }
+}
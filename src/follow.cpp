@@ -0,0 +1,73 @@
+#include "follow.hpp"
+#include "config.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+std::string FollowList::getFollowPath() {
+    return Config::getDataPath("followed.json");
+}
+
+FollowList FollowList::load(const std::string& path) {
+    FollowList list;
+    list.path_ = path;
+
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return list;
+    }
+
+    nlohmann::json j;
+    file >> j;
+    for (const auto& item : j["shows"]) {
+        FollowedShow show;
+        show.id = item["id"].get<std::string>();
+        show.name = item.value("name", "");
+        show.last_season = item.value("last_season", 0);
+        show.last_episode = item.value("last_episode", 0);
+        show.next_check = item.value("next_check", int64_t(0));
+        list.shows_.push_back(show);
+    }
+    return list;
+}
+
+void FollowList::save() const {
+    nlohmann::json j;
+    j["shows"] = nlohmann::json::array();
+    for (const auto& show : shows_) {
+        j["shows"].push_back({
+            {"id", show.id},
+            {"name", show.name},
+            {"last_season", show.last_season},
+            {"last_episode", show.last_episode},
+            {"next_check", show.next_check}
+        });
+    }
+
+    utils::writeFileAtomically(path_, j.dump(4));
+}
+
+FollowedShow* FollowList::find(const std::string& id) {
+    auto it = std::find_if(shows_.begin(), shows_.end(),
+        [&](const FollowedShow& show) { return show.id == id; });
+    return it == shows_.end() ? nullptr : &*it;
+}
+
+void FollowList::add(const FollowedShow& show) {
+    if (FollowedShow* existing = find(show.id)) {
+        *existing = show;
+    } else {
+        shows_.push_back(show);
+    }
+}
+
+bool FollowList::remove(const std::string& id) {
+    auto it = std::remove_if(shows_.begin(), shows_.end(),
+        [&](const FollowedShow& show) { return show.id == id; });
+    if (it == shows_.end()) {
+        return false;
+    }
+    shows_.erase(it, shows_.end());
+    return true;
+}
@@ -1,4 +1,8 @@
 #include "games.hpp"
+#include "utils.hpp"
+#include "http.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include <curl/curl.h>
 #include <iostream>
 #include <sstream>
@@ -8,7 +12,8 @@ static size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::stri
     return size * nmemb;
 }
 
-Games::Games(const std::string& api_key) : api_key_(api_key) {}
+Games::Games(const std::string& api_key, size_t concurrency, const std::string& base_url)
+    : api_key_(api_key), base_url_(base_url), concurrency_(concurrency) {}
 
 void Games::validateResponse(const nlohmann::json& json, const std::vector<std::string>& required_fields) {
     for (const auto& field : required_fields) {
@@ -22,6 +27,7 @@ void Games::validateResponse(const nlohmann::json& json, const std::vector<std::
 }
 
 std::string Games::makeRequest(const std::string& endpoint) {
+    trace::Span span("http", "games", endpoint);
     CURL* curl = curl_easy_init();
     std::string readBuffer;
     long http_code = 0;
@@ -30,11 +36,13 @@ std::string Games::makeRequest(const std::string& endpoint) {
         throw GameNetworkError("Failed to initialize CURL");
     }
     
-    std::string url = "https://sleepy.engineer/api/yarrharr/games" + endpoint;
+    std::string url = base_url_ + "/games" + endpoint;
     
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms_);
+    http::share(curl);
     
     struct curl_slist* headers = NULL;
     if (!api_key_.empty()) {
@@ -43,6 +51,7 @@ std::string Games::makeRequest(const std::string& endpoint) {
     }
     
     CURLcode res = curl_easy_perform(curl);
+    metrics::recordRequest(curl, "games", res);
     
     if (headers) {
         curl_slist_free_all(headers);
@@ -74,28 +83,12 @@ std::string Games::makeRequest(const std::string& endpoint) {
     return readBuffer;
 }
 
-std::vector<Game> Games::search(const std::string& query) {
+std::vector<Game> Games::search(const std::string& query, size_t prefetch) {
     if (query.empty()) {
         throw GameError("Search query cannot be empty");
     }
     
-    std::string encoded_query;
-    {
-        CURL* curl = curl_easy_init();
-        if (!curl) {
-            throw GameNetworkError("Failed to initialize CURL for query encoding");
-        }
-        char* escaped = curl_easy_escape(curl, query.c_str(), query.length());
-        if (!escaped) {
-            curl_easy_cleanup(curl);
-            throw GameError("Failed to encode search query");
-        }
-        encoded_query = escaped;
-        curl_free(escaped);
-        curl_easy_cleanup(curl);
-    }
-    
-    std::string response = makeRequest("?query=" + encoded_query);
+    std::string response = makeRequest("?query=" + utils::urlEncode(query));
     
     try {
         auto json = nlohmann::json::parse(response);
@@ -115,6 +108,10 @@ std::vector<Game> Games::search(const std::string& query) {
             games.push_back(game);
         }
         
+        for (size_t i = 0; i < games.size() && i < prefetch; i++) {
+            getGameDetailsAsync(games[i].id);
+        }
+        
         return games;
     }
     catch (const nlohmann::json::exception& e) {
@@ -123,6 +120,44 @@ std::vector<Game> Games::search(const std::string& query) {
 }
 
 Game Games::getGameDetails(const std::string& id) {
+    std::shared_future<Game> pending;
+    {
+        std::lock_guard<std::mutex> lock(details_mutex_);
+        auto it = details_.find(id);
+        if (it != details_.end()) {
+            pending = it->second;
+        }
+    }
+    // Waited for unlocked, so other lookups aren't held up behind it
+    return pending.valid() ? pending.get() : fetchGameDetails(id);
+}
+
+std::shared_future<Game> Games::getGameDetailsAsync(const std::string& id) {
+    std::lock_guard<std::mutex> lock(details_mutex_);
+    auto it = details_.find(id);
+    if (it != details_.end()) {
+        return it->second;
+    }
+    
+    if (!pool_) {
+        pool_ = std::make_unique<WorkerPool>(concurrency_);
+    }
+    auto future = pool_->async([this, id] {
+        try {
+            return fetchGameDetails(id);
+        } catch (...) {
+            // Only successes are cached, so a transient error is retried by
+            // the next lookup instead of sticking to the id
+            std::lock_guard<std::mutex> lock(details_mutex_);
+            details_.erase(id);
+            throw;
+        }
+    }).share();
+    details_.emplace(id, future);
+    return future;
+}
+
+Game Games::fetchGameDetails(const std::string& id) {
     if (id.empty()) {
         throw GameError("Game ID cannot be empty");
     }
@@ -0,0 +1,258 @@
+#include "hls.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    // KEY=value,KEY="quoted, with commas",...
+    std::map<std::string, std::string> attributes(const std::string& list) {
+        std::map<std::string, std::string> result;
+        size_t i = 0;
+        while (i < list.size()) {
+            size_t eq = list.find('=', i);
+            if (eq == std::string::npos) break;
+            std::string key = list.substr(i, eq - i);
+            key.erase(0, key.find_first_not_of(" \t"));
+            std::string value;
+            i = eq + 1;
+            if (i < list.size() && list[i] == '"') {
+                size_t close = list.find('"', i + 1);
+                if (close == std::string::npos) close = list.size();
+                value = list.substr(i + 1, close - i - 1);
+                i = close + 1;
+            } else {
+                size_t comma = list.find(',', i);
+                if (comma == std::string::npos) comma = list.size();
+                value = list.substr(i, comma - i);
+                i = comma;
+            }
+            result[key] = value;
+            if (i < list.size() && list[i] == ',') i++;
+        }
+        return result;
+    }
+
+    bool startsWith(const std::string& s, const char* prefix) {
+        return s.rfind(prefix, 0) == 0;
+    }
+
+    std::string lower(std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+        return s;
+    }
+
+    // ISO 639-2 codes for the ISO 639-1 ones playlists usually carry
+    std::string normalizeLanguage(const std::string& tag) {
+        static const std::map<std::string, std::string> codes = {
+            {"en", "eng"}, {"de", "ger"}, {"deu", "ger"}, {"fr", "fre"}, {"fra", "fre"}, {"es", "spa"},
+            {"it", "ita"}, {"pt", "por"}, {"ja", "jpn"}, {"ko", "kor"}, {"zh", "chi"}, {"zho", "chi"},
+            {"ru", "rus"}, {"nl", "dut"}, {"nld", "dut"}, {"sv", "swe"}, {"pl", "pol"}, {"hi", "hin"},
+        };
+        std::string primary = lower(tag.substr(0, tag.find_first_of("-_")));
+        auto it = codes.find(primary);
+        return it == codes.end() ? primary : it->second;
+    }
+
+    // "avc1.640028,mp4a.40.2" -> {"avc1", "mp4a"}: the codecs without their
+    // profile and level, which may differ between variants of one stream
+    std::vector<std::string> codecFamilies(const std::string& codecs) {
+        std::vector<std::string> families;
+        std::stringstream list(codecs);
+        std::string codec;
+        while (std::getline(list, codec, ',')) {
+            codec.erase(0, codec.find_first_not_of(" \t"));
+            std::string family = lower(codec.substr(0, codec.find('.')));
+            // Sample entry variants of the same codec
+            if (family == "avc3") family = "avc1";
+            if (family == "hev1") family = "hvc1";
+            if (!family.empty()) families.push_back(family);
+        }
+        std::sort(families.begin(), families.end());
+        return families;
+    }
+}
+
+namespace hls {
+    double Playlist::duration() const {
+        double total = 0;
+        for (const auto& segment : segments) total += segment.duration;
+        return total;
+    }
+
+    std::string resolve(const std::string& base, const std::string& uri) {
+        if (uri.find("://") != std::string::npos) {
+            return uri;
+        }
+        size_t scheme = base.find("://");
+        size_t pathStart = scheme == std::string::npos ? 0 : base.find('/', scheme + 3);
+        if (pathStart == std::string::npos) pathStart = base.size();
+        if (!uri.empty() && uri[0] == '/') {
+            return base.substr(0, pathStart) + uri;
+        }
+        std::string path = base.substr(0, base.find_first_of("?#"));
+        size_t slash = path.rfind('/');
+        if (slash == std::string::npos || slash < pathStart) {
+            return path.substr(0, pathStart) + "/" + uri;
+        }
+        return path.substr(0, slash + 1) + uri;
+    }
+
+    Playlist parse(const std::string& text, const std::string& url) {
+        Playlist playlist;
+        std::istringstream lines(text);
+        std::string line;
+        Variant pendingVariant;
+        bool variantPending = false;
+        double pendingDuration = 0;
+        bool first = true;
+
+        while (std::getline(lines, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (first) {
+                first = false;
+                if (line.rfind("\xEF\xBB\xBF", 0) == 0) line.erase(0, 3);
+                if (line != "#EXTM3U") {
+                    throw std::runtime_error("Not an HLS playlist: " + url);
+                }
+                continue;
+            }
+            if (line.empty()) continue;
+
+            if (startsWith(line, "#EXT-X-STREAM-INF:")) {
+                auto attrs = attributes(line.substr(18));
+                pendingVariant = {};
+                pendingVariant.bandwidth = std::strtoull(attrs["BANDWIDTH"].c_str(), nullptr, 10);
+                pendingVariant.codecs = attrs["CODECS"];
+                pendingVariant.audio_group = attrs["AUDIO"];
+                const std::string& resolution = attrs["RESOLUTION"];
+                size_t x = resolution.find('x');
+                if (x != std::string::npos) {
+                    pendingVariant.width = std::atoi(resolution.substr(0, x).c_str());
+                    pendingVariant.height = std::atoi(resolution.substr(x + 1).c_str());
+                }
+                variantPending = true;
+                playlist.master = true;
+            } else if (startsWith(line, "#EXT-X-MEDIA:")) {
+                auto attrs = attributes(line.substr(13));
+                Rendition rendition;
+                rendition.type = attrs["TYPE"];
+                rendition.group_id = attrs["GROUP-ID"];
+                rendition.language = attrs["LANGUAGE"];
+                rendition.name = attrs["NAME"];
+                rendition.uri = attrs.count("URI") ? resolve(url, attrs["URI"]) : "";
+                rendition.is_default = attrs["DEFAULT"] == "YES";
+                playlist.renditions.push_back(rendition);
+                playlist.master = true;
+            } else if (startsWith(line, "#EXTINF:")) {
+                pendingDuration = std::atof(line.c_str() + 8);
+            } else if (startsWith(line, "#EXT-X-KEY:")) {
+                playlist.encrypted = playlist.encrypted || attributes(line.substr(11))["METHOD"] != "NONE";
+            } else if (startsWith(line, "#EXT-X-MAP:")) {
+                auto attrs = attributes(line.substr(11));
+                playlist.init_uri = resolve(url, attrs["URI"]);
+                playlist.byte_ranges = playlist.byte_ranges || attrs.count("BYTERANGE");
+            } else if (startsWith(line, "#EXT-X-BYTERANGE")) {
+                playlist.byte_ranges = true;
+            } else if (startsWith(line, "#EXT-X-ENDLIST")) {
+                playlist.ended = true;
+            } else if (line[0] != '#') {
+                if (variantPending) {
+                    pendingVariant.uri = resolve(url, line);
+                    playlist.variants.push_back(pendingVariant);
+                    variantPending = false;
+                } else {
+                    playlist.segments.push_back({resolve(url, line), pendingDuration});
+                    pendingDuration = 0;
+                }
+            }
+        }
+        if (first) {
+            throw std::runtime_error("Not an HLS playlist: " + url);
+        }
+        return playlist;
+    }
+
+    bool languageMatches(const std::string& tag, const std::string& wanted) {
+        return !tag.empty() && !wanted.empty() && normalizeLanguage(tag) == normalizeLanguage(wanted);
+    }
+
+    const Rendition* chooseAudio(const Playlist& master, const Variant& variant, const Policy& policy) {
+        const Rendition* fallback = nullptr;
+        for (const auto& rendition : master.renditions) {
+            if (rendition.type != "AUDIO" || rendition.group_id != variant.audio_group || variant.audio_group.empty()) {
+                continue;
+            }
+            if (languageMatches(rendition.language, policy.audio_language)) {
+                return &rendition;
+            }
+            if (!fallback || (rendition.is_default && !fallback->is_default)) {
+                fallback = &rendition;
+            }
+        }
+        return fallback;
+    }
+
+    size_t chooseVariant(const Playlist& master, const Policy& policy) {
+        if (master.variants.empty()) {
+            throw std::runtime_error("HLS master playlist has no variants");
+        }
+
+        auto hasLanguage = [&](const Variant& variant) {
+            const Rendition* audio = chooseAudio(master, variant, policy);
+            return audio && languageMatches(audio->language, policy.audio_language);
+        };
+        bool languageAvailable = !policy.audio_language.empty() &&
+                                 std::any_of(master.variants.begin(), master.variants.end(), hasLanguage);
+
+        size_t best = master.variants.size();
+        size_t lowest = 0;
+        for (size_t i = 0; i < master.variants.size(); i++) {
+            const Variant& variant = master.variants[i];
+            if (variant.bandwidth < master.variants[lowest].bandwidth) lowest = i;
+
+            // Variants without a RESOLUTION are audio-only or unknown; only
+            // the bandwidth limit applies to them
+            if (policy.max_height > 0 && variant.height > policy.max_height) continue;
+            if (policy.max_bandwidth > 0 && variant.bandwidth > policy.max_bandwidth) continue;
+            if (languageAvailable && !hasLanguage(variant)) continue;
+
+            if (best == master.variants.size() ||
+                std::make_pair(variant.bandwidth, variant.height) >
+                    std::make_pair(master.variants[best].bandwidth, master.variants[best].height)) {
+                best = i;
+            }
+        }
+        return best == master.variants.size() ? lowest : best;
+    }
+
+    size_t lowerVariant(const Playlist& master, size_t current) {
+        const Variant& from = master.variants[current];
+        auto codecs = codecFamilies(from.codecs);
+        size_t next = current;
+        for (size_t i = 0; i < master.variants.size(); i++) {
+            const Variant& variant = master.variants[i];
+            if (variant.bandwidth >= from.bandwidth) continue;
+            // Segments of both end up in one stream copied by ffmpeg, so an
+            // HEVC variant can't follow AVC ones or the other way round
+            if (codecFamilies(variant.codecs) != codecs) continue;
+            // Audio already fetched belongs to the current group; a muxed
+            // variant has none, so stepping to one that takes its audio
+            // from a rendition would leave the rest of the output silent
+            if (from.audio_group.empty() && !variant.audio_group.empty()) continue;
+            bool sameAudio = variant.audio_group == from.audio_group;
+            if (next == current) {
+                next = i;
+                continue;
+            }
+            const Variant& chosen = master.variants[next];
+            bool chosenSameAudio = chosen.audio_group == from.audio_group;
+            if (sameAudio != chosenSameAudio ? sameAudio : variant.bandwidth > chosen.bandwidth) {
+                next = i;
+            }
+        }
+        return next;
+    }
+}
@@ -0,0 +1,34 @@
+#include "http.hpp"
+
+namespace {
+    // libcurl does not support one connection cache used by concurrent
+    // threads, so each thread gets its own share handle. Transfers on a
+    // thread still reuse its connections, DNS answers and TLS sessions, and
+    // no lock callbacks are needed.
+    struct ThreadShare {
+        CURLSH* handle;
+
+        ThreadShare() {
+            static const bool initialized = [] {
+                curl_global_init(CURL_GLOBAL_DEFAULT);
+                return true;
+            }();
+            (void)initialized;
+            handle = curl_share_init();
+            curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        }
+
+        ~ThreadShare() {
+            curl_share_cleanup(handle);
+        }
+    };
+}
+
+namespace http {
+    void share(CURL* curl) {
+        thread_local ThreadShare shared;
+        curl_easy_setopt(curl, CURLOPT_SHARE, shared.handle);
+    }
+}
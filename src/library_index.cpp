@@ -0,0 +1,525 @@
+#include "library_index.hpp"
+#include "config.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <regex>
+#include <set>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr char MAGIC[8] = {'Y', 'H', 'L', 'I', 'B', '0', '0', '1'};
+    const char* const KINDS[] = {"movie", "tv", "game"};
+    const char* const FOLDERS[] = {"Movies", "TV Shows", "Games"};
+
+    struct Header {
+        char magic[8];
+        uint32_t entry_count;
+        uint32_t dir_count;
+        uint32_t strings_size;
+        uint32_t reserved;
+    };
+
+    // Sorted by kind, id, season, episode and path, so a title's files are
+    // one binary search away
+    struct EntryRecord {
+        uint64_t size;
+        int64_t mtime;
+        uint32_t id_off;
+        uint32_t title_off;
+        uint32_t path_off;
+        uint32_t id_len;
+        uint32_t title_len;
+        uint32_t path_len;
+        uint8_t kind;
+        uint8_t has_hash;
+        int32_t season;
+        int32_t episode;
+        uint8_t hash[32];
+    };
+
+    // Sorted by path
+    struct DirRecord {
+        int64_t mtime;
+        uint32_t path_off;
+        uint32_t path_len;
+    };
+
+    uint8_t kindCode(const std::string& kind) {
+        for (uint8_t i = 0; i < 3; i++) {
+            if (kind == KINDS[i]) return i;
+        }
+        throw std::runtime_error("Unknown library entry kind: " + kind);
+    }
+
+    int64_t mtimeOf(const struct stat& st) {
+        timespec mtime = utils::modifyTime(st);
+        return static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+    }
+
+    // Held across re-reading, merging and replacing the index, so the daemon
+    // and a CLI run writing at once don't drop each other's entries
+    std::string lower(std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+        return s;
+    }
+
+    // Left behind by downloads in progress and the mover
+    bool temporary(const std::string& name) {
+        for (const char* suffix : {".processing", ".hls", ".hls-audio", ".moov", ".moving", ".tmp", ".dedupe"}) {
+            size_t length = std::strlen(suffix);
+            if (name.size() > length && name.compare(name.size() - length, length, suffix) == 0) {
+                return true;
+            }
+        }
+        return name.empty() || name[0] == '.';
+    }
+
+    // What the folder layout the downloader writes says about a file no
+    // download recorded: "TV Shows/<show>/Season 01/<show> - S01E02 - .mkv"
+    LibraryEntry describe(const fs::path& root, const std::string& path) {
+        LibraryEntry entry;
+        fs::path relative = fs::path(path).lexically_relative(root);
+        std::vector<std::string> parts(relative.begin(), relative.end());
+        for (int i = 0; i < 3; i++) {
+            if (!parts.empty() && parts[0] == FOLDERS[i]) entry.kind = KINDS[i];
+        }
+        entry.path = path;
+        entry.title = fs::path(path).stem().string();
+        if (entry.kind == "tv" && parts.size() > 2) {
+            entry.title = parts[1];
+            static const std::regex code("[Ss](\\d{1,3})[Ee](\\d{1,4})");
+            std::smatch match;
+            std::string name = parts.back();
+            if (std::regex_search(name, match, code)) {
+                entry.season = std::stoi(match[1]);
+                entry.episode = std::stoi(match[2]);
+            }
+        }
+        return entry;
+    }
+
+    std::string hexHash(const uint8_t* hash) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        for (int i = 0; i < 32; i++) {
+            hex += digits[hash[i] >> 4];
+            hex += digits[hash[i] & 15];
+        }
+        return hex;
+    }
+
+    bool parseHash(const std::string& hex, uint8_t* hash) {
+        if (hex.size() < 64) return false;
+        for (int i = 0; i < 32; i++) {
+            unsigned value;
+            if (std::sscanf(hex.c_str() + i * 2, "%2x", &value) != 1) return false;
+            hash[i] = static_cast<uint8_t>(value);
+        }
+        return true;
+    }
+
+    struct View {
+        const Header* header;
+        const EntryRecord* records;
+        const DirRecord* dirs;
+        const char* strings;
+
+        std::string_view string(uint32_t offset, uint32_t length) const { return {strings + offset, length}; }
+
+        LibraryEntry entry(const EntryRecord& record) const {
+            LibraryEntry entry;
+            entry.kind = KINDS[record.kind];
+            entry.id = string(record.id_off, record.id_len);
+            entry.season = record.season;
+            entry.episode = record.episode;
+            entry.title = string(record.title_off, record.title_len);
+            entry.path = string(record.path_off, record.path_len);
+            entry.size = record.size;
+            entry.mtime = record.mtime;
+            if (record.has_hash) entry.hash = hexHash(record.hash);
+            return entry;
+        }
+    };
+
+    View view(const char* data) {
+        View v;
+        v.header = reinterpret_cast<const Header*>(data);
+        v.records = reinterpret_cast<const EntryRecord*>(data + sizeof(Header));
+        v.dirs = reinterpret_cast<const DirRecord*>(v.records + v.header->entry_count);
+        v.strings = reinterpret_cast<const char*>(v.dirs + v.header->dir_count);
+        return v;
+    }
+
+    bool matches(const LibraryEntry& entry, const std::string& kind, const std::string& id, int season, int episode) {
+        return entry.kind == kind && entry.id == id && (season < 0 || entry.season == season) &&
+               (episode < 0 || entry.episode == episode);
+    }
+}
+
+LibraryIndex::LibraryIndex(const std::string& path) : path_(path) {
+    map();
+}
+
+LibraryIndex::~LibraryIndex() {
+    try {
+        flush();
+    } catch (...) {
+    }
+    unmap();
+}
+
+std::string LibraryIndex::getIndexPath() {
+    return Config::getDataPath("library.idx");
+}
+
+void LibraryIndex::map() {
+    int fd = open(path_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(Header))) {
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            data_ = static_cast<const char*>(mapped);
+            size_ = st.st_size;
+        }
+    }
+    close(fd);
+
+    if (!data_) return;
+    const auto* header = reinterpret_cast<const Header*>(data_);
+    size_t expected = sizeof(Header) + header->entry_count * sizeof(EntryRecord) +
+                      header->dir_count * sizeof(DirRecord) + header->strings_size;
+    if (std::memcmp(data_, MAGIC, sizeof(MAGIC)) != 0 || expected != size_) {
+        unmap();
+        return;
+    }
+
+    // Everything read later trusts these, so a corrupt file is dropped here
+    View v = view(data_);
+    auto inStrings = [&](uint32_t offset, uint32_t length) {
+        return static_cast<uint64_t>(offset) + length <= header->strings_size;
+    };
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        const EntryRecord& record = v.records[i];
+        if (record.kind >= 3 || !inStrings(record.id_off, record.id_len) ||
+            !inStrings(record.title_off, record.title_len) || !inStrings(record.path_off, record.path_len)) {
+            unmap();
+            return;
+        }
+    }
+    for (uint32_t i = 0; i < header->dir_count; i++) {
+        if (!inStrings(v.dirs[i].path_off, v.dirs[i].path_len)) {
+            unmap();
+            return;
+        }
+    }
+}
+
+void LibraryIndex::unmap() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+size_t LibraryIndex::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!data_) return pending_.size();
+    return reinterpret_cast<const Header*>(data_)->entry_count + pending_.size();
+}
+
+std::map<std::string, LibraryEntry> LibraryIndex::load() const {
+    std::map<std::string, LibraryEntry> files;
+    if (data_) {
+        View v = view(data_);
+        for (uint32_t i = 0; i < v.header->entry_count; i++) {
+            LibraryEntry entry = v.entry(v.records[i]);
+            files[entry.path] = std::move(entry);
+        }
+    }
+    for (const auto& entry : pending_) {
+        files[entry.path] = entry;
+    }
+    return files;
+}
+
+std::map<std::string, int64_t> LibraryIndex::directories() const {
+    std::map<std::string, int64_t> dirs;
+    if (data_) {
+        View v = view(data_);
+        for (uint32_t i = 0; i < v.header->dir_count; i++) {
+            dirs.emplace(v.string(v.dirs[i].path_off, v.dirs[i].path_len), v.dirs[i].mtime);
+        }
+    }
+    return dirs;
+}
+
+std::vector<LibraryEntry> LibraryIndex::entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<LibraryEntry> result;
+    for (auto& [path, entry] : load()) {
+        result.push_back(std::move(entry));
+    }
+    return result;
+}
+
+std::vector<LibraryEntry> LibraryIndex::find(const std::string& kind, const std::string& id,
+                                             int season, int episode) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<LibraryEntry> result;
+    std::set<std::string> superseded;
+    for (const auto& entry : pending_) {
+        superseded.insert(entry.path);
+        if (matches(entry, kind, id, season, episode)) {
+            result.push_back(entry);
+        }
+    }
+    if (!data_) return result;
+
+    View v = view(data_);
+    auto key = std::make_tuple(kindCode(kind), std::string_view(id));
+    auto recordKey = [&](const EntryRecord& record) {
+        return std::make_tuple(record.kind, v.string(record.id_off, record.id_len));
+    };
+    const EntryRecord* end = v.records + v.header->entry_count;
+    const EntryRecord* it = std::lower_bound(v.records, end, key,
+        [&](const EntryRecord& record, const auto& value) { return recordKey(record) < value; });
+    for (; it != end && recordKey(*it) == key; ++it) {
+        if ((season < 0 || it->season == season) && (episode < 0 || it->episode == episode)) {
+            LibraryEntry entry = v.entry(*it);
+            if (!superseded.count(entry.path)) {
+                result.push_back(std::move(entry));
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<LibraryEntry> LibraryIndex::search(const std::string& text) const {
+    std::string wanted = lower(text);
+    std::vector<LibraryEntry> result;
+    for (auto& entry : entries()) {
+        if (lower(entry.title).find(wanted) != std::string::npos ||
+            lower(fs::path(entry.path).filename().string()).find(wanted) != std::string::npos) {
+            result.push_back(std::move(entry));
+        }
+    }
+    return result;
+}
+
+void LibraryIndex::add(LibraryEntry entry) {
+    struct stat st;
+    if (stat(entry.path.c_str(), &st) != 0) {
+        return;
+    }
+    entry.path = fs::absolute(entry.path).lexically_normal().string();
+    entry.size = st.st_size;
+    entry.mtime = mtimeOf(st);
+    kindCode(entry.kind);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(std::move(entry));
+}
+
+void LibraryIndex::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.empty()) return;
+    // The mapping may predate what another process wrote since
+    utils::FileLock fileLock(path_ + ".lock");
+    unmap();
+    map();
+    write(load(), directories());
+    pending_.clear();
+}
+
+RescanReport LibraryIndex::rescan(const std::string& download_path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    utils::FileLock fileLock(path_ + ".lock");
+    unmap();
+    map();
+    fs::path root = fs::absolute(download_path).lexically_normal();
+    if (!root.has_filename()) {
+        root = root.parent_path();
+    }
+    auto files = load();
+    auto known = directories();
+    std::map<std::string, int64_t> dirs;
+    RescanReport report;
+
+    // A directory's mtime only moves when entries are added, removed or
+    // renamed in it, so an unchanged one is skipped without listing it and
+    // only its known subdirectories are visited. Files rewritten in place
+    // are picked up by downloads recording themselves instead.
+    std::function<void(const std::string&)> visit = [&](const std::string& dir) {
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            return;
+        }
+        report.directories++;
+        int64_t mtime = mtimeOf(st);
+        dirs[dir] = mtime;
+
+        std::string prefix = dir + "/";
+        auto previous = known.find(dir);
+        if (previous != known.end() && previous->second == mtime) {
+            for (auto it = known.lower_bound(prefix); it != known.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+                if (it->first.find('/', prefix.size()) == std::string::npos) {
+                    visit(it->first);
+                }
+            }
+            return;
+        }
+
+        report.listed++;
+        std::set<std::string> present;
+        std::vector<std::string> subdirs;
+        std::error_code error;
+        for (fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, error), end;
+             !error && it != end; it.increment(error)) {
+            std::string name = it->path().filename().string();
+            std::string path = prefix + name;
+            // lstat, so symlinked folders can't loop the walk
+            struct stat file;
+            if (temporary(name) || lstat(path.c_str(), &file) != 0) {
+                continue;
+            }
+            if (S_ISDIR(file.st_mode)) {
+                subdirs.push_back(path);
+                continue;
+            }
+            if (!S_ISREG(file.st_mode)) {
+                continue;
+            }
+            present.insert(path);
+            auto existing = files.find(path);
+            if (existing == files.end()) {
+                LibraryEntry entry = describe(root, path);
+                entry.size = file.st_size;
+                entry.mtime = mtimeOf(file);
+                files[path] = std::move(entry);
+                report.added++;
+            } else if (existing->second.size != static_cast<uint64_t>(file.st_size) ||
+                       existing->second.mtime != mtimeOf(file)) {
+                existing->second.size = file.st_size;
+                existing->second.mtime = mtimeOf(file);
+                existing->second.hash.clear();
+                report.updated++;
+            }
+        }
+
+        for (auto it = files.lower_bound(prefix); it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0;) {
+            if (it->first.find('/', prefix.size()) == std::string::npos && !present.count(it->first)) {
+                it = files.erase(it);
+                report.removed++;
+            } else {
+                ++it;
+            }
+        }
+        for (const auto& subdir : subdirs) {
+            visit(subdir);
+        }
+    };
+    for (const char* folder : FOLDERS) {
+        visit((root / folder).string());
+    }
+
+    // Files in directories that are gone altogether
+    std::string rootPrefix = root.string() + "/";
+    for (auto it = files.lower_bound(rootPrefix); it != files.end() && it->first.compare(0, rootPrefix.size(), rootPrefix) == 0;) {
+        if (!dirs.count(fs::path(it->first).parent_path().string())) {
+            it = files.erase(it);
+            report.removed++;
+        } else {
+            ++it;
+        }
+    }
+    // Directories of other roots are kept for their own rescans
+    for (const auto& [dir, mtime] : known) {
+        if (dir.compare(0, rootPrefix.size(), rootPrefix) != 0) {
+            dirs.emplace(dir, mtime);
+        }
+    }
+    if (report.listed == 0 && report.removed == 0 && pending_.empty() && dirs.size() == known.size()) {
+        return report;
+    }
+
+    write(files, dirs);
+    pending_.clear();
+    return report;
+}
+
+void LibraryIndex::write(const std::map<std::string, LibraryEntry>& files, const std::map<std::string, int64_t>& dirs) {
+    std::vector<const LibraryEntry*> sorted;
+    for (const auto& [path, entry] : files) {
+        sorted.push_back(&entry);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const LibraryEntry* a, const LibraryEntry* b) {
+        return std::make_tuple(kindCode(a->kind), std::string_view(a->id), a->season, a->episode, std::string_view(a->path)) <
+               std::make_tuple(kindCode(b->kind), std::string_view(b->id), b->season, b->episode, std::string_view(b->path));
+    });
+
+    std::string strings;
+    auto intern = [&](const std::string& text, uint32_t& offset, uint32_t& length) {
+        offset = strings.size();
+        length = text.size();
+        strings += text;
+    };
+
+    std::vector<EntryRecord> records;
+    records.reserve(sorted.size());
+    for (const auto* entry : sorted) {
+        EntryRecord record{};
+        intern(entry->id, record.id_off, record.id_len);
+        intern(entry->title, record.title_off, record.title_len);
+        intern(entry->path, record.path_off, record.path_len);
+        record.size = entry->size;
+        record.mtime = entry->mtime;
+        record.kind = kindCode(entry->kind);
+        record.season = entry->season;
+        record.episode = entry->episode;
+        record.has_hash = parseHash(entry->hash, record.hash);
+        records.push_back(record);
+    }
+
+    std::vector<DirRecord> dirRecords;
+    dirRecords.reserve(dirs.size());
+    for (const auto& [path, mtime] : dirs) {
+        DirRecord record{};
+        record.mtime = mtime;
+        intern(path, record.path_off, record.path_len);
+        dirRecords.push_back(record);
+    }
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.entry_count = records.size();
+    header.dir_count = dirRecords.size();
+    header.strings_size = strings.size();
+
+    std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+    data.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(EntryRecord));
+    data.append(reinterpret_cast<const char*>(dirRecords.data()), dirRecords.size() * sizeof(DirRecord));
+    data.append(strings.data(), strings.size());
+    utils::writeFileAtomically(path_, data);
+
+    unmap();
+    map();
+}
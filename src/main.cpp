@@ -7,6 +7,7 @@
 #include "utils.hpp"
 #include <iomanip>
 #include <map>
+#include <set>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include "version.hpp"
@@ -17,6 +18,29 @@
 #include <sstream>
 #include "download_utils.hpp"
 #include "games.hpp"
+#include "search_index.hpp"
+#include "batch.hpp"
+#include "updater.hpp"
+#include "delta.hpp"
+#include "follow.hpp"
+#include "daemon.hpp"
+#include "control.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "show_grid.hpp"
+#include "process.hpp"
+#include "content_store.hpp"
+#include "mover.hpp"
+#include "library_index.hpp"
+#include "concurrency.hpp"
+#include "catalog.hpp"
+#include "download_plan.hpp"
+#include <memory>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 namespace fs = std::filesystem;
 
@@ -24,6 +48,9 @@ void printHelp() {
     std::cout << "Usage: yarrharr <command> [options]\n\n"
               << "Commands:\n"
               << "  search <query>           Search for movies and TV shows\n"
+              << "    --offline             Only search titles yarrharr has already resolved\n"
+              << "    --all                 Search TMDB and the games catalog at once, ranked together\n"
+              << "    --timeout <seconds>   How long --all waits for each catalog (default 5)\n"
               << "  show <id>               Show details about a TV show\n"
               << "  movie <id>              Show details about a movie\n"
               << "  download [options]       Download content\n"
@@ -32,106 +59,157 @@ void printHelp() {
               << "    --season <num>        Download specific season\n"
               << "    --episode <num>       Download specific episode\n"
               << "    --skip-specials       Skip downloading season 0 (specials)\n"
+              << "    --stdout              Stream one movie or episode to stdout instead of saving it\n"
+              << "    --fifo <path>         Stream one movie or episode into a FIFO, created if missing\n"
+              << "    --plan                Print sizes, estimated time and free space, then exit\n"
+              << "    --trim                Drop the last episodes that would not fit on disk\n"
+              << "  batch <manifest>         Download everything listed in a manifest file\n"
+              << "    --jobs <n>            Parallel downloads to start from (overrides the manifest)\n"
+              << "  follow <show id>         Download new episodes of a show as they air\n"
+              << "  unfollow <show id>       Stop following a show\n"
+              << "  following                List followed shows\n"
+              << "  daemon                   Keep followed shows up to date\n"
+              << "    --jobs <n>            Parallel downloads to start from (default 2)\n"
+              << "  status                   Show transfers running in the daemon\n"
+              << "  dedupe [dir...]          Replace duplicate files with links (default: download path)\n"
+              << "    --jobs <n>            Files hashed in parallel (default 4)\n"
+              << "    --dry-run             Only report what would be linked\n"
+              << "  library [query]          List downloaded files, or those whose title matches\n"
+              << "    --movie <id>          Files of a movie; exits 1 when there are none\n"
+              << "    --show <id>           Files of a TV show; exits 1 when there are none\n"
+              << "    --season <n>          Only this season of --show\n"
+              << "    --game <id>           Files of a game; exits 1 when there are none\n"
+              << "    --rescan              Update the index from the download path first\n"
+              << "  metrics                  Print the daemon's live metrics\n"
               << "  config [options]         Configure API keys and settings\n"
               << "    --tmdb <key>          Set TMDB API key\n"
               << "    --yarrharr <key>      Set YarrHarr API key\n"
               << "  help                    Show this help message\n"
               << "  Global options:\n"
-              << "    --mp4                 Convert downloads to MP4 format (requires ffmpeg)\n"
+              << "    --mp4                 Convert downloads to MP4 format\n"
               << "    --config <path>       Specify custom config file location\n"
+              << "    --metrics <path>      Write timings and counters on exit (.jsonl appends a line,\n"
+              << "                          anything else gets Prometheus text)\n"
+              << "    --trace <path>        Write a Chrome/Perfetto trace of requests, transfers and ffmpeg runs\n"
               << "  games <subcommand>       Game-related commands\n"
               << "    search <query>         Search for games\n"
               << "    info <id>             Show details about a game\n"
-              << "    download <id>         Download a game\n";
+              << "    download <id>...      Download one or more games\n"
+              << "      --search <query>    Download the top search results instead\n"
+              << "      --top <n>           Number of search results to download (default 1)\n"
+              << "      --jobs <n>          Parallel downloads to start from (default 4)\n";
 }
 
-bool updateBinary(const char* execPath) {
-    try {
-        std::string latestVersion = version::getLatestVersion();
-        if (!version::isVersionNewer(latestVersion, std::string(version::CURRENT_VERSION))) {
-            std::cout << "You are already running the latest version (" << version::CURRENT_VERSION << ").\n";
-            return true;
-        }
-
-        #if defined(__APPLE__)
-            #if defined(__arm64__)
-                const std::string platform = "macos-arm64";
-            #else
-                const std::string platform = "macos-x86_64";
-            #endif
-        #elif defined(__linux__)
-            #if defined(__aarch64__)
-                const std::string platform = "linux-aarch64";
-            #else
-                const std::string platform = "linux-x86_64";
-            #endif
-        #else
-            std::cerr << "Unsupported platform for auto-update\n";
-            return false;
-        #endif
-
-        fs::path tempFile = fs::temp_directory_path() / "yarrharr.new";
-        
-        std::cout << "Downloading update " << version::CURRENT_VERSION << " → " << latestVersion << "...\n";
-        
-        std::string downloadUrl = "https://github.com/asleepynerd/yarrharr/releases/download/v" + 
-                                latestVersion + "/yarrharr-" + platform;
-
-        CURL* curl = curl_easy_init();
-        if (!curl) {
-            throw std::runtime_error("Failed to initialize download");
-        }
-
-        FILE* fp = fopen(tempFile.string().c_str(), "wb");
-        if (!fp) {
-            curl_easy_cleanup(curl);
-            throw std::runtime_error("Failed to create temporary file");
-        }
+// Shared by every downloader a command creates; null with dedupe_downloads off
+ContentStore* contentStore(const Config& config) {
+    static std::unique_ptr<ContentStore> store;
+    if (!store && config.dedupe_downloads) {
+        store = std::make_unique<ContentStore>();
+    }
+    return store.get();
+}
 
-        curl_easy_setopt(curl, CURLOPT_URL, downloadUrl.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progressCallback);
-        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+// Shared by every downloader a command creates
+LibraryIndex* libraryIndex() {
+    static LibraryIndex index;
+    return &index;
+}
 
-        CURLcode res = curl_easy_perform(curl);
-        fclose(fp);
-        curl_easy_cleanup(curl);
+hls::Policy hlsPolicy(const Config& config) {
+    return {config.hls_max_height, config.hls_max_bandwidth, config.hls_audio_language, config.hls_deadline_seconds};
+}
 
-        if (res != CURLE_OK) {
-            fs::remove(tempFile);
-            throw std::runtime_error("Failed to download update");
+// Where a --stdout or --fifo stream is written. Stdout itself is moved
+// aside, so nothing else printed can end up in the stream.
+int openStream(const std::string& fifo) {
+    if (fifo.empty()) {
+        int fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        return fd;
+    }
+    struct stat st;
+    if (stat(fifo.c_str(), &st) != 0) {
+        if (mkfifo(fifo.c_str(), 0600) != 0) {
+            throw std::runtime_error("Failed to create FIFO " + fifo + ": " + std::strerror(errno));
         }
+    } else if (!S_ISFIFO(st.st_mode)) {
+        throw std::runtime_error(fifo + " exists and is not a FIFO");
+    }
+    std::cerr << "Waiting for a reader on " << fifo << "..." << std::endl;
+    int fd = open(fifo.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + fifo + ": " + std::strerror(errno));
+    }
+    return fd;
+}
 
-        std::cout << std::endl;
-
-        fs::permissions(tempFile, 
-            fs::perms::owner_exec | fs::perms::owner_read | fs::perms::owner_write,
-            fs::perm_options::add);
-
-        fs::path currentExe = fs::canonical(fs::path(execPath));
-
-        fs::rename(tempFile, currentExe);
+// Terminal rows a line takes, for redrawing what was printed; counts UTF-8
+// characters, not display width
+size_t terminalRows(const std::string& line, size_t width) {
+    size_t chars = 0;
+    for (unsigned char c : line) {
+        chars += (c & 0xC0) != 0x80;
+    }
+    return width == 0 || chars == 0 ? 1 : (chars - 1) / width + 1;
+}
 
-        std::cout << "Update complete! Please restart yarrharr.\n";
-        return true;
+std::string describeResult(const catalog::Result& result) {
+    std::string year = result.date.substr(0, 4);
+    std::string text = result.kind == "movie" ? "[Movie] " : result.kind == "tv" ? "[TV] " : "[Game] ";
+    text += result.title;
+    if (!year.empty() && result.kind != "tv") {
+        text += " (" + year + ")";
+    }
+    return text + " - " + result.id;
+}
 
-    } catch (const std::exception& e) {
-        std::cerr << "Update failed: " << e.what() << "\n";
-        return false;
+void printQueued(const nlohmann::json& result) {
+    const auto& queued = result["queued"];
+    std::cout << "Queued on the running daemon (see yarrharr status):\n";
+    for (const auto& label : queued) {
+        std::cout << "  " << label.get<std::string>() << "\n";
     }
 }
 
 int main(int argc, char* argv[]) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    // --metrics and --trace are global and taken out before any command
+    // parses argv
+    std::string metricsPath;
+    std::string tracePath;
+    for (int i = 1; i < argc - 1;) {
+        std::string option = argv[i];
+        if (option != "--metrics" && option != "--trace") {
+            i++;
+            continue;
+        }
+        (option == "--metrics" ? metricsPath : tracePath) = argv[i + 1];
+        for (int j = i; j + 2 <= argc; j++) {
+            argv[j] = argv[j + 2];
+        }
+        argc -= 2;
+    }
+    metrics::ScopedExport metricsExport(metricsPath);
+    trace::Session traceSession(tracePath);
+    trace::setThreadName("main");
+
     if (argc < 2) {
-        version::checkForUpdates();
         printHelp();
         return 1;
     }
 
-    if (argc >= 2 && std::string(argv[1]) != "help") {
-        version::checkForUpdates();
+    // Release tooling: yarrharr make-delta <old binary> <new binary> <patch>
+    if (std::string(argv[1]) == "make-delta" && argc == 5) {
+        try {
+            auto patch = delta::create(delta::readFile(argv[2]), delta::readFile(argv[3]));
+            delta::writeFile(argv[4], patch);
+            std::cout << "Wrote " << argv[4] << " (" << patch.size() << " bytes)\n";
+            return 0;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
     }
 
     try {
@@ -145,8 +223,21 @@ int main(int argc, char* argv[]) {
         }
         
         auto config = Config::load(configPath);
+        process::setLimit(std::max(0, config.ffmpeg_jobs));
+
+        // Shared by every downloader a command creates, and declared before
+        // them so queued moves finish before exit
+        std::unique_ptr<Mover> mover;
+        if (!config.staging_path.empty()) {
+            utils::createDirectoryIfNotExists(config.staging_path);
+            mover = std::make_unique<Mover>(static_cast<uint64_t>(std::max(0, config.mover_bandwidth_mbps)) * 1000000 / 8);
+        }
         std::string command = argv[1];
 
+        bool checkUpdates = command != "help" && command != "batch" && command != "update" &&
+                            command != "daemon";
+        version::UpdateNotifier updateNotifier(checkUpdates ? config.update_check_interval_hours : 0);
+
         if (command == "config") {
             bool updated = false;
             for (int i = 2; i < argc; i++) {
@@ -184,13 +275,19 @@ int main(int argc, char* argv[]) {
             return 1;
         }
 
-        TMDB tmdb(config.tmdb_api_key);
+        TMDB tmdb(config.tmdb_api_key, config.tmdb_base_url);
+        SearchIndex searchIndex(SearchIndex::getIndexPath());
+        tmdb.setSearchIndex(&searchIndex);
         bool mp4_mode = false;
         bool skip_specials = false;
         std::string id;
         int season = -1;
         int episode = -1;
         bool isMovie = false;
+        bool toStdout = false;
+        bool planOnly = false;
+        bool trim = false;
+        std::string fifoPath;
 
         for (int i = 2; i < argc; i++) {
             std::string option = argv[i];
@@ -202,6 +299,18 @@ int main(int argc, char* argv[]) {
                 skip_specials = true;
                 continue;
             }
+            if (option == "--stdout") {
+                toStdout = true;
+                continue;
+            }
+            if (option == "--plan") {
+                planOnly = true;
+                continue;
+            }
+            if (option == "--trim") {
+                trim = true;
+                continue;
+            }
             if (i + 1 >= argc) break;
             
             if (option == "--movie") {
@@ -217,11 +326,46 @@ int main(int argc, char* argv[]) {
             else if (option == "--episode") {
                 episode = std::stoi(argv[i + 1]);
             }
+            else if (option == "--fifo") {
+                fifoPath = argv[i + 1];
+            }
         }
 
         if (command == "download") {
-            Downloader downloader("https://sleepy.engineer/api/yarrharr/direct", mp4_mode, skip_specials);
+            bool streaming = toStdout || !fifoPath.empty();
+            if (streaming && (id.empty() || (!isMovie && (season < 0 || episode < 0)))) {
+                std::cerr << "Error: --stdout and --fifo stream one movie, or one episode with --season and --episode.\n";
+                return 1;
+            }
+
+            // A running daemon owns the transfers; hand the request over,
+            // unless it asks for a trace or metrics of this process. What the
+            // daemon can't honor it refuses, and the download runs here.
+            bool local = streaming || planOnly || trim || !tracePath.empty() || !metricsPath.empty();
+            if (!id.empty() && !local && control::available()) {
+                try {
+                    printQueued(control::call("download", {
+                        {"id", id},
+                        {"movie", isMovie},
+                        {"season", season},
+                        {"episode", episode},
+                        {"skip_specials", skip_specials},
+                        {"mp4", mp4_mode},
+                        {"output_dir", config.download_path}
+                    }));
+                    return 0;
+                } catch (const ControlError& e) {
+                    std::cerr << "Not queued on the running daemon: " << e.what() << "; downloading here instead\n";
+                }
+            }
+
+            Downloader downloader(config.api_base_url + "/direct", mp4_mode, skip_specials);
             
+            downloader.setContentStore(contentStore(config));
+            downloader.setLibraryIndex(libraryIndex());
+            downloader.setHlsPolicy(hlsPolicy(config));
+            downloader.setStaging(config.staging_path, mover.get());
+            downloader.setConcurrency(std::max(0, config.max_concurrency));
             if (!config.yarrharr_api_key.empty()) {
                 downloader.setApiKey(config.yarrharr_api_key);
             } else {
@@ -229,113 +373,425 @@ int main(int argc, char* argv[]) {
                 return 1;
             }
 
+            if (streaming) {
+                DownloadJob job;
+                if (isMovie) {
+                    job = downloader.movieJob(tmdb.getMovieDetails(id), config.download_path);
+                } else {
+                    auto show = tmdb.getShowDetails(id);
+                    auto ep = show.episodes.find(season, episode);
+                    if (!ep) {
+                        std::cerr << "Error: No episode S" << season << "E" << episode << " in " << show.name << "\n";
+                        return 1;
+                    }
+                    job = downloader.episodeJob(show, *ep, config.download_path);
+                }
+                // A reader that goes away shows up as EPIPE instead
+                std::signal(SIGPIPE, SIG_IGN);
+                int fd = openStream(toStdout ? "" : fifoPath);
+                downloader.stream(job, fd);
+                close(fd);
+                return 0;
+            }
+
+            std::vector<DownloadJob> jobs;
+            std::vector<UrlProbe> probes;
+            bool single = isMovie || (season >= 0 && episode >= 0);
             if (isMovie) {
-                auto movie = tmdb.getMovieDetails(id);
-                downloader.downloadMovie(movie, config.download_path);
+                probes.emplace_back();
+                jobs.push_back(downloader.movieJob(tmdb.getMovieDetails(id), config.download_path, &probes.back()));
             }
             else if (!id.empty()) {
                 auto show = tmdb.getShowDetails(id);
-                if (season >= 0 && episode >= 0) {
-                    for (const auto& ep : show.episodes) {
-                        if (ep.season == season && ep.episode == episode) {
-                            downloader.downloadEpisode(show, ep, config.download_path);
-                            break;
-                        }
+                if (single) {
+                    if (auto ep = show.episodes.find(season, episode)) {
+                        probes.emplace_back();
+                        jobs.push_back(downloader.episodeJob(show, *ep, config.download_path, &probes.back()));
                     }
                 }
-                else if (season >= 0) {
-                    downloader.downloadSeason(show, season, config.download_path);
-                }
                 else {
-                    downloader.downloadShow(show, config.download_path);
+                    jobs = downloader.showJobs(show, season, config.download_path, &probes);
                 }
             }
+            if (jobs.empty()) {
+                return 0;
+            }
+
+            // Sized before anything is written, so a download too big for
+            // the disk fails here instead of halfway through
+            auto plan = downloader.plan(jobs, probes, config.download_path);
+            size_t planned = plan.items.size();
+            if (trim && !plan.fits()) {
+                plan.trim();
+            }
+            if (planOnly) {
+                plan.print(std::cout);
+                return plan.fits() && !plan.items.empty() ? 0 : 1;
+            }
+            if (plan.items.empty()) {
+                std::cerr << "Error: Not even the first file fits on " << config.download_path
+                          << (plan.staging.empty() ? "" : " and staging " + plan.staging) << ".\n";
+                return 1;
+            }
+            if (!plan.fitsStaging()) {
+                std::cerr << "Error: " << plan.items.size() << " file(s) need "
+                          << utils::formatFileSize(plan.stagingNeeded()) << " on " << plan.staging << " "
+                          << plan.stagingReason() << ", which has " << utils::formatFileSize(plan.staging_available)
+                          << " free. Run with --plan to see sizes, or --trim to download what fits.\n";
+                return 1;
+            }
+            if (!plan.fits()) {
+                std::cerr << "Error: " << plan.items.size() << " file(s) need " << utils::formatFileSize(plan.needed())
+                          << " on " << config.download_path << ", which has " << utils::formatFileSize(plan.available)
+                          << " free. Run with --plan to see sizes, or --trim to download what fits.\n";
+                return 1;
+            }
+            if (plan.items.size() < planned) {
+                std::cout << "Trimmed " << planned - plan.items.size() << " file(s) that would not fit, from "
+                          << plan.dropped.front().job.label << " on\n";
+            }
+
+            if (single) {
+                downloader.downloadFile(plan.items[0].job, nullptr);
+            }
+            else {
+                downloader.downloadFiles(plan.jobs(), 1);
+            }
         }
-        else if (command == "search" && argc > 2) {
-            std::string query;
-            for (int i = 2; i < argc; i++) {
-                query += std::string(argv[i]) + " ";
+        else if (command == "batch" && argc > 2) {
+            if (config.yarrharr_api_key.empty()) {
+                std::cerr << "Error: No YarrHarr API key found. Please run 'yarrharr config' to set it up.\n";
+                return 1;
             }
 
-            auto results = tmdb.search(query);
-            for (size_t i = 0; i < results.size(); i++) {
-                const auto& result = results[i];
-                std::cout << i + 1 << ". ";
-                if (result["media_type"] == "movie") {
-                    std::cout << "[Movie] " << result["title"].get<std::string>() << " (" << result["release_date"].get<std::string>().substr(0, 4) << ")" << " - " << result["id"].get<std::int64_t>() << "\n";
-                } else {
-                    std::cout << "[TV] " << result["name"].get<std::string>() << " - " << result["id"].get<std::int64_t>() << "\n";
+            auto manifest = Manifest::load(argv[2]);
+            for (int i = 3; i < argc - 1; i++) {
+                if (std::string(argv[i]) == "--jobs") {
+                    manifest.jobs = std::stoul(argv[i + 1]);
                 }
             }
+
+            Downloader downloader(config.api_base_url + "/direct", mp4_mode, skip_specials);
+            downloader.setApiKey(config.yarrharr_api_key);
+            downloader.setContentStore(contentStore(config));
+            downloader.setLibraryIndex(libraryIndex());
+            downloader.setHlsPolicy(hlsPolicy(config));
+            downloader.setStaging(config.staging_path, mover.get());
+            downloader.setConcurrency(std::max(0, config.max_concurrency));
+            Games games(config.yarrharr_api_key, manifest.jobs, config.api_base_url);
+
+            BatchRunner runner(tmdb, games, downloader, config.download_path, skip_specials);
+            runner.run(manifest);
         }
-        else if (command == "show" && argc > 2) {
-            auto show = tmdb.getShowDetails(argv[2]);
-            std::cout << "Show: " << show.name << "\n"
-                     << "First aired: " << show.first_air_date << "\n\n";
+        else if (command == "follow" && argc > 2) {
+            auto follows = FollowList::load(FollowList::getFollowPath());
+            if (follows.find(argv[2])) {
+                std::cout << "Already following " << argv[2] << "\n";
+                return 0;
+            }
 
-            struct winsize w;
-            ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-            int termWidth = w.ws_col;
+            // Only episodes that air from now on are downloaded
+            auto status = tmdb.getShowStatus(argv[2]);
+            FollowedShow show;
+            show.id = status.id;
+            show.name = status.name;
+            show.last_season = status.last_season;
+            show.last_episode = status.last_episode;
+            follows.add(show);
+            follows.save();
+            std::cout << "Following " << status.name;
+            if (status.last_season > 0) {
+                std::cout << " from S" << std::setw(2) << std::setfill('0') << status.last_season
+                          << "E" << std::setw(2) << std::setfill('0') << status.last_episode;
+            }
+            std::cout << "\n";
+        }
+        else if (command == "unfollow" && argc > 2) {
+            auto follows = FollowList::load(FollowList::getFollowPath());
+            if (!follows.remove(argv[2])) {
+                std::cerr << "Error: Not following " << argv[2] << "\n";
+                return 1;
+            }
+            follows.save();
+            std::cout << "Unfollowed " << argv[2] << "\n";
+        }
+        else if (command == "following") {
+            auto follows = FollowList::load(FollowList::getFollowPath());
+            if (follows.shows().empty()) {
+                std::cout << "Not following any shows.\n";
+            }
+            for (const auto& show : follows.shows()) {
+                std::cout << std::left << std::setw(10) << show.id << show.name
+                          << " (last S" << std::right << std::setw(2) << std::setfill('0') << show.last_season
+                          << "E" << std::setw(2) << show.last_episode << std::setfill(' ') << ")\n";
+            }
+        }
+        else if (command == "status") {
+            if (!control::available()) {
+                std::cout << "No yarrharr daemon is running.\n";
+                return 0;
+            }
+            auto status = control::call("status", nlohmann::json::object());
+            std::cout << "Following " << status["following"].get<size_t>() << " shows, "
+                      << status["queued"].get<size_t>() << " queued, "
+                      << status["completed"].get<size_t>() << " completed, "
+                      << status["failed"].get<size_t>() << " failed\n";
+            for (const auto& transfer : status["active"]) {
+                int64_t downloaded = transfer["downloaded"].get<int64_t>();
+                int64_t total = transfer["total"].get<int64_t>();
+                std::cout << "  " << transfer["label"].get<std::string>() << "  "
+                          << utils::formatFileSize(downloaded);
+                if (total > 0) {
+                    std::cout << " / " << utils::formatFileSize(total) << " (" << downloaded * 100 / total << "%)";
+                }
+                std::cout << "\n";
+            }
+        }
+        else if (command == "metrics") {
+            std::cout << control::call("metrics", nlohmann::json::object()).get<std::string>();
+        }
+        else if (command == "dedupe") {
+            std::vector<std::string> roots;
+            size_t jobs = 4;
+            bool dryRun = false;
+            for (int i = 2; i < argc; i++) {
+                std::string option = argv[i];
+                if (option == "--jobs" && i + 1 < argc) {
+                    jobs = std::stoul(argv[++i]);
+                } else if (option == "--dry-run") {
+                    dryRun = true;
+                } else {
+                    roots.push_back(option);
+                }
+            }
+            if (roots.empty()) {
+                roots.push_back(config.download_path);
+            }
 
-            std::map<int, std::vector<Episode>> seasons;
-            for (const auto& ep : show.episodes) {
-                seasons[ep.season].push_back(ep);
+            ContentStore store;
+            auto report = store.dedupe(roots, jobs, dryRun);
+            std::cout << "Scanned " << report.files << " files, hashed " << report.hashed
+                      << " with matching sizes\n"
+                      << (dryRun ? "Would link " : "Linked ") << report.linked << " duplicates, "
+                      << utils::formatFileSize(report.bytes_reclaimed)
+                      << (dryRun ? " reclaimable\n" : " reclaimed\n");
+        }
+        else if (command == "library") {
+            std::string query, kind, id;
+            int season = -1;
+            bool rescan = false;
+            for (int i = 2; i < argc; i++) {
+                std::string option = argv[i];
+                if ((option == "--movie" || option == "--show" || option == "--game") && i + 1 < argc) {
+                    kind = option == "--movie" ? "movie" : option == "--show" ? "tv" : "game";
+                    id = argv[++i];
+                } else if (option == "--season" && i + 1 < argc) {
+                    season = std::stoi(argv[++i]);
+                } else if (option == "--rescan") {
+                    rescan = true;
+                } else if (option == "--config" && i + 1 < argc) {
+                    i++;
+                } else {
+                    query += (query.empty() ? "" : " ") + option;
+                }
             }
 
-            int numSeasons = seasons.size();
-            int colWidth = (termWidth / numSeasons) - 3;
-            int numWidth = 3; 
+            LibraryIndex* library = libraryIndex();
+            if (rescan) {
+                auto report = library->rescan(config.download_path);
+                std::cout << "Visited " << report.directories << " directories, read " << report.listed
+                          << " changed since the last scan: " << report.added << " added, " << report.updated
+                          << " updated, " << report.removed << " removed\n";
+            }
 
-            for (const auto& [season, _] : seasons) {
-                std::cout << std::setw(colWidth) << std::left 
-                         << ("Season " + std::to_string(season));
-                if (season != seasons.rbegin()->first) 
-                    std::cout << " | ";
+            if (id.empty() && query.empty()) {
+                std::map<std::string, std::pair<size_t, uint64_t>> totals;
+                for (const auto& entry : library->entries()) {
+                    totals[entry.kind].first++;
+                    totals[entry.kind].second += entry.size;
+                }
+                for (const auto& [name, label] : {std::pair<std::string, const char*>{"movie", "Movies"},
+                                                  {"tv", "Episodes"}, {"game", "Games"}}) {
+                    std::cout << std::left << std::setw(10) << label << std::right << std::setw(7)
+                              << totals[name].first << "  " << utils::formatFileSize(totals[name].second) << "\n";
+                }
+                return 0;
             }
-            std::cout << "\n";
 
-            for (size_t i = 0; i < seasons.size(); i++) {
-                std::cout << std::string(colWidth, '-');
-                if (i < seasons.size() - 1) 
-                    std::cout << "-+-";
+            auto entries = id.empty() ? library->search(query) : library->find(kind, id, season);
+            for (const auto& entry : entries) {
+                std::cout << entry.title;
+                if (entry.kind == "tv" && entry.episode > 0) {
+                    std::cout << " S" << utils::padNumber(entry.season, 2) << "E" << utils::padNumber(entry.episode, 2);
+                }
+                std::cout << "  " << utils::formatFileSize(entry.size) << "  " << entry.path << "\n";
+            }
+            if (entries.empty()) {
+                std::cout << "Not in the library\n";
+                return id.empty() ? 0 : 1;
+            }
+        }
+        else if (command == "daemon") {
+            if (config.yarrharr_api_key.empty()) {
+                std::cerr << "Error: No YarrHarr API key found. Please run 'yarrharr config' to set it up.\n";
+                return 1;
             }
-            std::cout << "\n";
 
-            size_t maxEpisodes = 0;
-            for (const auto& [_, episodes] : seasons) {
-                maxEpisodes = std::max(maxEpisodes, episodes.size());
+            size_t jobs = 2;
+            for (int i = 2; i < argc - 1; i++) {
+                if (std::string(argv[i]) == "--jobs") {
+                    jobs = std::stoul(argv[i + 1]);
+                }
             }
 
-            for (size_t epIndex = 0; epIndex < maxEpisodes; epIndex++) {
-                std::vector<std::vector<std::string>> wrappedLines(seasons.size());
-                int maxWrappedLines = 1;
+            Downloader downloader(config.api_base_url + "/direct", mp4_mode, skip_specials);
+            downloader.setApiKey(config.yarrharr_api_key);
+            downloader.setContentStore(contentStore(config));
+            downloader.setLibraryIndex(libraryIndex());
+            downloader.setHlsPolicy(hlsPolicy(config));
+            downloader.setStaging(config.staging_path, mover.get());
+            downloader.setConcurrency(std::max(0, config.max_concurrency));
+            Games games(config.yarrharr_api_key, jobs, config.api_base_url);
+
+            // Adaptive, --jobs is only where the transfer limit starts
+            std::unique_ptr<ConcurrencyController> concurrency;
+            size_t threads = jobs;
+            if (config.max_concurrency > 0) {
+                concurrency = std::make_unique<ConcurrencyController>(
+                    ConcurrencyController::hostOf(config.api_base_url), "transfers", jobs, config.max_concurrency);
+                threads = concurrency->maxLimit();
+            }
+            Daemon daemon(tmdb, games, downloader, config.download_path, threads);
+            daemon.setMetricsPath(metricsPath);
+            daemon.setConcurrency(concurrency.get());
+            daemon.run();
+            if (concurrency) {
+                concurrency->save();
+            }
+        }
+        else if (command == "search" && argc > 2) {
+            std::string query;
+            bool offline = false;
+            bool all = false;
+            double timeout = 5;
+            for (int i = 2; i < argc; i++) {
+                std::string arg = argv[i];
+                if (arg == "--offline") {
+                    offline = true;
+                    continue;
+                }
+                if (arg == "--all") {
+                    all = true;
+                    continue;
+                }
+                if (arg == "--timeout" && i + 1 < argc) {
+                    timeout = std::stod(argv[++i]);
+                    continue;
+                }
+                if (arg == "--config") {
+                    i++;
+                    continue;
+                }
+                query += arg + " ";
+            }
 
-                int colIndex = 0;
-                for (const auto& [season, episodes] : seasons) {
-                    if (epIndex < episodes.size()) {
-                        const auto& ep = episodes[epIndex];
-                        std::string epText = utils::padNumber(ep.episode, 2) + ". " + ep.name;
-                        wrappedLines[colIndex] = utils::wrapText(epText, colWidth - 1);
-                        maxWrappedLines = std::max(maxWrappedLines, (int)wrappedLines[colIndex].size());
+            if (all) {
+                if (offline) {
+                    std::cerr << "Error: --all searches online catalogs and cannot be combined with --offline\n";
+                    return 1;
+                }
+                tmdb.setTimeout(static_cast<long>(timeout * 1000));
+                Games games(config.yarrharr_api_key, 4, config.api_base_url);
+                games.setTimeout(static_cast<long>(timeout * 1000));
+
+                // On a terminal the first catalog to answer is shown right
+                // away, then redrawn as the merged list once both are in
+                bool terminal = isatty(STDOUT_FILENO);
+                struct winsize w {};
+                ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+                size_t rows = 0;
+                std::vector<std::string> errors;
+                auto results = catalog::search(tmdb, games, query, [&](const catalog::Answer& answer) {
+                    if (!answer.error.empty()) {
+                        errors.push_back(answer.backend + " did not answer: " + answer.error);
+                        return;
+                    }
+                    if (!terminal || rows > 0) {
+                        return;
                     }
-                    colIndex++;
+                    for (size_t i = 0; i < answer.results.size(); i++) {
+                        std::string line = std::to_string(i + 1) + ". " + describeResult(answer.results[i]);
+                        std::cout << line << "\n";
+                        rows += terminalRows(line, w.ws_col);
+                    }
+                    std::string line = "Waiting for " + std::string(answer.backend == "TMDB" ? "Games" : "TMDB") + "...";
+                    std::cout << line << std::endl;
+                    rows += terminalRows(line, w.ws_col);
+                });
+
+                if (rows > 0) {
+                    std::cout << "\033[" << rows << "A\r\033[J";
+                }
+                for (size_t i = 0; i < results.size(); i++) {
+                    std::cout << i + 1 << ". " << describeResult(results[i]) << "\n";
                 }
+                if (results.empty() && errors.size() < 2) {
+                    std::cout << "No results.\n";
+                }
+                for (const auto& error : errors) {
+                    std::cerr << error << "\n";
+                }
+                return errors.size() == 2 ? 1 : 0;
+            }
 
-                for (int line = 0; line < maxWrappedLines; line++) {
-                    colIndex = 0;
-                    for (const auto& [season, episodes] : seasons) {
-                        if (line < wrappedLines[colIndex].size()) {
-                            std::cout << std::setw(colWidth) << std::left << wrappedLines[colIndex][line];
-                        } else {
-                            std::cout << std::setw(colWidth) << " ";
-                        }
-                        if (colIndex < numSeasons - 1) std::cout << " | ";
-                        colIndex++;
+            std::vector<nlohmann::json> results;
+            std::set<std::string> seen;
+            for (const auto& entry : searchIndex.search(query)) {
+                nlohmann::json result = {{"media_type", entry.media_type}, {"id", std::stoll(entry.id)}};
+                if (entry.media_type == "movie") {
+                    result["title"] = entry.title;
+                    result["release_date"] = entry.year;
+                } else {
+                    result["name"] = entry.title;
+                }
+                seen.insert(entry.media_type + ":" + entry.id);
+                results.push_back(result);
+            }
+
+            if (!offline) {
+                for (const auto& result : tmdb.search(query)) {
+                    if (result["media_type"] != "movie" && result["media_type"] != "tv") continue;
+                    std::string key = result["media_type"].get<std::string>() + ":" +
+                                      std::to_string(result["id"].get<std::int64_t>());
+                    if (seen.insert(key).second) {
+                        results.push_back(result);
                     }
-                    std::cout << "\n";
+                }
+            } else if (results.empty()) {
+                std::cout << "No matching titles in the local index.\n";
+            }
+
+            for (size_t i = 0; i < results.size(); i++) {
+                const auto& result = results[i];
+                std::cout << i + 1 << ". ";
+                if (result["media_type"] == "movie") {
+                    std::cout << "[Movie] " << result["title"].get<std::string>() << " (" << result.value("release_date", "").substr(0, 4) << ")" << " - " << result["id"].get<std::int64_t>() << "\n";
+                } else {
+                    std::cout << "[TV] " << result["name"].get<std::string>() << " - " << result["id"].get<std::int64_t>() << "\n";
                 }
             }
         }
+        else if (command == "show" && argc > 2) {
+            auto show = tmdb.getShowDetails(argv[2]);
+            std::cout << "Show: " << show.name << "\n"
+                     << "First aired: " << show.first_air_date << "\n\n";
+
+            struct winsize w;
+            ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+            int termWidth = w.ws_col;
+
+            printShowGrid(show.episodes, termWidth, std::cout);
+        }
         else if (command == "movie" && argc > 2) {
             auto movie = tmdb.getMovieDetails(argv[2]);
             std::cout << "\nMovie: " << movie.title << "\n"
@@ -346,7 +802,7 @@ int main(int argc, char* argv[]) {
                       << "./yarrharr download --movie " << movie.id << "\n";
         }
         else if (command == "update") {
-            if (updateBinary(argv[0])) {
+            if (updater::updateBinary(argv[0])) {
                 return 0;
             }
             return 1;
@@ -360,7 +816,7 @@ int main(int argc, char* argv[]) {
             std::string subcommand = argv[2];
             
             try {
-                Games games(config.yarrharr_api_key);
+                Games games(config.yarrharr_api_key, 4, config.api_base_url);
 
                 if (subcommand == "search" && argc > 3) {
                     std::string query;
@@ -389,20 +845,66 @@ int main(int argc, char* argv[]) {
                               << "./yarrharr games download " << game.id << "\n";
                 }
                 else if (subcommand == "download" && argc > 3) {
-                    auto game = games.getGameDetails(argv[3]);
-                    std::string output_dir = config.download_path + "/Games";
-                    utils::createDirectoryIfNotExists(output_dir);
-                    
-                    std::string filename = utils::sanitizeFilename(game.title) + ".rar";
-                    std::string output_path = (fs::path(output_dir) / filename).string();
-                    
-                    Downloader downloader("https://sleepy.engineer/api/yarrharr/games", false, false);
+                    std::vector<std::string> ids;
+                    std::string searchQuery;
+                    size_t top = 1;
+                    size_t jobs = 4;
+                    for (int i = 3; i < argc; i++) {
+                        std::string arg = argv[i];
+                        if (arg == "--search" && i + 1 < argc) {
+                            searchQuery = argv[++i];
+                        } else if (arg == "--top" && i + 1 < argc) {
+                            top = std::stoul(argv[++i]);
+                        } else if (arg == "--jobs" && i + 1 < argc) {
+                            jobs = std::stoul(argv[++i]);
+                        } else if (arg == "--config" && i + 1 < argc) {
+                            i++;
+                        } else {
+                            ids.push_back(arg);
+                        }
+                    }
+
+                    if (!searchQuery.empty()) {
+                        auto results = games.search(searchQuery, top);
+                        for (size_t i = 0; i < results.size() && i < top; i++) {
+                            ids.push_back(results[i].id);
+                        }
+                    }
+
+                    if (control::available()) {
+                        printQueued(control::call("games.download", {{"ids", ids}}));
+                        return 0;
+                    }
+
+                    std::vector<std::shared_future<Game>> details;
+                    for (const auto& gameId : ids) {
+                        details.push_back(games.getGameDetailsAsync(gameId));
+                    }
+
+                    Downloader downloader(config.api_base_url + "/games", false, false);
+                    downloader.setContentStore(contentStore(config));
+                    downloader.setLibraryIndex(libraryIndex());
+                    downloader.setStaging(config.staging_path, mover.get());
+                    downloader.setConcurrency(std::max(0, config.max_concurrency));
                     if (!config.yarrharr_api_key.empty()) {
                         downloader.setApiKey(config.yarrharr_api_key);
                     }
+
+                    std::vector<DownloadJob> downloads;
+                    for (size_t i = 0; i < details.size(); i++) {
+                        try {
+                            downloads.push_back(downloader.gameJob(details[i].get(), config.download_path));
+                        } catch (const GameError& e) {
+                            std::cerr << "Skipping game " << ids[i] << ": " << e.what() << "\n";
+                        }
+                    }
+
+                    if (downloads.empty()) {
+                        std::cerr << "Error: No games to download\n";
+                        return 1;
+                    }
                     
-                    std::cout << "Downloading " << game.title << " to " << output_path << "\n";
-                    downloader.downloadFile(game.direct_link, output_path);
+                    downloader.downloadFiles(downloads, jobs);
                 }
                 else {
                     std::cerr << "Error: Unknown games subcommand or missing arguments\n";
@@ -0,0 +1,228 @@
+#include "metadata_store.hpp"
+#include "config.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <tuple>
+#include <nlohmann/json.hpp>
+
+namespace {
+    constexpr int64_t HOUR = 3600;
+    // TMDB keeps changes for 14 days; a day's margin for the date-only
+    // start_date parameter
+    constexpr int64_t CHANGE_WINDOW = 13 * 24 * HOUR;
+    constexpr int64_t CHANGES_INTERVAL = HOUR;
+}
+
+ShowStatus ShowMetadata::airing(const std::string& id, const std::string& today) const {
+    ShowStatus result;
+    result.id = id;
+    result.name = name;
+    result.status = status;
+    for (const auto& [season, episodes] : seasons) {
+        result.seasons.push_back(season);
+        if (season == 0) {
+            continue;
+        }
+        for (const auto& episode : episodes) {
+            // "Unknown" and other placeholders for unannounced dates
+            if (episode.air_date.size() != 10) {
+                continue;
+            }
+            if (episode.air_date <= today) {
+                if (std::tie(episode.air_date, season, episode.episode) >
+                    std::tie(result.last_air_date, result.last_season, result.last_episode)) {
+                    result.last_air_date = episode.air_date;
+                    result.last_season = season;
+                    result.last_episode = episode.episode;
+                }
+            } else if (result.next_air_date.empty() || episode.air_date < result.next_air_date) {
+                result.next_air_date = episode.air_date;
+            }
+        }
+    }
+    return result;
+}
+
+std::string MetadataStore::getMetadataPath() {
+    return Config::getDataPath("metadata.json");
+}
+
+MetadataStore MetadataStore::load(const std::string& path) {
+    MetadataStore store;
+    store.path_ = path;
+
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return store;
+    }
+
+    try {
+        nlohmann::json j;
+        file >> j;
+        store.changes_from_ = j.value("changes_from", int64_t(0));
+        store.changes_until_ = j.value("changes_until", int64_t(0));
+        for (const auto& [id, time] : j["changed"].items()) {
+            store.changed_[id] = time.get<int64_t>();
+        }
+        for (const auto& [id, item] : j["shows"].items()) {
+            ShowMetadata& show = store.shows_[id];
+            show.name = item.value("name", "");
+            show.status = item.value("status", "");
+            show.last_sync = item.value("last_sync", int64_t(0));
+            for (const auto& [number, episodes] : item["seasons"].items()) {
+                int season = std::stoi(number);
+                for (const auto& episode : episodes) {
+                    show.seasons[season].push_back({season, episode["episode"].get<int>(),
+                                                    episode.value("name", ""), episode.value("air_date", "")});
+                }
+            }
+        }
+    } catch (const std::exception&) {
+        // A corrupt store only costs a full fetch of every show
+        MetadataStore empty;
+        empty.path_ = path;
+        return empty;
+    }
+    return store;
+}
+
+void MetadataStore::save() const {
+    nlohmann::json j;
+    j["changes_from"] = changes_from_;
+    j["changes_until"] = changes_until_;
+    j["changed"] = changed_;
+    j["shows"] = nlohmann::json::object();
+    for (const auto& [id, show] : shows_) {
+        nlohmann::json seasons = nlohmann::json::object();
+        for (const auto& [season, episodes] : show.seasons) {
+            nlohmann::json list = nlohmann::json::array();
+            for (const auto& episode : episodes) {
+                list.push_back({{"episode", episode.episode}, {"name", episode.name}, {"air_date", episode.air_date}});
+            }
+            seasons[std::to_string(season)] = list;
+        }
+        j["shows"][id] = {{"name", show.name}, {"status", show.status}, {"last_sync", show.last_sync},
+                          {"seasons", seasons}};
+    }
+
+    utils::writeFileAtomically(path_, j.dump());
+}
+
+const ShowMetadata* MetadataStore::find(const std::string& id) const {
+    auto it = shows_.find(id);
+    return it == shows_.end() ? nullptr : &it->second;
+}
+
+void MetadataStore::retain(const std::vector<std::string>& ids) {
+    std::set<std::string> keep(ids.begin(), ids.end());
+    for (auto it = shows_.begin(); it != shows_.end();) {
+        it = keep.count(it->first) ? std::next(it) : shows_.erase(it);
+    }
+    for (auto it = changed_.begin(); it != changed_.end();) {
+        it = keep.count(it->first) ? std::next(it) : changed_.erase(it);
+    }
+}
+
+SyncReport MetadataStore::sync(TMDB& tmdb, const std::vector<std::string>& ids, int64_t now) {
+    SyncReport report;
+
+    bool stored = std::any_of(ids.begin(), ids.end(), [&](const std::string& id) { return shows_.count(id); });
+    if (stored && changes_until_ + CHANGES_INTERVAL <= now) {
+        int64_t since = changes_until_;
+        if (since < now - CHANGE_WINDOW) {
+            // First run or a long gap: start the change list at the oldest
+            // sync still inside TMDB's window; older shows are fetched again
+            since = now;
+            for (const auto& [id, show] : shows_) {
+                since = std::min(since, std::max(show.last_sync, now - CHANGE_WINDOW));
+            }
+            changes_from_ = since;
+            changed_.clear();
+        }
+        try {
+            report.requests++;
+            for (const auto& id : tmdb.getChangedShows(since, now)) {
+                if (shows_.count(id)) {
+                    changed_[id] = now;
+                }
+            }
+            changes_until_ = now;
+        } catch (const std::exception& e) {
+            for (const auto& id : ids) {
+                if (shows_.count(id)) {
+                    report.failed[id] = std::string("Failed to read TMDB changes: ") + e.what();
+                }
+            }
+        }
+    }
+
+    for (const auto& id : ids) {
+        if (report.failed.count(id)) {
+            continue;
+        }
+        try {
+            auto it = shows_.find(id);
+            if (it == shows_.end() || it->second.last_sync < changes_from_) {
+                fetch(tmdb, id, now, report);
+            } else if (changed_.count(id) && changed_[id] > it->second.last_sync) {
+                patch(tmdb, id, now, report);
+            } else {
+                // Nothing edited up to the end of the change list
+                it->second.last_sync = std::max(it->second.last_sync, changes_until_);
+            }
+        } catch (const std::exception& e) {
+            report.failed[id] = e.what();
+        }
+    }
+
+    for (auto it = changed_.begin(); it != changed_.end();) {
+        auto show = shows_.find(it->first);
+        it = show == shows_.end() || show->second.last_sync >= it->second ? changed_.erase(it) : std::next(it);
+    }
+    return report;
+}
+
+void MetadataStore::fetch(TMDB& tmdb, const std::string& id, int64_t now, SyncReport& report) {
+    report.requests++;
+    ShowStatus status = tmdb.getShowStatus(id);
+    ShowMetadata show;
+    show.name = status.name;
+    show.status = status.status;
+    for (int season : status.seasons) {
+        report.requests++;
+        show.seasons[season] = tmdb.getSeasonEpisodes(id, season);
+    }
+    show.last_sync = now;
+    shows_[id] = std::move(show);
+    report.fetched++;
+}
+
+void MetadataStore::patch(TMDB& tmdb, const std::string& id, int64_t now, SyncReport& report) {
+    ShowMetadata& show = shows_[id];
+    report.requests++;
+    ShowChanges changes = tmdb.getShowChanges(id, show.last_sync);
+    if (changes.changed) {
+        // The show itself says which seasons exist now; new ones are
+        // fetched, removed ones dropped and edited ones replaced
+        report.requests++;
+        ShowStatus status = tmdb.getShowStatus(id);
+        std::map<int, std::vector<Episode>> seasons;
+        for (int season : status.seasons) {
+            auto existing = show.seasons.find(season);
+            if (existing == show.seasons.end() || changes.seasons.count(season)) {
+                report.requests++;
+                report.seasons++;
+                seasons[season] = tmdb.getSeasonEpisodes(id, season);
+            } else {
+                seasons[season] = existing->second;
+            }
+        }
+        show.name = status.name;
+        show.status = status.status;
+        show.seasons = std::move(seasons);
+        report.patched++;
+    }
+    show.last_sync = now;
+}
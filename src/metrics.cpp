@@ -0,0 +1,217 @@
+#include "metrics.hpp"
+#include "utils.hpp"
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+
+namespace {
+    constexpr uint64_t BASE_MICROS = 100;
+
+    std::string key(const std::string& name, const std::string& labels) {
+        return labels.empty() ? name : name + "{" + labels + "}";
+    }
+
+    std::string withLabel(const std::string& labels, const std::string& extra) {
+        return labels.empty() ? extra : labels + "," + extra;
+    }
+
+    std::string formatDouble(double value) {
+        std::ostringstream out;
+        out << value;
+        return out.str();
+    }
+}
+
+namespace metrics {
+    void Histogram::observe(double seconds) {
+        uint64_t micros = seconds > 0 ? static_cast<uint64_t>(seconds * 1e6) : 0;
+        uint64_t units = (micros + BASE_MICROS - 1) / BASE_MICROS;
+        size_t index = units <= 1 ? 0 : 64 - __builtin_clzll(units - 1);
+        if (index > BUCKETS) index = BUCKETS;
+
+        buckets_[index].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_micros_.fetch_add(micros, std::memory_order_relaxed);
+    }
+
+    double Histogram::upperBound(size_t bucket) {
+        return BASE_MICROS * std::ldexp(1.0, static_cast<int>(bucket)) / 1e6;
+    }
+
+    double Histogram::quantile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+
+        uint64_t target = static_cast<uint64_t>(std::ceil(q * total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += bucket(i);
+            if (seen >= target) return upperBound(i);
+        }
+        return upperBound(BUCKETS - 1);
+    }
+
+    Registry& Registry::instance() {
+        static Registry registry;
+        return registry;
+    }
+
+    Counter& Registry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& family = families_[name];
+        family.help = help;
+        auto& slot = family.counters[labels];
+        if (!slot) slot = std::make_unique<Counter>();
+        return *slot;
+    }
+
+    Histogram& Registry::histogram(const std::string& name, const std::string& help, const std::string& labels) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& family = families_[name];
+        family.help = help;
+        family.histogram = true;
+        auto& slot = family.histograms[labels];
+        if (!slot) slot = std::make_unique<Histogram>();
+        return *slot;
+    }
+
+    std::string Registry::prometheus() {
+        std::ostringstream out;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [name, family] : families_) {
+            out << "# HELP " << name << " " << family.help << "\n"
+                << "# TYPE " << name << " " << (family.histogram ? "histogram" : "counter") << "\n";
+
+            for (const auto& [labels, counter] : family.counters) {
+                out << key(name, labels) << " " << counter->value() << "\n";
+            }
+            for (const auto& [labels, histogram] : family.histograms) {
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < Histogram::BUCKETS; i++) {
+                    cumulative += histogram->bucket(i);
+                    std::string le = "le=\"" + formatDouble(Histogram::upperBound(i)) + "\"";
+                    out << key(name + "_bucket", withLabel(labels, le)) << " " << cumulative << "\n";
+                }
+                out << key(name + "_bucket", withLabel(labels, "le=\"+Inf\"")) << " " << histogram->count() << "\n"
+                    << key(name + "_sum", labels) << " " << formatDouble(histogram->sum()) << "\n"
+                    << key(name + "_count", labels) << " " << histogram->count() << "\n";
+            }
+        }
+
+        out << "# HELP yarrharr_peak_rss_bytes Peak resident set size\n"
+            << "# TYPE yarrharr_peak_rss_bytes gauge\n"
+            << "yarrharr_peak_rss_bytes " << peakRss() << "\n";
+        return out.str();
+    }
+
+    nlohmann::json Registry::json() {
+        nlohmann::json counters = nlohmann::json::object();
+        nlohmann::json histograms = nlohmann::json::object();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [name, family] : families_) {
+            for (const auto& [labels, counter] : family.counters) {
+                counters[key(name, labels)] = counter->value();
+            }
+            for (const auto& [labels, histogram] : family.histograms) {
+                if (histogram->count() == 0) continue;
+                histograms[key(name, labels)] = {
+                    {"count", histogram->count()},
+                    {"sum", histogram->sum()},
+                    {"p50", histogram->quantile(0.5)},
+                    {"p90", histogram->quantile(0.9)},
+                    {"p99", histogram->quantile(0.99)}
+                };
+            }
+        }
+
+        return {
+            {"time", static_cast<int64_t>(std::time(nullptr))},
+            {"peak_rss_bytes", peakRss()},
+            {"counters", counters},
+            {"histograms", histograms}
+        };
+    }
+
+    void Registry::writeFile(const std::string& path) {
+        if (path.size() > 6 && path.compare(path.size() - 6, 6, ".jsonl") == 0) {
+            std::ofstream file(path, std::ios::app);
+            file << json().dump() << "\n";
+            return;
+        }
+
+        // Scrapers (node_exporter's textfile collector) must never see a
+        // half-written file
+        utils::writeFileAtomically(path, prometheus());
+    }
+
+    StageTimer::StageTimer(const std::string& stage)
+        : histogram_(Registry::instance().histogram("yarrharr_stage_seconds",
+                                                    "Time spent in each processing stage",
+                                                    "stage=\"" + stage + "\"")),
+          start_(std::chrono::steady_clock::now()) {}
+
+    StageTimer::~StageTimer() {
+        histogram_.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count());
+    }
+
+    void recordRequest(CURL* curl, const std::string& kind, CURLcode result) {
+        auto& registry = Registry::instance();
+        std::string kindLabel = "kind=\"" + kind + "\"";
+
+        registry.counter("yarrharr_http_requests_total", "HTTP requests by outcome",
+                         withLabel(kindLabel, result == CURLE_OK ? "result=\"ok\"" : "result=\"error\"")).add();
+        if (result != CURLE_OK) return;
+
+        curl_off_t dns = 0, connect = 0, tls = 0, pretransfer = 0, firstByte = 0, total = 0, bytes = 0;
+        long connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+        auto phase = [&](const char* name, curl_off_t micros) {
+            registry.histogram("yarrharr_http_phase_seconds", "Time spent in each phase of an HTTP request",
+                               withLabel(kindLabel, std::string("phase=\"") + name + "\"")).observe(micros / 1e6);
+        };
+
+        // Handshake phases only exist on fresh connections
+        if (connects > 0) {
+            phase("dns", dns);
+            phase("connect", connect - dns);
+            if (tls > 0) phase("tls", tls - connect);
+        }
+        phase("ttfb", firstByte - pretransfer);
+        phase("transfer", total - firstByte);
+        phase("total", total);
+
+        registry.counter("yarrharr_http_bytes_total", "Bytes received", kindLabel).add(bytes);
+        registry.counter("yarrharr_http_connections_total", "Connections used by HTTP requests",
+                         withLabel(kindLabel, connects > 0 ? "connection=\"new\"" : "connection=\"reused\"")).add();
+    }
+
+    size_t peakRss() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+
+    ScopedExport::~ScopedExport() {
+        if (path_.empty()) return;
+        try {
+            Registry::instance().writeFile(path_);
+        } catch (const std::exception&) {
+        }
+    }
+}
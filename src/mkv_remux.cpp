@@ -0,0 +1,986 @@
+#include "mkv_remux.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <sys/types.h>
+
+namespace {
+    constexpr uint32_t EBML_HEADER = 0x1A45DFA3;
+    constexpr uint32_t SEGMENT = 0x18538067;
+    constexpr uint32_t SEEK_HEAD = 0x114D9B74;
+    constexpr uint32_t INFO = 0x1549A966;
+    constexpr uint32_t TIMECODE_SCALE = 0x2AD7B1;
+    constexpr uint32_t DURATION = 0x4489;
+    constexpr uint32_t TRACKS = 0x1654AE6B;
+    constexpr uint32_t TRACK_ENTRY = 0xAE;
+    constexpr uint32_t TRACK_NUMBER = 0xD7;
+    constexpr uint32_t TRACK_TYPE = 0x83;
+    constexpr uint32_t CODEC_ID = 0x86;
+    constexpr uint32_t CODEC_PRIVATE = 0x63A2;
+    constexpr uint32_t DEFAULT_DURATION = 0x23E383;
+    constexpr uint32_t LANGUAGE = 0x22B59C;
+    constexpr uint32_t CONTENT_ENCODINGS = 0x6D80;
+    constexpr uint32_t VIDEO = 0xE0;
+    constexpr uint32_t PIXEL_WIDTH = 0xB0;
+    constexpr uint32_t PIXEL_HEIGHT = 0xBA;
+    constexpr uint32_t DISPLAY_WIDTH = 0x54B0;
+    constexpr uint32_t DISPLAY_HEIGHT = 0x54BA;
+    constexpr uint32_t AUDIO = 0xE1;
+    constexpr uint32_t SAMPLING_FREQUENCY = 0xB5;
+    constexpr uint32_t CHANNELS = 0x9F;
+    constexpr uint32_t CLUSTER = 0x1F43B675;
+    constexpr uint32_t TIMECODE = 0xE7;
+    constexpr uint32_t SIMPLE_BLOCK = 0xA3;
+    constexpr uint32_t BLOCK_GROUP = 0xA0;
+    constexpr uint32_t BLOCK = 0xA1;
+    constexpr uint32_t REFERENCE_BLOCK = 0xFB;
+    constexpr uint32_t CUES = 0x1C53BB6B;
+    constexpr uint32_t CHAPTERS = 0x1043A770;
+    constexpr uint32_t TAGS = 0x1254C367;
+    constexpr uint32_t ATTACHMENTS = 0x1941A469;
+
+    constexpr uint64_t UNKNOWN_SIZE = ~0ull;
+    constexpr uint64_t MAX_ELEMENT = 256ull << 20;
+    constexpr size_t MAX_PROBE = 16 << 20;
+
+    enum Kind { Ignored, Container, Value };
+
+    constexpr uint32_t MOVIE_TIMESCALE = 1000;
+    constexpr uint32_t VIDEO_TIMESCALE = 90000;
+    constexpr uint64_t FTYP_SIZE = 32;
+
+    bool isTopLevel(uint32_t id) {
+        switch (id) {
+            case EBML_HEADER: case SEGMENT: case SEEK_HEAD: case INFO: case TRACKS:
+            case CLUSTER: case CUES: case CHAPTERS: case TAGS: case ATTACHMENTS:
+                return true;
+        }
+        return false;
+    }
+
+    // EBML variable-length integers: the count of leading zero bits in the
+    // first byte gives the length. Returns 0 when more bytes are needed and
+    // -1 on an invalid marker.
+    int readVint(const uint8_t* p, size_t available, size_t maxLength, uint64_t& value, bool keepMarker) {
+        if (available == 0) return 0;
+        size_t length = 1;
+        while (length <= 8 && !(p[0] & (0x80 >> (length - 1)))) length++;
+        if (length > maxLength) return -1;
+        if (available < length) return 0;
+        value = keepMarker ? p[0] : p[0] & (0xFF >> length);
+        bool allOnes = value == (0xFFu >> length);
+        for (size_t i = 1; i < length; i++) {
+            value = (value << 8) | p[i];
+            allOnes = allOnes && p[i] == 0xFF;
+        }
+        if (!keepMarker && allOnes) value = UNKNOWN_SIZE;
+        return static_cast<int>(length);
+    }
+
+    uint64_t readUint(const uint8_t* p, size_t size) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size && i < 8; i++) value = (value << 8) | p[i];
+        return value;
+    }
+
+    double readFloat(const uint8_t* p, size_t size) {
+        uint64_t bits = readUint(p, size);
+        if (size == 4) {
+            uint32_t narrow = static_cast<uint32_t>(bits);
+            float value;
+            std::memcpy(&value, &narrow, sizeof(value));
+            return value;
+        }
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return size == 8 ? value : 0;
+    }
+
+    class Boxes {
+    public:
+        std::string out;
+
+        void u8(uint8_t v) { out.push_back(static_cast<char>(v)); }
+        void u16(uint16_t v) { u8(v >> 8); u8(v); }
+        void u24(uint32_t v) { u8(v >> 16); u16(v); }
+        void u32(uint32_t v) { u16(v >> 16); u16(v); }
+        void u64(uint64_t v) { u32(v >> 32); u32(v); }
+        void zeros(size_t n) { out.append(n, '\0'); }
+        void bytes(const std::string& data) { out += data; }
+        void type(const char* fourcc) { out.append(fourcc, 4); }
+
+        size_t begin(const char* fourcc) {
+            size_t at = out.size();
+            u32(0);
+            type(fourcc);
+            return at;
+        }
+
+        size_t beginFull(const char* fourcc, uint8_t version, uint32_t flags) {
+            size_t at = begin(fourcc);
+            u8(version);
+            u24(flags);
+            return at;
+        }
+
+        void end(size_t at) {
+            uint32_t size = static_cast<uint32_t>(out.size() - at);
+            for (int i = 0; i < 4; i++) out[at + i] = static_cast<char>(size >> (24 - 8 * i));
+        }
+
+        void matrix() {
+            const uint32_t unity[9] = {0x10000, 0, 0, 0, 0x10000, 0, 0, 0, 0x40000000};
+            for (uint32_t v : unity) u32(v);
+        }
+
+        // MPEG-4 descriptors, with the four-byte length form
+        void descriptor(uint8_t tag, const std::string& body) {
+            u8(tag);
+            for (int shift = 21; shift > 0; shift -= 7) u8(0x80 | ((body.size() >> shift) & 0x7F));
+            u8(body.size() & 0x7F);
+            bytes(body);
+        }
+
+        void ftyp() {
+            u32(FTYP_SIZE);
+            type("ftyp");
+            type("isom");
+            u32(0x200);
+            for (const char* brand : {"isom", "iso2", "avc1", "mp41"}) type(brand);
+        }
+    };
+
+    uint16_t packLanguage(const std::string& language) {
+        if (language.size() != 3 || !std::all_of(language.begin(), language.end(), [](char c) { return c >= 'a' && c <= 'z'; })) {
+            return packLanguage("und");
+        }
+        return static_cast<uint16_t>(((language[0] - 0x60) << 10) | ((language[1] - 0x60) << 5) | (language[2] - 0x60));
+    }
+
+    // AC3SpecificBox payload from the first frame's syncinfo and bsi
+    std::string dac3(const std::string& frame) {
+        if (frame.size() < 8) return std::string(3, '\0');
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(frame.data());
+        size_t bit = 32;
+        auto bits = [&](int n) {
+            uint32_t v = 0;
+            for (int i = 0; i < n; i++, bit++) v = (v << 1) | ((p[bit / 8] >> (7 - bit % 8)) & 1);
+            return v;
+        };
+        uint32_t fscod = bits(2), frmsizecod = bits(6), bsid = bits(5), bsmod = bits(3), acmod = bits(3);
+        if ((acmod & 1) && acmod != 1) bits(2);
+        if (acmod & 4) bits(2);
+        if (acmod == 2) bits(2);
+        uint32_t lfeon = bits(1);
+        uint32_t packed = (fscod << 22) | (bsid << 17) | (bsmod << 14) | (acmod << 11) | (lfeon << 10) | ((frmsizecod >> 1) << 5);
+        return {static_cast<char>(packed >> 16), static_cast<char>(packed >> 8), static_cast<char>(packed)};
+    }
+}
+
+MkvToMp4::MkvToMp4(const std::string& output_path) : output_path_(output_path) {}
+
+MkvToMp4::~MkvToMp4() {
+    if (file_) {
+        fclose(file_);
+    }
+    if (state_ == State::Remuxing && !finished_) {
+        std::remove(output_path_.c_str());
+        std::remove((output_path_ + ".moov").c_str());
+    }
+}
+
+void MkvToMp4::write(const void* data, size_t length) {
+    if (state_ == State::Unsupported || finished_) {
+        return;
+    }
+    const char* p = static_cast<const char*>(data);
+    if (state_ == State::Probing) {
+        probed_.append(p, length);
+    }
+
+    if (skip_ > 0) {
+        size_t skipped = static_cast<size_t>(std::min<uint64_t>(skip_, length));
+        skip_ -= skipped;
+        position_ += skipped;
+        p += skipped;
+        length -= skipped;
+    }
+    buffer_.append(p, length);
+    parse();
+
+    if (state_ == State::Probing && probed_.size() > MAX_PROBE) {
+        state_ = State::Unsupported;
+        reason_ = "no track headers in the first " + std::to_string(MAX_PROBE >> 20) + " MiB";
+    }
+}
+
+int MkvToMp4::classify(uint32_t id) const {
+    uint32_t parent = stack_.empty() ? 0 : stack_.back().id;
+    switch (parent) {
+        case 0:
+            return id == SEGMENT ? Container : Ignored;
+        case SEGMENT:
+            if (id == TRACKS) return state_ == State::Probing ? Container : Ignored;
+            return id == INFO || id == CLUSTER ? Container : Ignored;
+        case INFO:
+            return id == TIMECODE_SCALE || id == DURATION ? Value : Ignored;
+        case TRACKS:
+            return id == TRACK_ENTRY ? Container : Ignored;
+        case TRACK_ENTRY:
+            if (id == VIDEO || id == AUDIO) return Container;
+            switch (id) {
+                case TRACK_NUMBER: case TRACK_TYPE: case CODEC_ID: case CODEC_PRIVATE:
+                case DEFAULT_DURATION: case LANGUAGE: case CONTENT_ENCODINGS:
+                    return Value;
+            }
+            return Ignored;
+        case VIDEO:
+            return id == PIXEL_WIDTH || id == PIXEL_HEIGHT || id == DISPLAY_WIDTH || id == DISPLAY_HEIGHT ? Value : Ignored;
+        case AUDIO:
+            return id == SAMPLING_FREQUENCY || id == CHANNELS ? Value : Ignored;
+        case CLUSTER:
+            if (id == BLOCK_GROUP) return Container;
+            return id == TIMECODE || id == SIMPLE_BLOCK ? Value : Ignored;
+        case BLOCK_GROUP:
+            return id == BLOCK || id == REFERENCE_BLOCK ? Value : Ignored;
+    }
+    return Ignored;
+}
+
+void MkvToMp4::parse() {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(buffer_.data());
+    size_t offset = 0;
+
+    auto fail = [&](const std::string& message) {
+        if (state_ == State::Probing) {
+            state_ = State::Unsupported;
+            reason_ = message;
+            return;
+        }
+        throw RemuxError(message);
+    };
+
+    while (state_ != State::Unsupported) {
+        uint64_t here = position_ + offset;
+        while (!stack_.empty() && stack_.back().end != UNKNOWN_SIZE && here >= stack_.back().end) {
+            uint32_t id = stack_.back().id;
+            stack_.pop_back();
+            closeMaster(id);
+        }
+        if (state_ == State::Unsupported) break;
+
+        uint64_t id = 0, size = 0;
+        size_t available = buffer_.size() - offset;
+        int idLength = readVint(data + offset, available, 4, id, true);
+        if (idLength == 0) break;
+        if (idLength < 0) {
+            fail("invalid element at offset " + std::to_string(here));
+            break;
+        }
+        if (here == 0 && id != EBML_HEADER) {
+            fail("not a Matroska stream");
+            break;
+        }
+        int sizeLength = readVint(data + offset + idLength, available - idLength, 8, size, false);
+        if (sizeLength == 0) break;
+        if (sizeLength < 0) {
+            fail("invalid element size at offset " + std::to_string(here));
+            break;
+        }
+        size_t header = idLength + sizeLength;
+
+        // Live-muxed files leave clusters (and the segment) open-ended;
+        // they end where an element that cannot be their child starts
+        uint32_t elementId = static_cast<uint32_t>(id);
+        bool closed = false;
+        while (!stack_.empty() && stack_.back().end == UNKNOWN_SIZE &&
+               (stack_.back().id == SEGMENT ? elementId == SEGMENT || elementId == EBML_HEADER : isTopLevel(elementId))) {
+            uint32_t open = stack_.back().id;
+            stack_.pop_back();
+            closeMaster(open);
+            closed = true;
+        }
+        if (closed) continue;
+
+        int kind = classify(elementId);
+        if (kind == Container) {
+            offset += header;
+            stack_.push_back({elementId, size == UNKNOWN_SIZE ? UNKNOWN_SIZE : here + header + size});
+            openMaster(elementId);
+            continue;
+        }
+        if (size == UNKNOWN_SIZE) {
+            fail("unknown size on a non-master element");
+            break;
+        }
+        if (kind == Value) {
+            if (size > MAX_ELEMENT) {
+                fail("element of " + std::to_string(size) + " bytes");
+                break;
+            }
+            if (available - header < size) break;
+            element(elementId, data + offset + header, static_cast<size_t>(size));
+            offset += header + size;
+            continue;
+        }
+
+        offset += header;
+        if (size <= buffer_.size() - offset) {
+            offset += size;
+        } else {
+            skip_ = size - (buffer_.size() - offset);
+            offset = buffer_.size();
+            break;
+        }
+    }
+
+    buffer_.erase(0, offset);
+    position_ += offset;
+}
+
+void MkvToMp4::openMaster(uint32_t id) {
+    switch (id) {
+        case TRACK_ENTRY:
+            tracks_.emplace_back();
+            break;
+        case CLUSTER:
+            cluster_time_ = 0;
+            if (state_ == State::Probing) {
+                decide();
+            }
+            break;
+        case BLOCK_GROUP:
+            group_block_.clear();
+            group_referenced_ = false;
+            break;
+    }
+}
+
+void MkvToMp4::closeMaster(uint32_t id) {
+    if (id == TRACKS && state_ == State::Probing) {
+        decide();
+    } else if (id == BLOCK_GROUP && !group_block_.empty()) {
+        block(reinterpret_cast<const uint8_t*>(group_block_.data()), group_block_.size(), false, !group_referenced_);
+        group_block_.clear();
+    }
+}
+
+void MkvToMp4::element(uint32_t id, const uint8_t* data, size_t size) {
+    switch (id) {
+        case TIMECODE_SCALE:
+            timecode_scale_ = std::max<uint64_t>(1, readUint(data, size));
+            break;
+        case DURATION:
+            duration_ = readFloat(data, size);
+            break;
+        case TIMECODE:
+            cluster_time_ = static_cast<int64_t>(readUint(data, size));
+            break;
+        case SIMPLE_BLOCK:
+            block(data, size, true, false);
+            break;
+        case BLOCK:
+            group_block_.assign(reinterpret_cast<const char*>(data), size);
+            break;
+        case REFERENCE_BLOCK:
+            group_referenced_ = true;
+            break;
+    }
+    if (tracks_.empty() || stack_.empty() || stack_.back().id == CLUSTER || stack_.back().id == BLOCK_GROUP) {
+        return;
+    }
+    Track* track = &tracks_.back();
+    std::string text(reinterpret_cast<const char*>(data), size);
+    switch (id) {
+        case TRACK_NUMBER: track->number = readUint(data, size); break;
+        case TRACK_TYPE: track->type = readUint(data, size); break;
+        case CODEC_ID: track->codec_id = text.c_str(); break;
+        case CODEC_PRIVATE: track->codec_private = text; break;
+        case DEFAULT_DURATION: track->default_duration = readUint(data, size); break;
+        case LANGUAGE: track->language = text.c_str(); break;
+        case CONTENT_ENCODINGS: track->encoded = true; break;
+        case PIXEL_WIDTH: track->width = readUint(data, size); break;
+        case PIXEL_HEIGHT: track->height = readUint(data, size); break;
+        case DISPLAY_WIDTH: track->display_width = readUint(data, size); break;
+        case DISPLAY_HEIGHT: track->display_height = readUint(data, size); break;
+        case SAMPLING_FREQUENCY: track->sample_rate = readFloat(data, size); break;
+        case CHANNELS: track->channels = readUint(data, size); break;
+    }
+}
+
+void MkvToMp4::decide() {
+    auto unsupported = [&](const std::string& reason) {
+        state_ = State::Unsupported;
+        reason_ = reason;
+    };
+
+    size_t kept = 0;
+    double seconds = duration_ * static_cast<double>(timecode_scale_) / 1e9;
+    double samples = 0;
+    for (auto& track : tracks_) {
+        if (track.type == 1) {
+            if (track.codec_id == "V_MPEG4/ISO/AVC") track.codec = Codec::Avc;
+            else if (track.codec_id == "V_MPEGH/ISO/HEVC") track.codec = Codec::Hevc;
+            else return unsupported("video codec " + track.codec_id);
+            if (track.codec_private.empty() || track.width == 0 || track.height == 0) {
+                return unsupported(track.codec_id + " track without decoder configuration");
+            }
+            samples += seconds * (track.default_duration ? 1e9 / track.default_duration : 60) * 2;
+        } else if (track.type == 2) {
+            if (track.codec_id.rfind("A_AAC", 0) == 0 && !track.codec_private.empty()) track.codec = Codec::Aac;
+            else if (track.codec_id == "A_AC3") track.codec = Codec::Ac3;
+            else return unsupported("audio codec " + track.codec_id);
+            double rate = track.sample_rate > 0 ? track.sample_rate : 48000;
+            samples += seconds * rate / (track.codec == Codec::Aac ? 1024 : 1536);
+        } else {
+            // Subtitles and the rest have no MP4 mapping here
+            continue;
+        }
+        if (track.encoded) {
+            return unsupported("compressed track " + std::to_string(track.number));
+        }
+        kept++;
+    }
+    if (kept == 0) {
+        return unsupported(tracks_.empty() ? "no track headers before the first cluster" : "no audio or video tracks");
+    }
+
+    file_ = fopen(output_path_.c_str(), "wb+");
+    if (!file_) {
+        throw RemuxError("Cannot create " + output_path_ + ": " + std::strerror(errno));
+    }
+    state_ = State::Remuxing;
+    probed_.clear();
+    probed_.shrink_to_fit();
+
+    // Room for the moov in front of the samples, from ~24 bytes of tables
+    // per sample; files without a duration, or that outgrow it, are
+    // rewritten once at the end instead. The gap stays a sparse hole.
+    reserve_ = std::max<uint64_t>(4096, static_cast<uint64_t>(samples * 24 * 1.1) + 16384 * kept);
+
+    Boxes head;
+    head.ftyp();
+    writeAt(0, head.out);
+
+    data_start_ = FTYP_SIZE + reserve_ + 16;
+    data_end_ = data_start_;
+    Boxes mdat;
+    mdat.u32(1);
+    mdat.type("mdat");
+    mdat.u64(0);
+    writeAt(data_start_ - 16, mdat.out);
+}
+
+void MkvToMp4::block(const uint8_t* data, size_t size, bool simple, bool keyframe) {
+    if (state_ != State::Remuxing) {
+        return;
+    }
+    uint64_t number = 0;
+    int numberLength = readVint(data, size, 8, number, false);
+    if (numberLength <= 0 || size < static_cast<size_t>(numberLength) + 3) {
+        throw RemuxError("truncated block");
+    }
+    auto track = std::find_if(tracks_.begin(), tracks_.end(), [&](const Track& t) { return t.number == number; });
+    if (track == tracks_.end() || track->codec == Codec::None) {
+        return;
+    }
+
+    const uint8_t* p = data + numberLength;
+    int16_t relative = static_cast<int16_t>((p[0] << 8) | p[1]);
+    uint8_t flags = p[2];
+    p += 3;
+    size_t remaining = size - numberLength - 3;
+    if (simple) {
+        keyframe = flags & 0x80;
+    }
+
+    std::vector<size_t> frames;
+    int lacing = (flags >> 1) & 3;
+    if (lacing == 0) {
+        frames.push_back(remaining);
+    } else {
+        if (remaining < 1) throw RemuxError("truncated lace");
+        size_t count = p[0] + 1;
+        p++;
+        remaining--;
+        size_t laced = 0;
+        if (lacing == 1) {
+            for (size_t i = 0; i + 1 < count; i++) {
+                size_t frame = 0;
+                uint8_t byte;
+                do {
+                    if (remaining == 0) throw RemuxError("truncated lace");
+                    byte = *p++;
+                    remaining--;
+                    frame += byte;
+                } while (byte == 255);
+                frames.push_back(frame);
+                laced += frame;
+            }
+        } else if (lacing == 3) {
+            int64_t frame = 0;
+            for (size_t i = 0; i + 1 < count; i++) {
+                uint64_t value = 0;
+                int length = readVint(p, remaining, 8, value, false);
+                if (length <= 0) throw RemuxError("truncated lace");
+                if (i == 0) {
+                    frame = static_cast<int64_t>(value);
+                } else {
+                    frame += static_cast<int64_t>(value) - ((int64_t(1) << (7 * length - 1)) - 1);
+                }
+                if (frame < 0) throw RemuxError("invalid lace");
+                p += length;
+                remaining -= length;
+                frames.push_back(static_cast<size_t>(frame));
+                laced += frame;
+            }
+        } else {
+            frames.assign(count - 1, remaining / count);
+            laced = (count - 1) * (remaining / count);
+        }
+        if (laced > remaining) throw RemuxError("invalid lace");
+        frames.push_back(remaining - laced);
+    }
+
+    int64_t pts = cluster_time_ + relative;
+    for (size_t frame : frames) {
+        addSample(*track, pts, keyframe, p, frame);
+        p += frame;
+    }
+}
+
+void MkvToMp4::addSample(Track& track, int64_t pts, bool keyframe, const uint8_t* data, size_t size) {
+    if (fwrite(data, 1, size, file_) != size) {
+        throw RemuxError("Write to " + output_path_ + " failed: " + std::strerror(errno));
+    }
+
+    if (track.sizes.empty()) {
+        track.first_pts = pts;
+        if (track.codec == Codec::Ac3) {
+            track.ac3_header.assign(reinterpret_cast<const char*>(data), std::min<size_t>(size, 16));
+        }
+    }
+    if (last_track_ == &track) {
+        track.chunk_samples.back()++;
+    } else {
+        track.chunk_offsets.push_back(data_end_);
+        track.chunk_samples.push_back(1);
+        last_track_ = &track;
+    }
+    track.sizes.push_back(static_cast<uint32_t>(size));
+    if (track.type == 1) {
+        track.pts.push_back(pts);
+        if (keyframe) {
+            track.sync.push_back(static_cast<uint32_t>(track.sizes.size()));
+        }
+    }
+    data_end_ += size;
+}
+
+void MkvToMp4::writeAt(uint64_t offset, const std::string& data) {
+    if (fseeko(file_, static_cast<off_t>(offset), SEEK_SET) != 0 || fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+        throw RemuxError("Write to " + output_path_ + " failed: " + std::strerror(errno));
+    }
+}
+
+std::string MkvToMp4::buildMoov(int64_t shift, bool co64) {
+    auto nanoseconds = [&](int64_t ticks) { return static_cast<long double>(ticks) * timecode_scale_; };
+    auto scaled = [](long double ns, uint32_t timescale) { return static_cast<int64_t>(std::llround(ns * timescale / 1e9L)); };
+
+    int64_t origin = INT64_MAX;
+    for (const auto& track : tracks_) {
+        if (track.sizes.empty()) continue;
+        int64_t start = track.type == 1 ? *std::min_element(track.pts.begin(), track.pts.end()) : track.first_pts;
+        origin = std::min(origin, start);
+    }
+
+    Boxes b;
+    size_t moov = b.begin("moov");
+    size_t mvhdAt = b.out.size();
+    {
+        size_t box = b.beginFull("mvhd", 0, 0);
+        b.u32(0);
+        b.u32(0);
+        b.u32(MOVIE_TIMESCALE);
+        b.u32(0);  // duration, patched below
+        b.u32(0x10000);
+        b.u16(0x100);
+        b.zeros(10);
+        b.matrix();
+        b.zeros(24);
+        b.u32(0);  // next_track_ID, patched below
+        b.end(box);
+    }
+
+    uint32_t trackId = 0;
+    uint64_t movieDuration = 0;
+    for (const auto& track : tracks_) {
+        if (track.codec == Codec::None || track.sizes.empty()) continue;
+        trackId++;
+        bool video = track.type == 1;
+        size_t count = track.sizes.size();
+
+        uint32_t timescale;
+        std::vector<uint32_t> durations(count);
+        std::vector<uint32_t> offsets;
+        int64_t start, mediaTime = 0;
+        if (video) {
+            // Matroska stores presentation times in decode order; decode
+            // times are the sorted presentation times, shifted back far
+            // enough that no frame is shown before it is decoded
+            timescale = VIDEO_TIMESCALE;
+            std::vector<int64_t> pts(count);
+            for (size_t i = 0; i < count; i++) pts[i] = scaled(nanoseconds(track.pts[i]), timescale);
+            std::vector<int64_t> sorted = pts;
+            std::sort(sorted.begin(), sorted.end());
+            int64_t delay = 0;
+            for (size_t i = 0; i < count; i++) delay = std::max(delay, sorted[i] - pts[i]);
+
+            int64_t fallback = track.default_duration ? scaled(track.default_duration, timescale) : timescale / 25;
+            for (size_t i = 0; i + 1 < count; i++) {
+                durations[i] = static_cast<uint32_t>(sorted[i + 1] - sorted[i]);
+            }
+            durations[count - 1] = static_cast<uint32_t>(std::max<int64_t>(1, fallback));
+            if (pts != sorted) {
+                offsets.resize(count);
+                for (size_t i = 0; i < count; i++) offsets[i] = static_cast<uint32_t>(pts[i] - (sorted[i] - delay));
+            }
+            start = sorted[0] - scaled(nanoseconds(origin), timescale);
+            start = scaled(static_cast<long double>(start) * 1e9L / timescale, MOVIE_TIMESCALE);
+            mediaTime = delay;
+        } else {
+            timescale = static_cast<uint32_t>(std::lround(track.sample_rate));
+            if (timescale == 0 && track.codec == Codec::Ac3 && track.ac3_header.size() >= 5) {
+                const uint32_t rates[] = {48000, 44100, 32000, 48000};
+                timescale = rates[static_cast<uint8_t>(track.ac3_header[4]) >> 6];
+            }
+            if (timescale == 0) timescale = 48000;
+            std::fill(durations.begin(), durations.end(), track.codec == Codec::Aac ? 1024 : 1536);
+            start = scaled(nanoseconds(track.first_pts - origin), MOVIE_TIMESCALE);
+        }
+
+        uint64_t mediaDuration = std::accumulate(durations.begin(), durations.end(), uint64_t(0));
+        uint64_t presented = static_cast<uint64_t>(std::llround(static_cast<long double>(mediaDuration) * MOVIE_TIMESCALE / timescale));
+        uint64_t trackDuration = presented + static_cast<uint64_t>(std::max<int64_t>(0, start));
+        movieDuration = std::max(movieDuration, trackDuration);
+
+        uint64_t width = 0, height = 0;
+        uint32_t hSpacing = 1, vSpacing = 1;
+        if (video) {
+            width = track.width;
+            height = track.height;
+            if (track.display_width && track.display_height && track.display_width * track.height != track.display_height * track.width) {
+                uint64_t h = track.display_width * track.height, v = track.display_height * track.width;
+                uint64_t divisor = std::gcd(h, v);
+                hSpacing = static_cast<uint32_t>(h / divisor);
+                vSpacing = static_cast<uint32_t>(v / divisor);
+                width = track.width * hSpacing / vSpacing;
+            }
+        }
+
+        size_t trak = b.begin("trak");
+        {
+            size_t box = b.beginFull("tkhd", 0, 3);
+            b.u32(0);
+            b.u32(0);
+            b.u32(trackId);
+            b.u32(0);
+            b.u32(static_cast<uint32_t>(trackDuration));
+            b.zeros(8);
+            b.u16(0);
+            b.u16(video ? 0 : 1);
+            b.u16(video ? 0 : 0x100);
+            b.u16(0);
+            b.matrix();
+            b.u32(static_cast<uint32_t>(width << 16));
+            b.u32(static_cast<uint32_t>(height << 16));
+            b.end(box);
+        }
+        if (start > 0 || mediaTime != 0) {
+            size_t edts = b.begin("edts");
+            size_t elst = b.beginFull("elst", 0, 0);
+            b.u32(start > 0 ? 2 : 1);
+            if (start > 0) {
+                b.u32(static_cast<uint32_t>(start));
+                b.u32(0xFFFFFFFF);
+                b.u32(0x10000);
+            }
+            b.u32(static_cast<uint32_t>(presented));
+            b.u32(static_cast<uint32_t>(mediaTime));
+            b.u32(0x10000);
+            b.end(elst);
+            b.end(edts);
+        }
+
+        size_t mdia = b.begin("mdia");
+        {
+            size_t box = b.beginFull("mdhd", 0, 0);
+            b.u32(0);
+            b.u32(0);
+            b.u32(timescale);
+            b.u32(static_cast<uint32_t>(mediaDuration));
+            b.u16(packLanguage(track.language));
+            b.u16(0);
+            b.end(box);
+
+            box = b.beginFull("hdlr", 0, 0);
+            b.u32(0);
+            b.type(video ? "vide" : "soun");
+            b.zeros(12);
+            std::string name = video ? "VideoHandler" : "SoundHandler";
+            b.out.append(name.c_str(), name.size() + 1);
+            b.end(box);
+        }
+
+        size_t minf = b.begin("minf");
+        if (video) {
+            size_t box = b.beginFull("vmhd", 0, 1);
+            b.zeros(8);
+            b.end(box);
+        } else {
+            size_t box = b.beginFull("smhd", 0, 0);
+            b.zeros(4);
+            b.end(box);
+        }
+        {
+            size_t dinf = b.begin("dinf");
+            size_t dref = b.beginFull("dref", 0, 0);
+            b.u32(1);
+            size_t url = b.beginFull("url ", 0, 1);
+            b.end(url);
+            b.end(dref);
+            b.end(dinf);
+        }
+
+        size_t stbl = b.begin("stbl");
+        {
+            size_t stsd = b.beginFull("stsd", 0, 0);
+            b.u32(1);
+            if (video) {
+                bool hevc = track.codec == Codec::Hevc;
+                size_t entry = b.begin(hevc ? "hvc1" : "avc1");
+                b.zeros(6);
+                b.u16(1);
+                b.zeros(16);
+                b.u16(static_cast<uint16_t>(track.width));
+                b.u16(static_cast<uint16_t>(track.height));
+                b.u32(0x00480000);
+                b.u32(0x00480000);
+                b.u32(0);
+                b.u16(1);
+                b.zeros(32);
+                b.u16(0x18);
+                b.u16(0xFFFF);
+                size_t config = b.begin(hevc ? "hvcC" : "avcC");
+                b.bytes(track.codec_private);
+                b.end(config);
+                if (hSpacing != vSpacing) {
+                    size_t pasp = b.begin("pasp");
+                    b.u32(hSpacing);
+                    b.u32(vSpacing);
+                    b.end(pasp);
+                }
+                b.end(entry);
+            } else {
+                bool aac = track.codec == Codec::Aac;
+                size_t entry = b.begin(aac ? "mp4a" : "ac-3");
+                b.zeros(6);
+                b.u16(1);
+                b.zeros(8);
+                b.u16(static_cast<uint16_t>(track.channels ? track.channels : 2));
+                b.u16(16);
+                b.zeros(4);
+                b.u32(timescale <= 0xFFFF ? timescale << 16 : 0);
+                if (aac) {
+                    Boxes config, es;
+                    config.u8(0x40);          // MPEG-4 audio
+                    config.u8(0x15);          // audio stream
+                    config.u24(0);
+                    config.u32(0);
+                    config.u32(0);
+                    config.descriptor(0x05, track.codec_private);
+                    Boxes sl;
+                    sl.u8(0x02);
+                    es.u16(static_cast<uint16_t>(trackId));
+                    es.u8(0);
+                    es.descriptor(0x04, config.out);
+                    es.descriptor(0x06, sl.out);
+
+                    size_t esds = b.beginFull("esds", 0, 0);
+                    b.descriptor(0x03, es.out);
+                    b.end(esds);
+                } else {
+                    size_t box = b.begin("dac3");
+                    b.bytes(dac3(track.ac3_header));
+                    b.end(box);
+                }
+                b.end(entry);
+            }
+            b.end(stsd);
+
+            std::vector<std::pair<uint32_t, uint32_t>> runs;
+            for (uint32_t d : durations) {
+                if (!runs.empty() && runs.back().second == d) runs.back().first++;
+                else runs.push_back({1, d});
+            }
+            size_t box = b.beginFull("stts", 0, 0);
+            b.u32(static_cast<uint32_t>(runs.size()));
+            for (const auto& [n, d] : runs) {
+                b.u32(n);
+                b.u32(d);
+            }
+            b.end(box);
+
+            if (!offsets.empty()) {
+                runs.clear();
+                for (uint32_t o : offsets) {
+                    if (!runs.empty() && runs.back().second == o) runs.back().first++;
+                    else runs.push_back({1, o});
+                }
+                box = b.beginFull("ctts", 0, 0);
+                b.u32(static_cast<uint32_t>(runs.size()));
+                for (const auto& [n, o] : runs) {
+                    b.u32(n);
+                    b.u32(o);
+                }
+                b.end(box);
+            }
+
+            if (video && track.sync.size() != count) {
+                box = b.beginFull("stss", 0, 0);
+                b.u32(static_cast<uint32_t>(track.sync.size()));
+                for (uint32_t s : track.sync) b.u32(s);
+                b.end(box);
+            }
+
+            box = b.beginFull("stsc", 0, 0);
+            size_t entries = b.out.size();
+            b.u32(0);
+            uint32_t stscCount = 0;
+            for (size_t i = 0; i < track.chunk_samples.size(); i++) {
+                if (i == 0 || track.chunk_samples[i] != track.chunk_samples[i - 1]) {
+                    b.u32(static_cast<uint32_t>(i + 1));
+                    b.u32(track.chunk_samples[i]);
+                    b.u32(1);
+                    stscCount++;
+                }
+            }
+            for (int i = 0; i < 4; i++) b.out[entries + i] = static_cast<char>(stscCount >> (24 - 8 * i));
+            b.end(box);
+
+            box = b.beginFull("stsz", 0, 0);
+            b.u32(0);
+            b.u32(static_cast<uint32_t>(count));
+            for (uint32_t size : track.sizes) b.u32(size);
+            b.end(box);
+
+            box = b.beginFull(co64 ? "co64" : "stco", 0, 0);
+            b.u32(static_cast<uint32_t>(track.chunk_offsets.size()));
+            for (uint64_t offset : track.chunk_offsets) {
+                if (co64) b.u64(offset + shift);
+                else b.u32(static_cast<uint32_t>(offset + shift));
+            }
+            b.end(box);
+        }
+        b.end(stbl);
+        b.end(minf);
+        b.end(mdia);
+        b.end(trak);
+    }
+    if (trackId == 0) {
+        throw RemuxError("no frames in the stream");
+    }
+
+    Boxes patch;
+    patch.u32(static_cast<uint32_t>(movieDuration));
+    b.out.replace(mvhdAt + 24, 4, patch.out);
+    patch.out.clear();
+    patch.u32(trackId + 1);
+    b.out.replace(mvhdAt + 104, 4, patch.out);
+    b.end(moov);
+    return b.out;
+}
+
+void MkvToMp4::finish() {
+    if (state_ == State::Probing) {
+        state_ = State::Unsupported;
+        reason_ = "stream ended before the track headers";
+        return;
+    }
+    if (state_ != State::Remuxing || finished_) {
+        return;
+    }
+    if (skip_ > 0 || !buffer_.empty()) {
+        throw RemuxError("stream truncated");
+    }
+    while (!stack_.empty()) {
+        uint32_t id = stack_.back().id;
+        stack_.pop_back();
+        closeMaster(id);
+    }
+
+    Boxes size;
+    size.u64(data_end_ - (data_start_ - 16));
+    writeAt(data_start_ - 8, size.out);
+
+    std::string moov = buildMoov(0, data_end_ > UINT32_MAX);
+    if (moov.size() == reserve_ || moov.size() + 8 <= reserve_) {
+        if (moov.size() < reserve_) {
+            Boxes free;
+            free.u32(static_cast<uint32_t>(reserve_ - moov.size()));
+            free.type("free");
+            moov += free.out;
+        }
+        writeAt(FTYP_SIZE, moov);
+        if (fclose(file_) != 0) {
+            file_ = nullptr;
+            throw RemuxError("Write to " + output_path_ + " failed: " + std::strerror(errno));
+        }
+        file_ = nullptr;
+        finished_ = true;
+        return;
+    }
+
+    // The tables outgrew the reserved space: copy the samples behind a
+    // full-size moov once, with chunk offsets moved to match
+    int64_t shift = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        shift = static_cast<int64_t>(FTYP_SIZE + moov.size() + 16) - static_cast<int64_t>(data_start_);
+        bool co64 = data_end_ + shift > UINT32_MAX;
+        std::string rebuilt = buildMoov(shift, co64);
+        bool settled = rebuilt.size() == moov.size();
+        moov = std::move(rebuilt);
+        if (settled) break;
+    }
+
+    std::string tempPath = output_path_ + ".moov";
+    FILE* out = fopen(tempPath.c_str(), "wb");
+    if (!out) {
+        throw RemuxError("Cannot create " + tempPath + ": " + std::strerror(errno));
+    }
+    Boxes head;
+    head.ftyp();
+    head.bytes(moov);
+    head.u32(1);
+    head.type("mdat");
+    head.u64(data_end_ - (data_start_ - 16));
+
+    bool ok = fwrite(head.out.data(), 1, head.out.size(), out) == head.out.size() &&
+              fseeko(file_, static_cast<off_t>(data_start_), SEEK_SET) == 0;
+    std::vector<char> chunk(1 << 20);
+    for (uint64_t left = data_end_ - data_start_; ok && left > 0;) {
+        size_t n = fread(chunk.data(), 1, static_cast<size_t>(std::min<uint64_t>(left, chunk.size())), file_);
+        ok = n > 0 && fwrite(chunk.data(), 1, n, out) == n;
+        left -= n;
+    }
+    ok = fclose(out) == 0 && ok;
+    fclose(file_);
+    file_ = nullptr;
+    if (!ok || std::rename(tempPath.c_str(), output_path_.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        throw RemuxError("Rewriting " + output_path_ + " failed: " + std::strerror(errno));
+    }
+    finished_ = true;
+}
@@ -0,0 +1,184 @@
+#include "mover.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+    const size_t CHUNK_BYTES = 8 * 1024 * 1024;
+
+    enum class Method { CopyFileRange, Sendfile, ReadWrite };
+
+    // One chunk from `in` to `out` at their current offsets; 0 at end of
+    // file. Moves to the next method when the kernel rejects one for this
+    // pair of filesystems, which it does on the first call.
+    ssize_t copyChunk(int in, int out, size_t length, Method& method) {
+#ifdef __linux__
+        if (method == Method::CopyFileRange) {
+            ssize_t n = copy_file_range(in, nullptr, out, nullptr, length, 0);
+            if (n >= 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)) {
+                return n;
+            }
+            method = Method::Sendfile;
+        }
+        if (method == Method::Sendfile) {
+            ssize_t n = sendfile(out, in, nullptr, length);
+            if (n >= 0 || (errno != ENOSYS && errno != EINVAL)) {
+                return n;
+            }
+            method = Method::ReadWrite;
+        }
+#endif
+        static thread_local std::vector<char> buffer(CHUNK_BYTES);
+        ssize_t n = read(in, buffer.data(), std::min(length, buffer.size()));
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = write(out, buffer.data() + written, n - written);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            written += w;
+        }
+        return n;
+    }
+
+    std::string systemError(const std::string& what) {
+        return what + ": " + std::strerror(errno);
+    }
+
+    void copyAcross(const std::string& from, const std::string& to, uint64_t bytes_per_second) {
+        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            throw std::runtime_error(systemError("Failed to open " + from));
+        }
+        struct stat st;
+        fstat(in, &st);
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        std::string temp = to + ".moving";
+        int out = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+        if (out < 0) {
+            close(in);
+            throw std::runtime_error(systemError("Failed to create " + temp));
+        }
+
+        // Smaller chunks under a cap so the pacing stays smooth
+        size_t chunk = CHUNK_BYTES;
+        if (bytes_per_second > 0) {
+            chunk = std::clamp<size_t>(bytes_per_second / 8, 64 * 1024, CHUNK_BYTES);
+        }
+
+        Method method = Method::CopyFileRange;
+        uint64_t copied = 0;
+        auto started = std::chrono::steady_clock::now();
+        std::string error;
+        while (true) {
+            ssize_t n = copyChunk(in, out, chunk, method);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                error = systemError("Failed to copy to " + temp);
+                break;
+            }
+            if (n == 0) break;
+            copied += n;
+            if (bytes_per_second > 0) {
+                std::this_thread::sleep_until(started + std::chrono::duration<double>(
+                                                            static_cast<double>(copied) / bytes_per_second));
+            }
+        }
+        if (error.empty() && copied != static_cast<uint64_t>(st.st_size)) {
+            error = "Failed to copy to " + temp + ": source changed during the move";
+        }
+
+        // Durable before the staged copy goes away; keeps the mtime so the
+        // content store still recognises the file
+        if (error.empty() && fsync(out) != 0) {
+            error = systemError("Failed to sync " + temp);
+        }
+        struct timespec times[2] = {utils::accessTime(st), utils::modifyTime(st)};
+        futimens(out, times);
+        close(in);
+        if (close(out) != 0 && error.empty()) {
+            error = systemError("Failed to write " + temp);
+        }
+        if (error.empty() && rename(temp.c_str(), to.c_str()) != 0) {
+            error = systemError("Failed to rename " + temp);
+        }
+        if (!error.empty()) {
+            unlink(temp.c_str());
+            throw std::runtime_error(error);
+        }
+        unlink(from.c_str());
+
+        auto& registry = metrics::Registry::instance();
+        registry.counter("yarrharr_mover_copied_bytes_total", "Bytes copied from staging to another filesystem")
+            .add(copied);
+    }
+}
+
+Mover::Mover(uint64_t bytes_per_second) : bytes_per_second_(bytes_per_second), pool_(1) {}
+
+void Mover::enqueue(const std::string& from, const std::string& to, Done done) {
+    pending_++;
+    pool_.submit([this, from, to, done] {
+        std::string error;
+        try {
+            move(from, to, bytes_per_second_);
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        if (done) {
+            done(to, error);
+        } else if (!error.empty()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            failures_.push_back(error);
+        }
+        pending_--;
+    });
+}
+
+std::vector<std::string> Mover::wait() {
+    pool_.wait();
+    std::vector<std::string> failures;
+    std::lock_guard<std::mutex> lock(mutex_);
+    failures.swap(failures_);
+    return failures;
+}
+
+void Mover::move(const std::string& from, const std::string& to, uint64_t bytes_per_second) {
+    metrics::StageTimer timer("move");
+    trace::Span span("disk", "move", to);
+
+    std::error_code ec;
+    fs::path parent = fs::path(to).parent_path();
+    if (!parent.empty()) {
+        fs::create_directories(parent, ec);
+    }
+    auto& registry = metrics::Registry::instance();
+    if (rename(from.c_str(), to.c_str()) == 0) {
+        registry.counter("yarrharr_mover_files_total", "Files moved from staging to the library", "method=\"rename\"")
+            .add();
+        return;
+    }
+    if (errno != EXDEV) {
+        throw std::runtime_error(systemError("Failed to move " + from + " to " + to));
+    }
+    copyAcross(from, to, bytes_per_second);
+    registry.counter("yarrharr_mover_files_total", "Files moved from staging to the library", "method=\"copy\"").add();
+}
@@ -0,0 +1,278 @@
+#include "process.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <poll.h>
+#include <spawn.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace {
+    std::atomic<uint64_t> cancel_generation{0};
+
+    // Serializes pipe creation with spawning so one child never inherits
+    // the write end of another child's pipe before it is marked close-on-exec
+    std::mutex spawn_mutex;
+
+    std::mutex slot_mutex;
+    std::condition_variable slot_cv;
+    size_t slots_used = 0;
+    std::atomic<size_t> slot_limit{0};
+
+    size_t defaultLimit() {
+        // ffmpeg only remuxes here (-c copy), so jobs are bound by disk more
+        // than CPU; a few at a time keeps the disk streaming sequentially
+        size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        return std::min<size_t>(4, std::max<size_t>(1, cores / 2));
+    }
+
+    class Slot {
+    public:
+        template <typename Cancelled>
+        explicit Slot(Cancelled cancelled) {
+            std::unique_lock<std::mutex> lock(slot_mutex);
+            while (slots_used >= process::limit()) {
+                if (cancelled()) return;
+                slot_cv.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            slots_used++;
+            acquired_ = true;
+        }
+
+        ~Slot() {
+            if (!acquired_) return;
+            {
+                std::lock_guard<std::mutex> lock(slot_mutex);
+                slots_used--;
+            }
+            slot_cv.notify_one();
+        }
+
+        bool acquired() const { return acquired_; }
+
+    private:
+        bool acquired_ = false;
+    };
+
+    bool isExecutable(const std::string& path) {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode) && access(path.c_str(), X_OK) == 0;
+    }
+
+    pid_t spawn(const std::string& path, const std::vector<std::string>& argv, bool inheritStderr, int stdoutFd,
+                int& readFd) {
+        std::lock_guard<std::mutex> lock(spawn_mutex);
+
+        int out[2];
+        if (pipe(out) != 0) {
+            throw ProcessError(std::string("pipe: ") + std::strerror(errno));
+        }
+        fcntl(out[0], F_SETFD, FD_CLOEXEC);
+        fcntl(out[1], F_SETFD, FD_CLOEXEC);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        posix_spawn_file_actions_adddup2(&actions, stdoutFd >= 0 ? stdoutFd : out[1], STDOUT_FILENO);
+        if (!inheritStderr) {
+            posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+        }
+
+        // The daemon installs SIGINT/SIGTERM handlers and libraries may
+        // ignore SIGPIPE; children start from the defaults
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t defaults;
+        sigemptyset(&defaults);
+        sigaddset(&defaults, SIGINT);
+        sigaddset(&defaults, SIGTERM);
+        sigaddset(&defaults, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        sigset_t mask;
+        sigemptyset(&mask);
+        posix_spawnattr_setsigmask(&attr, &mask);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+        std::vector<char*> args;
+        for (const auto& arg : argv) {
+            args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        args.push_back(nullptr);
+
+        pid_t pid;
+        int error = posix_spawn(&pid, path.c_str(), &actions, &attr, args.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        close(out[1]);
+
+        if (error != 0) {
+            close(out[0]);
+            throw ProcessError("Failed to start " + argv[0] + ": " + std::strerror(error));
+        }
+        readFd = out[0];
+        return pid;
+    }
+
+    int exitCode(int status) {
+        if (WIFEXITED(status)) return WEXITSTATUS(status);
+        if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+        return -1;
+    }
+
+    int reap(pid_t pid) {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        return exitCode(status);
+    }
+}
+
+namespace process {
+    std::string findProgram(const std::string& name) {
+        static std::mutex mutex;
+        static std::map<std::string, std::string> cache;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = cache.find(name);
+        if (it != cache.end()) {
+            return it->second;
+        }
+
+        std::string found;
+        if (name.find('/') != std::string::npos) {
+            if (isExecutable(name)) found = name;
+        } else if (const char* path = std::getenv("PATH")) {
+            std::stringstream dirs(path);
+            std::string dir;
+            while (std::getline(dirs, dir, ':')) {
+                std::string candidate = (dir.empty() ? "." : dir) + "/" + name;
+                if (isExecutable(candidate)) {
+                    found = candidate;
+                    break;
+                }
+            }
+        }
+        cache[name] = found;
+        return found;
+    }
+
+    Result run(const std::vector<std::string>& argv, const Options& options) {
+        if (argv.empty()) {
+            throw ProcessError("No program to run");
+        }
+        std::string path = findProgram(argv[0]);
+        if (path.empty()) {
+            throw ProcessError(argv[0] + " not found in PATH");
+        }
+
+        uint64_t generation = cancel_generation.load();
+        auto cancelled = [&] {
+            return cancel_generation.load() != generation || (options.cancel && options.cancel->load());
+        };
+
+        Result result;
+        Slot slot(cancelled);
+        if (!slot.acquired()) {
+            result.cancelled = true;
+            return result;
+        }
+
+        int fd = -1;
+        pid_t pid = spawn(path, argv, options.inherit_stderr, options.stdout_fd, fd);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (options.stdout_fd >= 0) {
+            // Nothing to read, so only the child's exit ends the run
+            close(fd);
+            fd = -1;
+        }
+
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point terminatedAt;
+        bool killed = false;
+        std::string buffer;
+        char chunk[4096];
+        int status = 0;
+        bool exited = false;
+
+        try {
+            bool open = true;
+            while (open) {
+                if (!result.cancelled && cancelled()) {
+                    kill(pid, SIGTERM);
+                    result.cancelled = true;
+                    terminatedAt = Clock::now();
+                } else if (result.cancelled && !killed && Clock::now() - terminatedAt > std::chrono::seconds(5)) {
+                    kill(pid, SIGKILL);
+                    killed = true;
+                }
+
+                pollfd pfd{fd, POLLIN, 0};
+                int ready = ::poll(&pfd, fd >= 0 ? 1 : 0, 100);
+                if (ready < 0 && errno != EINTR) break;
+                if (ready == 0) {
+                    // Anything the child started may still hold the pipe
+                    // open, so its exit ends the run rather than EOF
+                    exited = waitpid(pid, &status, WNOHANG) == pid;
+                    open = !exited;
+                }
+                if (ready <= 0) continue;
+
+                while (true) {
+                    ssize_t n = read(fd, chunk, sizeof(chunk));
+                    if (n > 0) {
+                        buffer.append(chunk, n);
+                        size_t newline;
+                        while ((newline = buffer.find('\n')) != std::string::npos) {
+                            std::string line = buffer.substr(0, newline);
+                            buffer.erase(0, newline + 1);
+                            if (options.on_line) options.on_line(line);
+                        }
+                    } else if (n < 0 && errno == EINTR) {
+                        continue;
+                    } else {
+                        open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+                        break;
+                    }
+                }
+            }
+            if (!buffer.empty() && options.on_line) {
+                options.on_line(buffer);
+            }
+        } catch (...) {
+            kill(pid, SIGKILL);
+            if (fd >= 0) close(fd);
+            if (!exited) reap(pid);
+            throw;
+        }
+
+        if (fd >= 0) close(fd);
+        result.exit_code = exited ? exitCode(status) : reap(pid);
+        return result;
+    }
+
+    void setLimit(size_t jobs) {
+        slot_limit = jobs;
+        slot_cv.notify_all();
+    }
+
+    size_t limit() {
+        size_t jobs = slot_limit.load();
+        return jobs == 0 ? defaultLimit() : jobs;
+    }
+
+    void cancelAll() {
+        cancel_generation++;
+    }
+}
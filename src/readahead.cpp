@@ -0,0 +1,69 @@
+#include "readahead.hpp"
+#include "concurrency.hpp"
+#include "metrics.hpp"
+#include "worker_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <thread>
+
+Readahead::Readahead(size_t parallel, size_t window, int attempts)
+    : parallel_(std::max<size_t>(parallel, 1)), window_(std::max<size_t>(window, 1)),
+      attempts_(std::max(attempts, 1)) {}
+
+bool Readahead::run(size_t count, const Fetch& fetch, const Deliver& deliver) {
+    // Declared before the pool, which drains its queue on the way out
+    std::atomic<bool> stopped{false};
+    WorkerPool pool(std::min(controller_ ? controller_->maxLimit() : parallel_, std::max<size_t>(count, 1)));
+    std::deque<std::future<std::string>> inflight;
+
+    auto submit = [&](size_t index) {
+        inflight.push_back(pool.async([this, &fetch, &stopped, index] {
+            ConcurrencyController::Slot slot(controller_);
+            for (int attempt = 1;; attempt++) {
+                if (stopped) {
+                    return std::string();
+                }
+                try {
+                    std::string piece = fetch(index);
+                    slot.transferred(piece.size());
+                    return piece;
+                } catch (const std::exception&) {
+                    slot.fail();
+                    if (attempt >= attempts_) {
+                        throw;
+                    }
+                }
+                metrics::Registry::instance()
+                    .counter("yarrharr_stream_retries_total", "Stream pieces fetched again after a failure")
+                    .add();
+                std::this_thread::sleep_for(std::chrono::milliseconds(200 * attempt));
+            }
+        }));
+    };
+
+    try {
+        size_t submitted = 0;
+        for (size_t next = 0; next < count; next++) {
+            size_t window = controller_ ? std::max(window_, 2 * controller_->limit()) : window_;
+            while (submitted < count && submitted < next + window) {
+                submit(submitted++);
+            }
+            std::string piece = inflight.front().get();
+            inflight.pop_front();
+            if (controller_) {
+                controller_->tick();
+            }
+            if (!deliver(piece)) {
+                stopped = true;
+                return false;
+            }
+        }
+    } catch (...) {
+        stopped = true;
+        throw;
+    }
+    return true;
+}
@@ -0,0 +1,313 @@
+#include "search_index.hpp"
+#include "config.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    constexpr char MAGIC[8] = {'Y', 'H', 'I', 'D', 'X', '0', '0', '1'};
+
+    struct Header {
+        char magic[8];
+        uint32_t entry_count;
+        uint32_t trigram_count;
+        uint32_t posting_count;
+        uint32_t strings_size;
+    };
+
+    struct EntryRecord {
+        uint32_t id_off;
+        uint32_t title_off;
+        uint16_t id_len;
+        uint16_t title_len;
+        uint16_t year;
+        uint8_t media_type;  // 0 = movie, 1 = tv
+        uint8_t reserved;
+        uint32_t trigram_count;
+    };
+
+    struct TrigramRecord {
+        uint32_t trigram;
+        uint32_t postings_off;
+        uint32_t postings_len;
+    };
+
+    std::string normalize(const std::string& text) {
+        std::string result = " ";
+        for (unsigned char c : text) {
+            if (std::isalnum(c)) {
+                result += static_cast<char>(std::tolower(c));
+            } else if (result.back() != ' ') {
+                result += ' ';
+            }
+        }
+        if (result.back() != ' ') {
+            result += ' ';
+        }
+        return result;
+    }
+
+    std::vector<uint32_t> trigrams(const std::string& normalized) {
+        std::vector<uint32_t> result;
+        for (size_t i = 0; i + 3 <= normalized.size(); i++) {
+            result.push_back((static_cast<uint8_t>(normalized[i]) << 16) |
+                             (static_cast<uint8_t>(normalized[i + 1]) << 8) |
+                              static_cast<uint8_t>(normalized[i + 2]));
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    IndexEntry entryAt(const EntryRecord& record, const char* strings) {
+        IndexEntry entry;
+        entry.media_type = record.media_type == 0 ? "movie" : "tv";
+        entry.id.assign(strings + record.id_off, record.id_len);
+        entry.title.assign(strings + record.title_off, record.title_len);
+        entry.year = record.year ? std::to_string(record.year) : "";
+        return entry;
+    }
+}
+
+SearchIndex::SearchIndex(const std::string& path) : path_(path) {
+    map();
+}
+
+SearchIndex::~SearchIndex() {
+    try {
+        flush();
+    } catch (...) {
+    }
+    unmap();
+}
+
+std::string SearchIndex::getIndexPath() {
+    return Config::getDataPath("search.idx");
+}
+
+void SearchIndex::map() {
+    int fd = open(path_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(Header))) {
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            data_ = static_cast<const char*>(mapped);
+            size_ = st.st_size;
+        }
+    }
+    close(fd);
+
+    if (data_ && !valid()) {
+        unmap();
+    }
+}
+
+// search() and entries() trust the counts and offsets, so a truncated or
+// corrupt file is rejected here rather than read past the mapping
+bool SearchIndex::valid() const {
+    const auto* header = reinterpret_cast<const Header*>(data_);
+    if (std::memcmp(data_, MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+    uint64_t expected = sizeof(Header) + uint64_t(header->entry_count) * sizeof(EntryRecord) +
+                        uint64_t(header->trigram_count) * sizeof(TrigramRecord) +
+                        uint64_t(header->posting_count) * sizeof(uint32_t) + header->strings_size;
+    if (expected != size_) {
+        return false;
+    }
+
+    const auto* records = reinterpret_cast<const EntryRecord*>(data_ + sizeof(Header));
+    const auto* grams = reinterpret_cast<const TrigramRecord*>(records + header->entry_count);
+    const auto* postings = reinterpret_cast<const uint32_t*>(grams + header->trigram_count);
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        if (uint64_t(records[i].id_off) + records[i].id_len > header->strings_size ||
+            uint64_t(records[i].title_off) + records[i].title_len > header->strings_size) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->trigram_count; i++) {
+        if (uint64_t(grams[i].postings_off) + grams[i].postings_len > header->posting_count) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header->posting_count; i++) {
+        if (postings[i] >= header->entry_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SearchIndex::unmap() {
+    if (data_) {
+        munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+size_t SearchIndex::size() const {
+    if (!data_) return 0;
+    return reinterpret_cast<const Header*>(data_)->entry_count;
+}
+
+std::vector<IndexEntry> SearchIndex::entries() const {
+    std::vector<IndexEntry> result;
+    if (!data_) return result;
+
+    const auto* header = reinterpret_cast<const Header*>(data_);
+    const auto* records = reinterpret_cast<const EntryRecord*>(data_ + sizeof(Header));
+    const char* strings = data_ + sizeof(Header) +
+                          header->entry_count * sizeof(EntryRecord) +
+                          header->trigram_count * sizeof(TrigramRecord) +
+                          header->posting_count * sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        result.push_back(entryAt(records[i], strings));
+    }
+    return result;
+}
+
+std::vector<IndexEntry> SearchIndex::search(const std::string& query, size_t limit) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<IndexEntry> results;
+    if (!data_) return results;
+
+    const auto* header = reinterpret_cast<const Header*>(data_);
+    const auto* records = reinterpret_cast<const EntryRecord*>(data_ + sizeof(Header));
+    const auto* grams = reinterpret_cast<const TrigramRecord*>(records + header->entry_count);
+    const auto* postings = reinterpret_cast<const uint32_t*>(grams + header->trigram_count);
+    const char* strings = reinterpret_cast<const char*>(postings + header->posting_count);
+
+    std::string normalized = normalize(query);
+    auto queryGrams = trigrams(normalized);
+    if (queryGrams.empty()) return results;
+
+    std::vector<uint16_t> shared(header->entry_count, 0);
+    const TrigramRecord* gramsEnd = grams + header->trigram_count;
+    for (uint32_t gram : queryGrams) {
+        auto it = std::lower_bound(grams, gramsEnd, gram,
+            [](const TrigramRecord& record, uint32_t value) { return record.trigram < value; });
+        if (it == gramsEnd || it->trigram != gram) continue;
+        for (uint32_t i = 0; i < it->postings_len; i++) {
+            shared[postings[it->postings_off + i]]++;
+        }
+    }
+
+    // Weighted towards how much of the query was found, so typos and
+    // partial titles still match long entries
+    std::vector<std::pair<double, uint32_t>> scored;
+    for (uint32_t i = 0; i < header->entry_count; i++) {
+        if (!shared[i]) continue;
+        double score = 0.7 * shared[i] / queryGrams.size() +
+                       0.3 * shared[i] / std::max<uint32_t>(records[i].trigram_count, 1);
+        if (score >= 0.5) {
+            scored.emplace_back(score, i);
+        }
+    }
+
+    auto byScore = [](const auto& a, const auto& b) { return a.first > b.first; };
+    size_t candidates = std::min(scored.size(), limit * 4);
+    std::partial_sort(scored.begin(), scored.begin() + candidates, scored.end(), byScore);
+    scored.resize(candidates);
+
+    // Whole-phrase hits go first among the best candidates
+    for (auto& [score, i] : scored) {
+        std::string title = normalize(std::string(strings + records[i].title_off, records[i].title_len));
+        if (title.find(normalized) != std::string::npos) {
+            score += 0.5;
+        }
+    }
+    std::stable_sort(scored.begin(), scored.end(), byScore);
+    if (scored.size() > limit) {
+        scored.resize(limit);
+    }
+
+    for (const auto& [score, i] : scored) {
+        results.push_back(entryAt(records[i], strings));
+    }
+    return results;
+}
+
+void SearchIndex::add(const IndexEntry& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(entry);
+}
+
+void SearchIndex::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.empty()) return;
+    // The mapping may predate what another process wrote since
+    utils::FileLock fileLock(path_ + ".lock");
+    unmap();
+    map();
+
+    // Keyed by type and id so re-resolving a title replaces its old entry
+    std::map<std::pair<std::string, std::string>, IndexEntry> merged;
+    for (auto& entry : entries()) {
+        merged[{entry.media_type, entry.id}] = std::move(entry);
+    }
+    for (auto& entry : pending_) {
+        merged[{entry.media_type, entry.id}] = std::move(entry);
+    }
+    pending_.clear();
+
+    std::vector<EntryRecord> records;
+    std::map<uint32_t, std::vector<uint32_t>> inverted;
+    std::string strings;
+
+    for (const auto& [key, entry] : merged) {
+        EntryRecord record{};
+        record.id_off = strings.size();
+        record.id_len = entry.id.size();
+        strings += entry.id;
+        record.title_off = strings.size();
+        record.title_len = std::min<size_t>(entry.title.size(), UINT16_MAX);
+        strings.append(entry.title, 0, record.title_len);
+        record.year = entry.year.size() == 4 && std::isdigit(static_cast<unsigned char>(entry.year[0]))
+            ? static_cast<uint16_t>(std::stoi(entry.year)) : 0;
+        record.media_type = entry.media_type == "movie" ? 0 : 1;
+
+        auto grams = trigrams(normalize(entry.title));
+        record.trigram_count = grams.size();
+        for (uint32_t gram : grams) {
+            inverted[gram].push_back(records.size());
+        }
+        records.push_back(record);
+    }
+
+    std::vector<TrigramRecord> grams;
+    std::vector<uint32_t> postings;
+    for (const auto& [gram, ids] : inverted) {
+        grams.push_back({gram, static_cast<uint32_t>(postings.size()), static_cast<uint32_t>(ids.size())});
+        postings.insert(postings.end(), ids.begin(), ids.end());
+    }
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.entry_count = records.size();
+    header.trigram_count = grams.size();
+    header.posting_count = postings.size();
+    header.strings_size = strings.size();
+
+    std::string data(reinterpret_cast<const char*>(&header), sizeof(header));
+    data.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(EntryRecord));
+    data.append(reinterpret_cast<const char*>(grams.data()), grams.size() * sizeof(TrigramRecord));
+    data.append(reinterpret_cast<const char*>(postings.data()), postings.size() * sizeof(uint32_t));
+    data.append(strings.data(), strings.size());
+    utils::writeFileAtomically(path_, data);
+
+    unmap();
+    map();
+}
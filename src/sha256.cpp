@@ -0,0 +1,203 @@
+#include "sha256.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define YARRHARR_SHA_NI 1
+#endif
+
+namespace {
+    constexpr uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    inline uint32_t rotr(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+
+#ifdef YARRHARR_SHA_NI
+    // Downloads are hashed as they are written, so this runs at network
+    // speed; the SHA extensions are several times faster than the portable
+    // rounds
+    bool haveShaNi() {
+        unsigned a, b, c, d;
+        if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) || !(c & bit_SSSE3)) {
+            return false;
+        }
+        return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29));
+    }
+
+    __attribute__((target("sha,sse4.1,ssse3")))
+    void compressShaNi(uint32_t state[8], const uint8_t* data, size_t blocks) {
+        const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+        __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+        __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+        __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);     // ABEF
+        state1 = _mm_blend_epi16(state1, tmp, 0xF0);          // CDGH
+
+        for (; blocks > 0; blocks--, data += 64) {
+            __m128i abef = state0;
+            __m128i cdgh = state1;
+            __m128i msgs[4];
+
+#pragma GCC unroll 16
+            for (int g = 0; g < 16; g++) {
+                if (g < 4) {
+                    msgs[g] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + g * 16)), MASK);
+                }
+                __m128i msg = _mm_add_epi32(msgs[g % 4], _mm_loadu_si128(reinterpret_cast<const __m128i*>(&K[g * 4])));
+                state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+                if (g >= 3 && g <= 14) {
+                    __m128i& next = msgs[(g + 1) % 4];
+                    next = _mm_add_epi32(next, _mm_alignr_epi8(msgs[g % 4], msgs[(g + 3) % 4], 4));
+                    next = _mm_sha256msg2_epu32(next, msgs[g % 4]);
+                }
+                state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+                if (g >= 1 && g <= 12) {
+                    msgs[(g - 1) % 4] = _mm_sha256msg1_epu32(msgs[(g - 1) % 4], msgs[g % 4]);
+                }
+            }
+
+            state0 = _mm_add_epi32(state0, abef);
+            state1 = _mm_add_epi32(state1, cdgh);
+        }
+
+        tmp = _mm_shuffle_epi32(state0, 0x1B);                // FEBA
+        state1 = _mm_shuffle_epi32(state1, 0xB1);             // DCHG
+        state0 = _mm_blend_epi16(tmp, state1, 0xF0);          // DCBA
+        state1 = _mm_alignr_epi8(state1, tmp, 8);             // ABEF
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+    }
+#endif
+}
+
+Sha256::Sha256()
+    : state_{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19} {}
+
+void Sha256::transform(const uint8_t block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+               (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + K[i] + w[i];
+        uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+    state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+}
+
+void Sha256::compress(const uint8_t* data, size_t blocks) {
+#ifdef YARRHARR_SHA_NI
+    static const bool shaNi = haveShaNi();
+    if (shaNi) {
+        compressShaNi(state_, data, blocks);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < blocks; i++) {
+        transform(data + i * 64);
+    }
+}
+
+void Sha256::update(const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    length_ += length;
+
+    if (buffered_) {
+        size_t take = std::min(length, 64 - buffered_);
+        std::memcpy(buffer_ + buffered_, bytes, take);
+        buffered_ += take;
+        bytes += take;
+        length -= take;
+        if (buffered_ < 64) return;
+        compress(buffer_, 1);
+        buffered_ = 0;
+    }
+
+    compress(bytes, length / 64);
+    bytes += length / 64 * 64;
+    length %= 64;
+
+    std::memcpy(buffer_, bytes, length);
+    buffered_ = length;
+}
+
+void Sha256::digest(uint8_t out[32]) {
+    uint64_t bits = length_ * 8;
+    uint8_t pad = 0x80;
+    update(&pad, 1);
+    uint8_t zero = 0;
+    while (buffered_ != 56) {
+        update(&zero, 1);
+    }
+    uint8_t lengthBytes[8];
+    for (int i = 0; i < 8; i++) {
+        lengthBytes[i] = static_cast<uint8_t>(bits >> (56 - i * 8));
+    }
+    update(lengthBytes, 8);
+
+    for (int i = 0; i < 8; i++) {
+        out[i * 4] = static_cast<uint8_t>(state_[i] >> 24);
+        out[i * 4 + 1] = static_cast<uint8_t>(state_[i] >> 16);
+        out[i * 4 + 2] = static_cast<uint8_t>(state_[i] >> 8);
+        out[i * 4 + 3] = static_cast<uint8_t>(state_[i]);
+    }
+}
+
+std::string Sha256::hexDigest() {
+    static const char hex[] = "0123456789abcdef";
+    uint8_t raw[32];
+    digest(raw);
+
+    std::string result;
+    for (uint8_t byte : raw) {
+        result += hex[byte >> 4];
+        result += hex[byte & 0x0F];
+    }
+    return result;
+}
+
+std::string Sha256::hashFile(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        throw std::runtime_error("Failed to open file for hashing: " + path);
+    }
+
+    Sha256 hash;
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        hash.update(buffer, n);
+    }
+    fclose(fp);
+    return hash.hexDigest();
+}
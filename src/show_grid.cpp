@@ -0,0 +1,67 @@
+#include "show_grid.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+
+void printShowGrid(const EpisodeStore& episodes, int termWidth, std::ostream& out) {
+    std::map<int, EpisodeStore::Range> seasons;
+    for (int season : episodes.seasons()) {
+        seasons.emplace(season, episodes.season(season));
+    }
+
+    int numSeasons = seasons.size();
+    if (numSeasons == 0) return;
+    int colWidth = (termWidth / numSeasons) - 3;
+    int numWidth = 3; 
+
+    for (const auto& [season, _] : seasons) {
+        out << std::setw(colWidth) << std::left 
+                 << ("Season " + std::to_string(season));
+        if (season != seasons.rbegin()->first) 
+            out << " | ";
+    }
+    out << "\n";
+
+    for (size_t i = 0; i < seasons.size(); i++) {
+        out << std::string(colWidth, '-');
+        if (i < seasons.size() - 1) 
+            out << "-+-";
+    }
+    out << "\n";
+
+    size_t maxEpisodes = 0;
+    for (const auto& [_, range] : seasons) {
+        maxEpisodes = std::max(maxEpisodes, range.size());
+    }
+
+    for (size_t epIndex = 0; epIndex < maxEpisodes; epIndex++) {
+        std::vector<std::vector<std::string>> wrappedLines(seasons.size());
+        int maxWrappedLines = 1;
+
+        int colIndex = 0;
+        for (const auto& [season, range] : seasons) {
+            if (epIndex < range.size()) {
+                auto ep = range[epIndex];
+                std::string epText = utils::padNumber(ep.episode, 2) + ". " + std::string(ep.name);
+                wrappedLines[colIndex] = utils::wrapText(epText, colWidth - 1);
+                maxWrappedLines = std::max(maxWrappedLines, (int)wrappedLines[colIndex].size());
+            }
+            colIndex++;
+        }
+
+        for (int line = 0; line < maxWrappedLines; line++) {
+            colIndex = 0;
+            for (const auto& [season, range] : seasons) {
+                if (line < wrappedLines[colIndex].size()) {
+                    out << std::setw(colWidth) << std::left << wrappedLines[colIndex][line];
+                } else {
+                    out << std::setw(colWidth) << " ";
+                }
+                if (colIndex < numSeasons - 1) out << " | ";
+                colIndex++;
+            }
+            out << "\n";
+        }
+    }
+}
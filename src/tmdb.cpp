@@ -1,8 +1,13 @@
 #include "tmdb.hpp"
 #include "utils.hpp"
+#include "search_index.hpp"
+#include "http.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include <curl/curl.h>
 #include <sstream>
 #include <iostream>
+#include <stdexcept>
 
 
 static size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* userp) {
@@ -10,26 +15,30 @@ static size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::stri
     return size * nmemb;
 }
 
-TMDB::TMDB(const std::string& api_key) : api_key_(api_key) {}
+TMDB::TMDB(const std::string& api_key, const std::string& base_url) : api_key_(api_key), base_url_(base_url) {}
 
 std::string TMDB::makeRequest(const std::string& endpoint) {
+    trace::Span span("http", "tmdb", endpoint);
     
     CURL* curl = curl_easy_init();
     std::string readBuffer;
     
     if (curl) {
-        std::string url = "https://api.themoviedb.org/3" + endpoint + 
+        std::string url = base_url_ + endpoint + 
                          (endpoint.find('?') != std::string::npos ? "&" : "?") +
                          "api_key=" + api_key_;
         
         
         curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms_);
+        http::share(curl);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
         
         CURLcode res = curl_easy_perform(curl);
+        metrics::recordRequest(curl, "tmdb", res);
         if (res != CURLE_OK) {
-            std::cout << "CURL error: " << curl_easy_strerror(res) << std::endl;
+            std::cerr << "CURL error: " << curl_easy_strerror(res) << std::endl;
         }
         
         curl_easy_cleanup(curl);
@@ -39,16 +48,10 @@ std::string TMDB::makeRequest(const std::string& endpoint) {
 }
 
 std::vector<nlohmann::json> TMDB::search(const std::string& query) {
-    std::string encoded_query;
-    {
-        CURL* curl = curl_easy_init();
-        char* escaped = curl_easy_escape(curl, query.c_str(), query.length());
-        encoded_query = escaped;
-        curl_free(escaped);
-        curl_easy_cleanup(curl);
+    std::string response = makeRequest("/search/multi?query=" + utils::urlEncode(query));
+    if (response.empty()) {
+        throw std::runtime_error("No response from TMDB");
     }
-    
-    std::string response = makeRequest("/search/multi?query=" + encoded_query);
     auto json = nlohmann::json::parse(response);
     return json["results"].get<std::vector<nlohmann::json>>();
 }
@@ -78,18 +81,55 @@ Show TMDB::getShowDetails(const std::string& id) {
             if (!season.is_null() && season.contains("season_number")) {
                 auto season_num = season["season_number"].get<int>();
                 auto season_episodes = getSeasonEpisodes(id, season_num);
-                show.episodes.insert(show.episodes.end(), 
-                                   season_episodes.begin(), 
-                                   season_episodes.end());
+                for (const auto& episode : season_episodes) {
+                    show.episodes.add(episode);
+                }
             }
         }
     } else {
         std::cout << "No seasons data available" << std::endl;
     }
     
+    if (index_) {
+        index_->add({"tv", show.id, show.name, show.first_air_date.substr(0, 4)});
+    }
+    
     return show;
 }
 
+ShowStatus TMDB::getShowStatus(const std::string& id) {
+    std::string response = makeRequest("/tv/" + id);
+    auto json = nlohmann::json::parse(response);
+    
+    auto text = [](const nlohmann::json& object, const char* key) {
+        return object.contains(key) && object[key].is_string() ? object[key].get<std::string>() : std::string();
+    };
+    
+    ShowStatus status;
+    status.id = id;
+    status.name = json.contains("name") && !json["name"].is_null() ? json["name"].get<std::string>() : "Unknown";
+    status.status = text(json, "status");
+    
+    if (json.contains("last_episode_to_air") && json["last_episode_to_air"].is_object()) {
+        const auto& last = json["last_episode_to_air"];
+        status.last_season = last.value("season_number", 0);
+        status.last_episode = last.value("episode_number", 0);
+        status.last_air_date = text(last, "air_date");
+    }
+    if (json.contains("next_episode_to_air") && json["next_episode_to_air"].is_object()) {
+        status.next_air_date = text(json["next_episode_to_air"], "air_date");
+    }
+    if (json.contains("seasons") && json["seasons"].is_array()) {
+        for (const auto& season : json["seasons"]) {
+            if (season.is_object() && season["season_number"].is_number_integer()) {
+                status.seasons.push_back(season["season_number"].get<int>());
+            }
+        }
+    }
+    
+    return status;
+}
+
 Movie TMDB::getMovieDetails(const std::string& id) {
     std::string response = makeRequest("/movie/" + id);
     auto json = nlohmann::json::parse(response);
@@ -99,11 +139,65 @@ Movie TMDB::getMovieDetails(const std::string& id) {
     movie.title = json["title"].get<std::string>();
     movie.release_date = json["release_date"].get<std::string>();
     
+    if (index_) {
+        index_->add({"movie", movie.id, movie.title, movie.release_date.substr(0, 4)});
+    }
+    
     return movie;
 }
 
 std::vector<Episode> TMDB::getSeasonEpisodes(const std::string& show_id, int season) {
-    std::string response = makeRequest("/tv/" + show_id + "/season/" + std::to_string(season));
+    return parseSeasonEpisodes(makeRequest("/tv/" + show_id + "/season/" + std::to_string(season)), season);
+}
+
+std::vector<std::string> TMDB::getChangedShows(int64_t since, int64_t until) {
+    std::vector<std::string> ids;
+    int pages = 1;
+    for (int page = 1; page <= pages; page++) {
+        auto json = nlohmann::json::parse(makeRequest("/tv/changes?start_date=" + utils::formatDate(since) +
+                                                      "&end_date=" + utils::formatDate(until) +
+                                                      "&page=" + std::to_string(page)));
+        pages = json.value("total_pages", 1);
+        for (const auto& result : json["results"]) {
+            if (result.is_object() && result["id"].is_number_integer()) {
+                ids.push_back(std::to_string(result["id"].get<int64_t>()));
+            }
+        }
+    }
+    return ids;
+}
+
+ShowChanges TMDB::getShowChanges(const std::string& id, int64_t since) {
+    auto json = nlohmann::json::parse(makeRequest("/tv/" + id + "/changes?start_date=" + utils::formatDate(since)));
+
+    // start_date only has day resolution, so edits already seen that day
+    // come back too and are dropped by their timestamp
+    ShowChanges changes;
+    if (!json.contains("changes") || !json["changes"].is_array()) {
+        return changes;
+    }
+    for (const auto& change : json["changes"]) {
+        std::string key = change.value("key", "");
+        for (const auto& item : change.value("items", nlohmann::json::array())) {
+            int64_t time = utils::parseDate(item.value("time", ""));
+            if (time != 0 && time <= since) {
+                continue;
+            }
+            changes.changed = true;
+            if (key != "season") {
+                continue;
+            }
+            for (const char* field : {"value", "original_value"}) {
+                if (item.contains(field) && item[field].is_object() && item[field]["season_number"].is_number_integer()) {
+                    changes.seasons.insert(item[field]["season_number"].get<int>());
+                }
+            }
+        }
+    }
+    return changes;
+}
+
+std::vector<Episode> TMDB::parseSeasonEpisodes(const std::string& response, int season) {
     auto json = nlohmann::json::parse(response);
     
     std::vector<Episode> episodes;
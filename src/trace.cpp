@@ -0,0 +1,149 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace {
+    constexpr size_t CAPACITY = 8192;
+
+    struct Event {
+        const char* category;
+        const char* name;
+        std::string detail;
+        uint64_t start;
+        uint64_t duration;
+    };
+
+    // Owned by one thread; the mutex is only contended while a session is
+    // being written out
+    struct Buffer {
+        std::mutex mutex;
+        std::vector<Event> events;
+        size_t next = 0;
+        uint64_t dropped = 0;
+        int tid = 0;
+        std::string name;
+    };
+
+    std::mutex registry_mutex;
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    int next_tid = 1;
+    // steady_clock ticks when the session started; published with release
+    // so a span that sees tracing on also sees the epoch it started at
+    std::atomic<int64_t> epoch{std::chrono::steady_clock::now().time_since_epoch().count()};
+
+    // Named before the thread records anything; buffers are only created
+    // for threads that do, so untraced runs register none
+    thread_local std::string thread_name;
+    thread_local Buffer* thread_buffer = nullptr;
+
+    Buffer& localBuffer() {
+        thread_local std::shared_ptr<Buffer> buffer = [] {
+            auto created = std::make_shared<Buffer>();
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            created->tid = next_tid++;
+            created->name = thread_name.empty() ? "thread " + std::to_string(created->tid) : thread_name;
+            buffers.push_back(created);
+            return created;
+        }();
+        thread_buffer = buffer.get();
+        return *buffer;
+    }
+
+    uint64_t nowMicros() {
+        std::chrono::steady_clock::time_point start{
+            std::chrono::steady_clock::duration(epoch.load(std::memory_order_acquire))};
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+
+    void record(Event event) {
+        Buffer& buffer = localBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        if (buffer.events.size() < CAPACITY) {
+            buffer.events.push_back(std::move(event));
+        } else {
+            // Keep the most recent window rather than the start of the run
+            buffer.events[buffer.next] = std::move(event);
+            buffer.next = (buffer.next + 1) % CAPACITY;
+            buffer.dropped++;
+        }
+    }
+}
+
+namespace trace {
+    std::atomic<bool> active{false};
+
+    void setThreadName(const std::string& name) {
+        thread_name = name;
+        if (thread_buffer) {
+            std::lock_guard<std::mutex> lock(thread_buffer->mutex);
+            thread_buffer->name = name;
+        }
+    }
+
+    Span::Span(const char* category, const char* name, const std::string& detail)
+        : category_(category), name_(name) {
+        if (!enabled()) return;
+        detail_ = detail;
+        start_ = nowMicros() + 1;
+    }
+
+    Span::~Span() {
+        // start_ stays 0 for spans opened while tracing was off
+        if (start_ == 0 || !enabled()) return;
+        uint64_t start = start_ - 1;
+        record({category_, name_, std::move(detail_), start, nowMicros() - start});
+    }
+
+    Session::Session(const std::string& path) : path_(path) {
+        if (path_.empty()) return;
+        epoch.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_release);
+        active = true;
+    }
+
+    Session::~Session() {
+        if (path_.empty()) return;
+        active = false;
+
+        nlohmann::json events = nlohmann::json::array();
+        uint64_t dropped = 0;
+        std::lock_guard<std::mutex> registryLock(registry_mutex);
+        for (const auto& buffer : buffers) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            events.push_back({
+                {"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", buffer->tid},
+                {"args", {{"name", buffer->name}}}
+            });
+            for (const auto& event : buffer->events) {
+                nlohmann::json entry = {
+                    {"name", event.name}, {"cat", event.category}, {"ph", "X"},
+                    {"ts", event.start}, {"dur", event.duration}, {"pid", 1}, {"tid", buffer->tid}
+                };
+                if (!event.detail.empty()) {
+                    entry["args"] = {{"detail", event.detail}};
+                }
+                events.push_back(std::move(entry));
+            }
+            dropped += buffer->dropped;
+            buffer->events.clear();
+            buffer->next = 0;
+            buffer->dropped = 0;
+        }
+        // Threads that exited since are written out; drop their buffers
+        buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                                     [](const std::shared_ptr<Buffer>& buffer) { return buffer.use_count() == 1; }),
+                      buffers.end());
+
+        std::ofstream file(path_, std::ios::trunc);
+        file << nlohmann::json{
+            {"traceEvents", events},
+            {"displayTimeUnit", "ms"},
+            {"otherData", {{"dropped_events", dropped}}}
+        }.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    }
+}
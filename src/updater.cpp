@@ -0,0 +1,204 @@
+#include "updater.hpp"
+#include "version.hpp"
+#include "delta.hpp"
+#include "sha256.hpp"
+#include "download_utils.hpp"
+#include <curl/curl.h>
+#include <filesystem>
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+    const std::string RELEASES_URL = "https://github.com/asleepynerd/yarrharr/releases/download/v";
+
+    struct HashingFile {
+        FILE* fp;
+        Sha256 hash;
+    };
+
+    size_t hashingWriteCallback(void* ptr, size_t size, size_t nmemb, void* userdata) {
+        auto* out = static_cast<HashingFile*>(userdata);
+        out->hash.update(ptr, size * nmemb);
+        return fwrite(ptr, size, nmemb, out->fp);
+    }
+
+    size_t stringWriteCallback(void* ptr, size_t size, size_t nmemb, void* userdata) {
+        static_cast<std::string*>(userdata)->append(static_cast<char*>(ptr), size * nmemb);
+        return size * nmemb;
+    }
+
+    // Small release assets (checksums, patches); returns the HTTP status, or 0
+    // if the request didn't complete
+    long fetch(const std::string& url, std::string& body) {
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            return 0;
+        }
+
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stringWriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 15L);
+
+        long http_code = 0;
+        if (curl_easy_perform(curl) == CURLE_OK) {
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+        }
+        curl_easy_cleanup(curl);
+        return http_code;
+    }
+
+    fs::path currentExecutable(const char* execPath) {
+        std::error_code ec;
+        fs::path self = fs::canonical("/proc/self/exe", ec);
+        if (!ec) {
+            return self;
+        }
+        return fs::canonical(fs::path(execPath));
+    }
+
+    bool applyDelta(const std::string& url, const fs::path& currentExe, const fs::path& staged,
+                    const std::string& expected) {
+        std::string body;
+        if (fetch(url, body) != 200) {
+            return false;
+        }
+
+        try {
+            std::vector<uint8_t> patch(body.begin(), body.end());
+            auto updated = delta::apply(delta::readFile(currentExe.string()), patch);
+
+            if (!expected.empty()) {
+                Sha256 hash;
+                hash.update(updated.data(), updated.size());
+                if (hash.hexDigest() != expected) {
+                    throw DeltaError("Patched binary does not match the published checksum");
+                }
+            }
+
+            delta::writeFile(staged.string(), updated);
+            std::cout << "Applied delta update (" << body.size() << " bytes downloaded for a "
+                      << updated.size() << " byte binary)\n";
+            return true;
+        } catch (const std::exception& e) {
+            // DeltaError, or a corrupt patch running out of memory
+            std::cerr << "Delta update not usable (" << e.what() << "), downloading the full binary\n";
+            fs::remove(staged);
+            return false;
+        }
+    }
+
+    void downloadFull(const std::string& url, const fs::path& staged, const std::string& expected) {
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            throw std::runtime_error("Failed to initialize download");
+        }
+
+        HashingFile out{fopen(staged.string().c_str(), "wb"), Sha256()};
+        if (!out.fp) {
+            curl_easy_cleanup(curl);
+            throw std::runtime_error("Failed to create " + staged.string());
+        }
+
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, hashingWriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progressCallback);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+
+        CURLcode res = curl_easy_perform(curl);
+        fflush(out.fp);
+        fsync(fileno(out.fp));
+        fclose(out.fp);
+        curl_easy_cleanup(curl);
+        std::cout << std::endl;
+
+        if (res != CURLE_OK) {
+            fs::remove(staged);
+            throw std::runtime_error("Failed to download update");
+        }
+
+        std::string actual = out.hash.hexDigest();
+        if (expected.empty()) {
+            std::cerr << "Warning: no checksum published for this release, skipping verification\n";
+        } else if (actual != expected) {
+            fs::remove(staged);
+            throw std::runtime_error("Downloaded binary failed checksum verification");
+        }
+    }
+}
+
+namespace updater {
+    std::string platformName() {
+        #if defined(__APPLE__)
+            #if defined(__arm64__)
+                return "macos-arm64";
+            #else
+                return "macos-x86_64";
+            #endif
+        #elif defined(__linux__)
+            #if defined(__aarch64__)
+                return "linux-aarch64";
+            #else
+                return "linux-x86_64";
+            #endif
+        #else
+            return "";
+        #endif
+    }
+
+    bool updateBinary(const char* execPath) {
+        try {
+            std::string latestVersion = version::getLatestVersion();
+            if (!version::isVersionNewer(latestVersion, std::string(version::CURRENT_VERSION))) {
+                std::cout << "You are already running the latest version (" << version::CURRENT_VERSION << ").\n";
+                return true;
+            }
+
+            const std::string platform = platformName();
+            if (platform.empty()) {
+                std::cerr << "Unsupported platform for auto-update\n";
+                return false;
+            }
+
+            // Staged beside the executable so the final rename never
+            // crosses a filesystem boundary
+            fs::path currentExe = currentExecutable(execPath);
+            fs::path staged = currentExe.parent_path() / ("." + currentExe.filename().string() + ".new");
+
+            std::cout << "Downloading update " << version::CURRENT_VERSION << " → " << latestVersion << "...\n";
+
+            std::string assetUrl = RELEASES_URL + latestVersion + "/yarrharr-" + platform;
+            std::string expected;
+            std::string checksumBody;
+            if (fetch(assetUrl + ".sha256", checksumBody) == 200 && checksumBody.size() >= 64) {
+                expected = checksumBody.substr(0, 64);
+            }
+
+            std::string deltaUrl = assetUrl + "-" + std::string(version::CURRENT_VERSION) + ".delta";
+            if (!applyDelta(deltaUrl, currentExe, staged, expected)) {
+                downloadFull(assetUrl, staged, expected);
+            }
+
+            fs::permissions(staged, 
+                fs::perms::owner_exec | fs::perms::owner_read | fs::perms::owner_write |
+                fs::perms::group_exec | fs::perms::group_read |
+                fs::perms::others_exec | fs::perms::others_read);
+
+            fs::rename(staged, currentExe);
+
+            std::cout << "Update complete! Please restart yarrharr.\n";
+            return true;
+
+        } catch (const std::exception& e) {
+            std::cerr << "Update failed: " << e.what() << "\n";
+            return false;
+        }
+    }
+}
@@ -4,6 +4,17 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
@@ -104,4 +115,134 @@ std::string padNumber(int num, int width) {
     return ss.str();
 }
 
-}
\ No newline at end of file
+std::string urlEncode(const std::string& text) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string result;
+    result.reserve(text.size() * 3);
+    for (unsigned char c : text) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            result += static_cast<char>(c);
+        } else {
+            result += '%';
+            result += hex[c >> 4];
+            result += hex[c & 0x0F];
+        }
+    }
+    return result;
+}
+
+std::string formatDate(int64_t time) {
+    std::time_t t = static_cast<std::time_t>(time);
+    std::tm tm{};
+    gmtime_r(&t, &tm);
+    char date[16];
+    std::strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+    return date;
+}
+
+int64_t parseDate(const std::string& text) {
+    std::tm tm{};
+    if (text.size() < 10 || sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 3) {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return timegm(&tm);
+}
+
+timespec accessTime(const struct stat& st) {
+#ifdef __APPLE__
+    return st.st_atimespec;
+#else
+    return st.st_atim;
+#endif
+}
+
+timespec modifyTime(const struct stat& st) {
+#ifdef __APPLE__
+    return st.st_mtimespec;
+#else
+    return st.st_mtim;
+#endif
+}
+
+int prepareSocket(int fd) {
+    if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    }
+    return fd;
+}
+
+int sendFlags() {
+#ifdef MSG_NOSIGNAL
+    return MSG_NOSIGNAL;
+#else
+    return 0;
+#endif
+}
+
+void writeFileAtomically(const std::string& path, const std::string& data) {
+    std::string tempPath = path + ".XXXXXX";
+    int fd = mkstemp(tempPath.data());
+    if (fd < 0) {
+        throw std::runtime_error("Failed to write " + path + ": " + std::strerror(errno));
+    }
+    auto fail = [&](const char* what) {
+        std::string reason = std::strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        unlink(tempPath.c_str());
+        throw std::runtime_error(std::string("Failed to ") + what + " " + path + ": " + reason);
+    };
+
+    // mkstemp creates the file 0600; keep the mode of the file being replaced
+    struct stat st{};
+    fchmod(fd, stat(path.c_str(), &st) == 0 ? st.st_mode & 07777 : 0644);
+
+    for (size_t written = 0; written < data.size();) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("write");
+        }
+        written += static_cast<size_t>(n);
+    }
+    if (fsync(fd) != 0) {
+        fail("sync");
+    }
+    int closed = close(fd);
+    fd = -1;
+    if (closed != 0) {
+        fail("write");
+    }
+    if (rename(tempPath.c_str(), path.c_str()) != 0) {
+        fail("replace");
+    }
+
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    int dir = open(parent.empty() ? "." : parent.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+}
+
+FileLock::FileLock(const std::string& path) : fd_(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600)) {
+    if (fd_ >= 0) {
+        flock(fd_, LOCK_EX);
+    }
+}
+
+FileLock::~FileLock() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+}
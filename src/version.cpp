@@ -1,9 +1,15 @@
 #include "version.hpp"
+#include "config.hpp"
+#include "utils.hpp"
 #include <curl/curl.h>
 #include <nlohmann/json.hpp>
 #include <iostream>
-#include <regex>
+#include <fstream>
 #include <filesystem>
+#include <chrono>
+#include <cstdlib>
+#include <cctype>
+#include <unistd.h>
 
 namespace {
     size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* userp) {
@@ -11,7 +17,12 @@ namespace {
         return size * nmemb;
     }
 
-    std::string fetchLatestRelease() {
+    int cancelCallback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+        return static_cast<const std::atomic<bool>*>(clientp)->load() ? 1 : 0;
+    }
+
+    std::string fetchLatestRelease(long timeout_ms = 10000, const std::atomic<bool>* cancelled = nullptr,
+                                   CURLcode* result = nullptr) {
         CURL* curl = curl_easy_init();
         std::string readBuffer;
         
@@ -22,9 +33,19 @@ namespace {
             curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
             
             curl_easy_setopt(curl, CURLOPT_USERAGENT, "YarrHarr-Version-Check");
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+            curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+            if (cancelled) {
+                curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cancelCallback);
+                curl_easy_setopt(curl, CURLOPT_XFERINFODATA, cancelled);
+                curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+            }
             
             CURLcode res = curl_easy_perform(curl);
             curl_easy_cleanup(curl);
+            if (result) {
+                *result = res;
+            }
             
             if (res != CURLE_OK) {
                 return "";
@@ -34,6 +55,52 @@ namespace {
         return readBuffer;
     }
 
+    bool parseVersion(const std::string& text, int parts[3]) {
+        size_t pos = 0;
+        for (int i = 0; i < 3; i++) {
+            if (pos >= text.size() || !std::isdigit(static_cast<unsigned char>(text[pos]))) {
+                return false;
+            }
+            parts[i] = 0;
+            while (pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos]))) {
+                parts[i] = parts[i] * 10 + (text[pos++] - '0');
+            }
+            if (i < 2 && (pos >= text.size() || text[pos++] != '.')) {
+                return false;
+            }
+        }
+        return pos == text.size();
+    }
+
+    std::string parseLatestVersion(const std::string& response) {
+        if (response.empty()) {
+            return "";
+        }
+        auto json = nlohmann::json::parse(response);
+        std::string tag_name = json["tag_name"];
+        if (!tag_name.empty() && tag_name[0] == 'v') {
+            tag_name = tag_name.substr(1);
+        }
+        return tag_name;
+    }
+
+    int64_t unixNow() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    std::string cachePath() {
+        return Config::getDataPath("update_check.json");
+    }
+
+    void writeCache(const std::string& latest) {
+        nlohmann::json j;
+        j["checked_at"] = unixNow();
+        j["latest_version"] = latest;
+
+        utils::writeFileAtomically(cachePath(), j.dump(4));
+    }
+
     bool isBrewInstall() {
         try {
             std::filesystem::path exePath = std::filesystem::canonical("/proc/self/exe");
@@ -44,23 +111,30 @@ namespace {
             return false;
         }
     }
+
+    void printNotice(const std::string& latestVersion) {
+        std::cout << "\nUpdate available! "
+                  << "Current version: " << version::CURRENT_VERSION
+                  << ", Latest version: " << latestVersion << "\n";
+
+        if (isBrewInstall()) {
+            std::cout << "To update, run: brew upgrade yarrharr\n\n";
+        } else {
+            std::cout << "To update, run: ./yarrharr update\n\n";
+        }
+    }
 }
 
 namespace version {
     bool isVersionNewer(const std::string& version1, const std::string& version2) {
-        std::regex version_regex(R"((\d+)\.(\d+)\.(\d+))");
-        std::smatch match1, match2;
-        
-        if (!std::regex_match(version1, match1, version_regex) ||
-            !std::regex_match(version2, match2, version_regex)) {
+        int v1[3], v2[3];
+        if (!parseVersion(version1, v1) || !parseVersion(version2, v2)) {
             return false;
         }
         
-        for (size_t i = 1; i <= 3; ++i) {
-            int v1 = std::stoi(match1[i].str());
-            int v2 = std::stoi(match2[i].str());
-            if (v1 != v2) {
-                return v1 > v2;
+        for (size_t i = 0; i < 3; ++i) {
+            if (v1[i] != v2[i]) {
+                return v1[i] > v2[i];
             }
         }
         
@@ -69,19 +143,12 @@ namespace version {
 
     std::string getLatestVersion() {
         try {
-            std::string response = fetchLatestRelease();
-            if (response.empty()) {
+            std::string latest = parseLatestVersion(fetchLatestRelease());
+            if (latest.empty()) {
                 return std::string(CURRENT_VERSION);
             }
-            
-            auto json = nlohmann::json::parse(response);
-            std::string tag_name = json["tag_name"];
-            
-            if (!tag_name.empty() && tag_name[0] == 'v') {
-                tag_name = tag_name.substr(1);
-            }
-            
-            return tag_name;
+            writeCache(latest);
+            return latest;
             
         } catch (const std::exception& e) {
             return std::string(CURRENT_VERSION);
@@ -98,15 +165,7 @@ namespace version {
             std::string latestVersion = getLatestVersion();
             
             if (isVersionNewer(latestVersion, std::string(CURRENT_VERSION))) {
-                std::cout << "\nUpdate available! "
-                          << "Current version: " << CURRENT_VERSION
-                          << ", Latest version: " << latestVersion << "\n";
-
-                if (isBrewInstall()) {
-                    std::cout << "To update, run: brew upgrade yarrharr\n\n";
-                } else {
-                    std::cout << "To update, run: ./yarrharr update\n\n";
-                }
+                printNotice(latestVersion);
                 return true;
             }
             
@@ -115,4 +174,72 @@ namespace version {
         
         return false;
     }
-} 
\ No newline at end of file
+
+    UpdateNotifier::UpdateNotifier(int interval_hours) {
+        if (interval_hours <= 0 || getenv("YARRHARR_NO_UPDATE_CHECK")) {
+            return;
+        }
+
+        int64_t checked_at = 0;
+        try {
+            std::ifstream file(cachePath());
+            if (file.is_open()) {
+                auto j = nlohmann::json::parse(file);
+                checked_at = j.value("checked_at", int64_t(0));
+                cached_latest_ = j.value("latest_version", "");
+            }
+        } catch (const std::exception&) {
+        }
+
+        // Scripts and pipes never touch the network; a terminal refreshes
+        // the cache in the background once it goes stale
+        bool stale = unixNow() - checked_at >= interval_hours * 3600LL;
+        if (!stale || !isatty(STDOUT_FILENO)) {
+            return;
+        }
+
+        refresh_ = std::make_shared<State>();
+        thread_ = std::thread([state = refresh_, previous = cached_latest_] {
+            std::string latest;
+            try {
+                CURLcode res = CURLE_OK;
+                latest = parseLatestVersion(fetchLatestRelease(3000, &state->cancelled, &res));
+                // A failed attempt is recorded too, so the next run doesn't
+                // go straight back to the network; one cut short on exit is
+                // not an attempt and is left for the next run
+                bool cancelled = res == CURLE_ABORTED_BY_CALLBACK || (latest.empty() && state->cancelled);
+                if (!cancelled) {
+                    writeCache(latest.empty() ? previous : latest);
+                }
+            } catch (const std::exception&) {
+            }
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->latest = latest;
+            state->done = true;
+            state->finished.notify_all();
+        });
+    }
+
+    UpdateNotifier::~UpdateNotifier() {
+        std::string latest = cached_latest_;
+        if (thread_.joinable()) {
+            // A short grace period, then the request is cancelled: the thread
+            // must be gone before static destructors run
+            bool done;
+            {
+                std::unique_lock<std::mutex> lock(refresh_->mutex);
+                done = refresh_->finished.wait_for(lock, std::chrono::milliseconds(250),
+                                                   [this] { return refresh_->done; });
+            }
+            refresh_->cancelled = true;
+            thread_.join();
+            if (done && !refresh_->latest.empty()) {
+                latest = refresh_->latest;
+            }
+        }
+
+        if (!latest.empty() && isVersionNewer(latest, std::string(CURRENT_VERSION))) {
+            printNotice(latest);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#include "worker_pool.hpp"
+#include "trace.hpp"
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t threads, size_t max_queued) : max_queued_(max_queued) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; i++) {
+        workers_.emplace_back([this] { run(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_cv_.wait(lock, [this] { return max_queued_ == 0 || tasks_.size() < max_queued_; });
+        tasks_.push(std::move(task));
+    }
+    task_cv_.notify_one();
+}
+
+void WorkerPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return tasks_.empty() && active_ == 0; });
+}
+
+void WorkerPool::run() {
+    trace::setThreadName("worker");
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop();
+            active_++;
+        }
+        space_cv_.notify_one();
+
+        try {
+            task();
+        } catch (...) {
+            // Tasks report their own failures; a throwing task must not
+            // take the worker down with it
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_--;
+            if (tasks_.empty() && active_ == 0) {
+                idle_cv_.notify_all();
+            }
+        }
+    }
+}